@@ -593,6 +593,15 @@ void BacklashComp::ApplyBacklashComp(unsigned int moveOptions, double yGuideDist
     m_lastDirection = dir;
 }
 
+int BacklashComp::GetCompPulse(unsigned int moveOptions, double yGuideDistance) const
+{
+    if (!(moveOptions & MOVEOPT_USE_BLC) || !m_compActive || m_pulseWidth <= 0 || yGuideDistance == 0.0)
+        return 0;
+
+    GUIDE_DIRECTION dir = yGuideDistance > 0.0 ? DOWN : UP;
+    return m_lastDirection != NONE && dir != m_lastDirection ? m_pulseWidth : 0;
+}
+
 // Class for implementing the backlash graph dialog
 class BacklashGraph : public wxDialog
 {
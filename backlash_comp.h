@@ -175,6 +175,8 @@ public:
 
     // apply a BLC adjustment to the given guide pulse (yAmount) if needed
     void ApplyBacklashComp(unsigned int moveOptions, double yGuideDistance, int *yAmount);
+    // the adjustment ApplyBacklashComp would make, without changing the BLC state
+    int GetCompPulse(unsigned int moveOptions, double yGuideDistance) const;
 
     void ResetBLCState();
 };
@@ -0,0 +1,506 @@
+/*
+ *  benchmark.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+#include "image_simd.h"
+#include "thread_pool.h"
+
+#include <wx/tokenzr.h>
+
+#include <random>
+#include <set>
+
+// synthetic frame: noisy background, a sprinkling of hot pixels and a few stars
+static void MakeTestFrame(usImage& img, int width, int height)
+{
+    img.Init(width, height);
+
+    unsigned int seed = 12345;
+    for (unsigned int i = 0; i < img.NPixels; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned int r = (seed >> 16) & 0x7fff;
+        unsigned short val = 1000 + (r & 0xff);
+        if ((r & 0x3ff) == 0)
+            val = 65000; // hot pixel
+        img.ImageData[i] = val;
+    }
+
+    for (int s = 0; s < 50; s++)
+    {
+        int cx = 20 + (s * 7919) % (width - 40);
+        int cy = 20 + (s * 104729) % (height - 40);
+        for (int y = -6; y <= 6; y++)
+            for (int x = -6; x <= 6; x++)
+            {
+                double r2 = x * x + y * y;
+                unsigned int v = img.Pixel(cx + x, cy + y) + (unsigned int)(20000.0 * exp(-r2 / 4.0));
+                img.Pixel(cx + x, cy + y) = (unsigned short) std::min(v, 65535U);
+            }
+    }
+
+    img.BitsPerPixel = 16;
+}
+
+// run fn repeatedly for at least minMs milliseconds, return the mean time per call in ms
+template<typename F>
+static double TimeIt(F fn, long minMs = 500)
+{
+    fn(); // warm-up
+
+    wxStopWatch swatch;
+    unsigned int n = 0;
+    long elapsed;
+    do
+    {
+        fn();
+        ++n;
+        elapsed = swatch.Time();
+    } while (elapsed < minMs);
+
+    return (double) elapsed / (double) n;
+}
+
+static void BenchMedian3()
+{
+    enum { W = 5496, H = 3672 }; // 20 MP
+
+    usImage src;
+    MakeTestFrame(src, W, H);
+
+    usImage ref;
+    ref.Init(src.Size);
+
+    usImage dst;
+    dst.Init(src.Size);
+
+    SimdLevel const prev = SimdGetLevel();
+    SimdLevel const levels[] = { SIMD_NONE, SIMD_SSE2, SIMD_AVX2, SIMD_NEON };
+
+    for (unsigned int i = 0; i < WXSIZEOF(levels); i++)
+    {
+        if (!SimdSetLevel(levels[i]))
+            continue;
+
+        usImage& out = levels[i] == SIMD_NONE ? ref : dst;
+
+        double ms = TimeIt([&]() { Median3(out.ImageData, src.View()); });
+
+        bool match = memcmp(out.ImageData, ref.ImageData, src.NPixels * sizeof(unsigned short)) == 0;
+
+        wxPrintf("median3   %-8s %dx%d  %8.2f ms  %8.1f Mpix/s%s\n", SimdLevelName(levels[i]), W, H,
+                 ms, (double) src.NPixels / (ms * 1000.0), match ? "" : "  MISMATCH");
+    }
+
+    SimdSetLevel(prev);
+}
+
+static void BenchCalcStats()
+{
+    enum { W = 5496, H = 3672 };
+
+    usImage img;
+    MakeTestFrame(img, W, H);
+
+    double ms = TimeIt([&]() { img.CalcStats(); });
+    wxPrintf("calcstats full          %dx%d  %8.2f ms  %8.1f Mpix/s\n", W, H, ms, (double) img.NPixels / (ms * 1000.0));
+
+    ms = TimeIt([&]() { img.CalcStats(false); });
+    wxPrintf("calcstats no-filt       %dx%d  %8.2f ms  %8.1f Mpix/s\n", W, H, ms, (double) img.NPixels / (ms * 1000.0));
+}
+
+// the original MedianFilter, which rebuilds the histogram at the start of
+// every row; kept as the baseline for the "medianfilter" benchmark
+static void MedianFilterRowInit(usImage& dst, const usImage& src, int halfWidth)
+{
+    dst.Init(src.Size);
+    unsigned short *d = &dst.ImageData[0];
+
+    int const width = src.Size.GetWidth();
+    int const height = src.Size.GetHeight();
+
+    std::vector<unsigned short> histo1(256);
+    std::vector<unsigned short> histo2(65536);
+
+    auto median = [&](unsigned int n) -> unsigned short {
+        n /= 2;
+        unsigned int i;
+        for (i = 0; i < 256; i++)
+        {
+            if (histo1[i] > n)
+                break;
+            n -= histo1[i];
+        }
+        for (i <<= 8; i < 65536; i++)
+        {
+            if (histo2[i] > n)
+                break;
+            n -= histo2[i];
+        }
+        return i;
+    };
+
+    for (int y = 0; y < height; y++)
+    {
+        int top = std::max(0, y - halfWidth);
+        int bot = std::min(y + halfWidth, height - 1);
+
+        std::fill(histo1.begin(), histo1.end(), 0);
+        std::fill(histo2.begin(), histo2.end(), 0);
+
+        for (int j = top; j <= bot; j++)
+        {
+            const unsigned short *p = &src.Pixel(0, j);
+            for (int i = 0; i <= halfWidth; i++, p++)
+            {
+                ++histo1[*p >> 8];
+                ++histo2[*p];
+            }
+        }
+        unsigned int n = (halfWidth + 1) * (bot - top + 1);
+
+        *d++ = median(n);
+
+        for (int i = 1; i < width; i++)
+        {
+            int left = std::max(0, i - halfWidth);
+            int right = std::min(i + halfWidth, width - 1);
+
+            if (left > 0)
+            {
+                const unsigned short *p = &src.Pixel(left - 1, top);
+                for (int j = top; j <= bot; j++, p += width)
+                {
+                    --histo1[*p >> 8];
+                    --histo2[*p];
+                }
+                n -= (bot - top + 1);
+            }
+
+            if (i + halfWidth <= width - 1)
+            {
+                const unsigned short *p = &src.Pixel(right, top);
+                for (int j = top; j <= bot; j++, p += width)
+                {
+                    ++histo1[*p >> 8];
+                    ++histo2[*p];
+                }
+                n += (bot - top + 1);
+            }
+
+            *d++ = median(n);
+        }
+    }
+}
+
+static void BenchMedianFilter()
+{
+    enum { W = 4096, H = 3000, HALF_WIDTH = 15 }; // same window as DefectMapDarks::BuildFilteredDark
+
+    usImage src;
+    MakeTestFrame(src, W, H);
+
+    usImage ref;
+    double ms = TimeIt([&]() { MedianFilterRowInit(ref, src, HALF_WIDTH); }, 0);
+    wxPrintf("medianfilter row-init   %dx%d  %8.2f ms\n", W, H, ms);
+    double const base = ms;
+
+    usImage dst;
+    unsigned int const threads[] = { 1, ThreadPool::Concurrency() };
+
+    for (unsigned int i = 0; i < WXSIZEOF(threads); i++)
+    {
+        if (i > 0 && threads[i] == threads[0])
+            break;
+
+        ThreadPool::SetMaxThreads(threads[i]);
+        ms = TimeIt([&]() { MedianFilter(dst, src, HALF_WIDTH); }, 0);
+
+        bool match = memcmp(dst.ImageData, ref.ImageData, src.NPixels * sizeof(unsigned short)) == 0;
+
+        wxPrintf("medianfilter %2u thread%s %dx%d  %8.2f ms  %5.2fx%s\n", threads[i], threads[i] == 1 ? " " : "s",
+                 W, H, ms, base / ms, match ? "" : "  MISMATCH");
+    }
+
+    ThreadPool::SetMaxThreads(0);
+}
+
+static void BenchStarFind()
+{
+    enum { W = 1024, H = 1024, CALLS = 100 };
+
+    usImage img;
+    MakeTestFrame(img, W, H);
+
+    // the second star placed by MakeTestFrame
+    int const cx = 20 + 7919 % (W - 40);
+    int const cy = 20 + 104729 % (H - 40);
+
+    SimdLevel const prev = SimdGetLevel();
+    SimdLevel const levels[] = { SIMD_NONE, SIMD_SSE2, SIMD_AVX2, SIMD_NEON };
+    int const regions[] = { 7, 10, 15, 20, 30, 40, 50 };
+
+    for (unsigned int r = 0; r < WXSIZEOF(regions); r++)
+    {
+        Star ref;
+
+        for (unsigned int i = 0; i < WXSIZEOF(levels); i++)
+        {
+            if (!SimdSetLevel(levels[i]))
+                continue;
+
+            Star star;
+            double ms = TimeIt([&]() {
+                for (int k = 0; k < CALLS; k++)
+                    star.Find(&img, regions[r], cx, cy, Star::FIND_CENTROID, 1.0, 10.0, 65535, Star::FIND_LOGGING_MINIMAL);
+            });
+
+            if (levels[i] == SIMD_NONE)
+                ref = star;
+            bool match = star.X == ref.X && star.Y == ref.Y && star.Mass == ref.Mass && star.SNR == ref.SNR &&
+                star.HFD == ref.HFD && star.PeakVal == ref.PeakVal;
+
+            wxPrintf("starfind  %-8s region %2d  %8.0f ns/call%s\n", SimdLevelName(levels[i]), regions[r],
+                     ms * 1e6 / CALLS, match ? "" : "  MISMATCH");
+        }
+    }
+
+    SimdSetLevel(prev);
+}
+
+// frame with a grid of stars at known sub-pixel positions, rendered like the
+// simulator's stars but as pixel-integrated Gaussians of the given FWHM, so
+// that undersampled stars can be modelled, on a background with Gaussian noise
+static void MakeStarField(usImage& img, double fwhm, double amplitude, std::vector<PHD_Point>& truth)
+{
+    enum { W = 512, H = 512, SPACING = 32, RADIUS = 8 };
+
+    img.Init(W, H);
+    img.BitsPerPixel = 16;
+
+    std::mt19937 rng(1);
+    std::normal_distribution<double> noise(0.0, 10.0);
+    std::uniform_real_distribution<double> frac(-0.5, 0.5);
+
+    std::vector<double> frame(img.NPixels);
+    for (unsigned int i = 0; i < img.NPixels; i++)
+        frame[i] = 1000.0 + noise(rng);
+
+    double const sigma = fwhm / 2.3548;
+    double const k = 1.0 / (sigma * sqrt(2.0));
+    double const flux = amplitude * 2.0 * M_PI * sigma * sigma;
+
+    // fraction of a unit Gaussian centered at c falling in pixel p
+    auto pixelFrac = [k](int p, double c) { return 0.5 * (erf((p + 0.5 - c) * k) - erf((p - 0.5 - c) * k)); };
+
+    truth.clear();
+    for (int gy = SPACING; gy < H - SPACING / 2; gy += SPACING)
+    {
+        for (int gx = SPACING; gx < W - SPACING / 2; gx += SPACING)
+        {
+            double const dx = frac(rng);
+            double const dy = frac(rng);
+            PHD_Point const c(gx + dx, gy + dy);
+            truth.push_back(c);
+
+            for (int y = gy - RADIUS; y <= gy + RADIUS; y++)
+            {
+                double const fy = pixelFrac(y, c.Y);
+                for (int x = gx - RADIUS; x <= gx + RADIUS; x++)
+                    frame[y * W + x] += flux * fy * pixelFrac(x, c.X);
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < img.NPixels; i++)
+        img.ImageData[i] = (unsigned short) std::min(std::max(frame[i] + 0.5, 0.0), 65535.0);
+}
+
+static void BenchPsfFit()
+{
+    double const fwhms[] = { 1.2, 1.8, 2.5, 4.0 };
+    double const amplitudes[] = { 300.0, 3000.0 };
+    Star::FindMode const modes[] = { Star::FIND_CENTROID, Star::FIND_PSF_FIT };
+    const char *const modeNames[] = { "centroid", "psf-fit" };
+
+    for (unsigned int f = 0; f < WXSIZEOF(fwhms); f++)
+    {
+        for (unsigned int a = 0; a < WXSIZEOF(amplitudes); a++)
+        {
+            usImage img;
+            std::vector<PHD_Point> truth;
+            MakeStarField(img, fwhms[f], amplitudes[a], truth);
+
+            for (unsigned int m = 0; m < WXSIZEOF(modes); m++)
+            {
+                // accuracy, starting each search at the nearest pixel
+                double sum2 = 0.0;
+                unsigned int found = 0;
+                for (const PHD_Point& c : truth)
+                {
+                    Star star;
+                    if (star.Find(&img, 7, ROUND(c.X), ROUND(c.Y), modes[m], 0.1, 20.0, 0, Star::FIND_LOGGING_MINIMAL))
+                    {
+                        sum2 += (star.X - c.X) * (star.X - c.X) + (star.Y - c.Y) * (star.Y - c.Y);
+                        ++found;
+                    }
+                }
+
+                double ms = TimeIt([&]() {
+                    Star star;
+                    for (const PHD_Point& c : truth)
+                        star.Find(&img, 7, ROUND(c.X), ROUND(c.Y), modes[m], 0.1, 20.0, 0, Star::FIND_LOGGING_MINIMAL);
+                });
+
+                wxPrintf("psffit  fwhm %.1f  peak %4.0f  %-8s  rms error %.4f px  %8.0f ns/call  %u/%u found\n",
+                         fwhms[f], amplitudes[a], modeNames[m], found ? sqrt(sum2 / found) : 0.0,
+                         ms * 1e6 / truth.size(), found, (unsigned int) truth.size());
+            }
+        }
+    }
+}
+
+// the original BinPixels template, with run-time loops for any binning
+// factor; kept as the baseline for the "binning" benchmark
+template<typename T>
+static void BinPixelsGeneric(T *dst, const T *src, const wxSize& srcsize, unsigned int binning)
+{
+    int const srcw = srcsize.x;
+    int const tw = (srcsize.x / binning) * binning;
+    int const th = (srcsize.y / binning) * binning;
+
+    for (int srcy = 0; srcy < th; srcy += binning)
+    {
+        for (int srcx = 0; srcx < tw; srcx += binning)
+        {
+            unsigned int sum = 0;
+            for (unsigned int j = 0; j < binning; j++)
+                for (unsigned int i = 0; i < binning; i++)
+                    sum += src[(srcy + j) * srcw + srcx + i];
+            *dst++ = sum / (binning * binning);
+        }
+    }
+}
+
+static void BenchBinning()
+{
+    enum { W = 5496, H = 3672 }; // 20 MP, divisible by 2, 3 and 4
+
+    usImage src;
+    MakeTestFrame(src, W, H);
+
+    std::vector<unsigned char> src8(src.NPixels);
+    for (unsigned int i = 0; i < src.NPixels; i++)
+        src8[i] = src.ImageData[i] >> 8;
+
+    SimdLevel const prev = SimdGetLevel();
+    SimdLevel const levels[] = { SIMD_NONE, SIMD_SSE2, SIMD_AVX2, SIMD_NEON };
+    unsigned int const binnings[] = { 2, 3, 4 };
+
+    for (unsigned int b = 0; b < WXSIZEOF(binnings); b++)
+    {
+        unsigned int const bin = binnings[b];
+        unsigned int const n = (W / bin) * (H / bin);
+        std::vector<unsigned short> ref(n), dst(n);
+        std::vector<unsigned char> tmp8(n);
+
+        double ms = TimeIt([&]() { BinPixelsGeneric(&ref[0], src.ImageData, src.Size, bin); });
+        wxPrintf("binning %ux%u 16-bit generic       %8.2f ms\n", bin, bin, ms);
+        double base = ms;
+
+        ThreadPool::SetMaxThreads(1);
+        for (unsigned int i = 0; i < WXSIZEOF(levels); i++)
+        {
+            if (!SimdSetLevel(levels[i]))
+                continue;
+
+            ms = TimeIt([&]() { BinPixels(&dst[0], src.ImageData, src.Size, bin); });
+            bool match = dst == ref;
+            wxPrintf("binning %ux%u 16-bit %-8s      %8.2f ms  %5.2fx%s\n", bin, bin, SimdLevelName(levels[i]),
+                     ms, base / ms, match ? "" : "  MISMATCH");
+        }
+        SimdSetLevel(prev);
+        ThreadPool::SetMaxThreads(0);
+
+        ms = TimeIt([&]() { BinPixels(&dst[0], src.ImageData, src.Size, bin); });
+        wxPrintf("binning %ux%u 16-bit %2u threads    %8.2f ms  %5.2fx%s\n", bin, bin, ThreadPool::Concurrency(),
+                 ms, base / ms, dst == ref ? "" : "  MISMATCH");
+
+        // 8-bit camera data to usImage pixels: bin, then widen vs. the fused path
+        ms = TimeIt([&]() {
+            BinPixelsGeneric(&tmp8[0], &src8[0], src.Size, bin);
+            for (unsigned int i = 0; i < n; i++)
+                ref[i] = tmp8[i];
+        });
+        wxPrintf("binning %ux%u 8-bit generic+copy   %8.2f ms\n", bin, bin, ms);
+        base = ms;
+
+        ms = TimeIt([&]() { BinPixels(&dst[0], &src8[0], src.Size, bin); });
+        wxPrintf("binning %ux%u 8-bit fused %2u thr   %8.2f ms  %5.2fx%s\n", bin, bin, ThreadPool::Concurrency(),
+                 ms, base / ms, dst == ref ? "" : "  MISMATCH");
+    }
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*fn)();
+};
+
+static const Benchmark s_benchmarks[] =
+{
+    { "median3", BenchMedian3 },
+    { "calcstats", BenchCalcStats },
+    { "medianfilter", BenchMedianFilter },
+    { "starfind", BenchStarFind },
+    { "psffit", BenchPsfFit },
+    { "binning", BenchBinning },
+};
+
+void RunBenchmarks(const wxString& names)
+{
+    wxPrintf("PHD2 %s benchmarks, CPU: %s\n", FULLVER, SimdLevelName(SimdDetect()));
+
+    bool all = names.IsEmpty() || names == "all";
+
+    wxStringTokenizer tok(names, ",");
+    std::set<wxString> selected;
+    while (tok.HasMoreTokens())
+        selected.insert(tok.GetNextToken().Trim().Trim(false).Lower());
+
+    for (unsigned int i = 0; i < WXSIZEOF(s_benchmarks); i++)
+    {
+        if (all || selected.count(s_benchmarks[i].name))
+            (*s_benchmarks[i].fn)();
+    }
+}
@@ -151,7 +151,7 @@ bool CameraSBIG::LoadDriver()
     return ok;
 }
 
-static bool SelectInterfaceAndDevice()
+static bool SelectInterfaceAndDevice(wxMessageBoxProxy& ui)
 {
     // select which cam interface
     wxArrayString interf;
@@ -169,7 +169,7 @@ static bool SelectInterfaceAndDevice()
 #endif
 
     int resp = pConfig->Profile.GetInt("/camera/sbig/interface", 0);
-    resp = wxGetSingleChoiceIndex(_("Select interface"), _("Interface"), interf,
+    resp = ui.wxGetSingleChoiceIndex(_("Select interface"), _("Interface"), interf,
         NULL, wxDefaultCoord, wxDefaultCoord, true, wxCHOICE_WIDTH, wxCHOICE_HEIGHT,
         resp);
 
@@ -200,7 +200,7 @@ static bool SelectInterfaceAndDevice()
                 Debug.Write(wxString::Format("SBIG: [%d] %s\n", i, usbp.usbInfo[i].name));
                 USBNames.Add(usbp.usbInfo[i].name);
             }
-            i = wxGetSingleChoiceIndex(_("Select USB camera"), _("Camera name"), USBNames);
+            i = ui.wxGetSingleChoiceIndex(_("Select USB camera"), _("Camera name"), USBNames);
             Debug.Write(wxString::Format("SBIG: selected index %d\n", i));
             if (i == -1)
                 return true;
@@ -290,7 +290,7 @@ static bool LoadOpenDeviceParams(OpenDeviceParams *odp)
 bool CameraSBIG::HandleSelectCameraButtonClick(wxCommandEvent& evt)
 {
     if (LoadDriver())
-        SelectInterfaceAndDevice();
+        SelectInterfaceAndDevice(*this);
     return true; // handled
 }
 
@@ -305,7 +305,7 @@ bool CameraSBIG::Connect(const wxString& camId)
 
     if (!LoadOpenDeviceParams(&odp))
     {
-        bool err = SelectInterfaceAndDevice();
+        bool err = SelectInterfaceAndDevice(*this);
         if (err)
         {
             Disconnect();
@@ -175,6 +175,20 @@ struct ToupCam
         return true;
     }
 
+    // software binning of a full frame straight into 16-bit image data
+    bool PullImageBinned(unsigned short *dst, wxSize *sz)
+    {
+        if (!_PullImage(m_tmpbuf, sz))
+            return false;
+        if (m_bpp == 8)
+            BinPixels(dst, static_cast<const unsigned char *>(m_tmpbuf), *sz, m_curBin);
+        else
+            BinPixels(dst, static_cast<const unsigned short *>(m_tmpbuf), *sz, m_curBin);
+        sz->x /= m_curBin;
+        sz->y /= m_curBin;
+        return true;
+    }
+
     bool GetOption(unsigned int option, int *val)
     {
         HRESULT hr;
@@ -661,15 +675,26 @@ bool CameraToupTek::Capture(int duration, usImage& img, int options, const wxRec
 
     //Debug.Write("TOUPTEK: capture: image ready\n");
 
-    void *buf;
     wxSize sz;
+    bool ok;
 
-    if (useSubframe || m_cam.m_bpp == 8)
-        buf = m_cam.m_buffer;
+    // full frames binned in software go straight from the SDK buffer into
+    // ImageData, skipping the intermediate 8-bit copy
+    bool const binDirect = !useSubframe && binning > 1 && m_cam.SoftwareBinning();
+
+    if (binDirect)
+        ok = m_cam.PullImageBinned(img.ImageData, &sz);
     else
-        buf = img.ImageData;
+    {
+        void *buf;
+        if (useSubframe || m_cam.m_bpp == 8)
+            buf = m_cam.m_buffer;
+        else
+            buf = img.ImageData;
+        ok = m_cam.PullImage(buf, &sz);
+    }
 
-    if (!m_cam.PullImage(buf, &sz))
+    if (!ok)
     {
         DisconnectWithAlert(_("Capture failed, unable to pull image data from camera"), RECONNECT);
         return true;
@@ -713,7 +738,7 @@ bool CameraToupTek::Capture(int duration, usImage& img, int options, const wxRec
     }
     else
     {
-        if (m_cam.m_bpp == 8)
+        if (m_cam.m_bpp == 8 && !binDirect)
         {
             const char *src = static_cast<char *>(m_cam.m_buffer);
             for (unsigned int i = 0; i < img.NPixels; i++)
@@ -721,7 +746,7 @@ bool CameraToupTek::Capture(int duration, usImage& img, int options, const wxRec
         }
         else
         {
-            // 16-bit, no subframe: data pulled directly to ImageData
+            // 16-bit or binned, no subframe: data written directly to ImageData
         }
     }
 
@@ -37,6 +37,7 @@
 #include "phd.h"
 
 #include "camera.h"
+#include "frame_stacker.h"
 #include "gear_simulator.h"
 
 #include <wx/stdpaths.h>
@@ -224,12 +225,17 @@ GuideCamera::GuideCamera()
     Binning = pConfig->Profile.GetInt("/camera/binning", 1);
     CurrentDarkFrame = nullptr;
     CurrentDefectMap = nullptr;
+    DarkMedians = new DarkMedianCache();
+    Stacker = new FrameStacker();
+    Stacker->SetFrames(pConfig->Profile.GetInt("/camera/StackFrames", 1));
 }
 
 GuideCamera::~GuideCamera()
 {
     ClearDarks();
     ClearDefectMap();
+    delete DarkMedians;
+    delete Stacker;
 }
 
 static int CompareNoCase(const wxString& first, const wxString& second)
@@ -821,6 +827,7 @@ void CameraConfigDialogPane::LayoutControls(GuideCamera *pCamera, BrainCtrlIdMap
     pTopline->Add(GetSizerCtrl(CtrlMap, AD_szTimeLapse), wxSizerFlags(0).Border(wxLEFT, 110).Expand());
     pGenGroup->Add(pTopline, def_flags);
     pGenGroup->Add(GetSizerCtrl(CtrlMap, AD_szVariableExposureDelay), def_flags);
+    pGenGroup->Add(GetSizerCtrl(CtrlMap, AD_szPipelinedExposures), def_flags);
     pGenGroup->Add(GetSizerCtrl(CtrlMap, AD_szAutoExposure), def_flags);
 
     pGenGroup->Layout();
@@ -854,7 +861,10 @@ void CameraConfigDialogPane::LayoutControls(GuideCamera *pCamera, BrainCtrlIdMap
 
     }
     if (pCamera)
+    {
         pGenGroup->Add(GetSizerCtrl(CtrlMap, AD_szSaturationOptions), wxSizerFlags(0).Border(wxALL, 2).Expand());
+        pGenGroup->Add(GetSizerCtrl(CtrlMap, AD_szFrameStacking), wxSizerFlags(0).Border(wxALL, 2).Expand());
+    }
     this->Add(pGenGroup, def_flags);
     if (pCamera && !pCamera->Connected)
     {
@@ -972,6 +982,12 @@ CameraConfigDialogCtrlSet::CameraConfigDialogCtrlSet(wxWindow *pParent, GuideCam
     szSaturationGroup->Add(m_SaturationByProfile, wxSizerFlags(0).Border(wxLEFT, 70).Expand().Align(wxALIGN_CENTER_VERTICAL));
     AddGroup(CtrlMap, AD_szSaturationOptions, szSaturationGroup);
 
+    // Sub-exposure stacking
+    m_stackFrames = NewSpinnerInt(GetParentWindow(AD_szFrameStacking), textWidth, 1, 1, FrameStacker::MAX_FRAMES, 1);
+    AddLabeledCtrl(CtrlMap, AD_szFrameStacking, _("Stack sub-exposures"), m_stackFrames,
+        _("Number of sub-exposures averaged into each guide frame. Each guide frame takes this many new "
+          "sub-exposures, so the guide cycle is this many times the exposure duration. Default = 1 (no stacking)"));
+
     // Watchdog timeout
     m_timeoutVal = NewSpinnerInt(GetParentWindow(AD_szCameraTimeout), textWidth, 5, 5, 9999, 1);
     AddLabeledCtrl(CtrlMap, AD_szCameraTimeout, _("Disconnect nonresponsive          \ncamera after (seconds)"), m_timeoutVal,
@@ -1026,6 +1042,8 @@ void CameraConfigDialogCtrlSet::LoadValues()
 
     m_timeoutVal->SetValue(m_pCamera->GetTimeoutMs() / 1000);
 
+    m_stackFrames->SetValue(m_pCamera->GetStackFrames());
+
     bool saturationByADU = m_pCamera->IsSaturationByADU();
     m_SaturationByADU->SetValue(saturationByADU);
     m_SaturationByProfile->SetValue(!saturationByADU);
@@ -1197,6 +1215,8 @@ void CameraConfigDialogCtrlSet::UnloadValues()
 
     m_pCamera->SetTimeoutMs(m_timeoutVal->GetValue() * 1000);
 
+    m_pCamera->SetStackFrames(m_stackFrames->GetValue());
+
     if (m_pCamera->HasDelayParam)
     {
         m_pCamera->ReadDelay = m_pDelay->GetValue();
@@ -1337,6 +1357,7 @@ void GuideCamera::AddDark(usImage *dark)
             usImage *prior = pos->second;
             if (prior == CurrentDarkFrame)
                 CurrentDarkFrame = dark;
+            DarkMedians->Clear();
             delete prior;
         }
 
@@ -1414,6 +1435,7 @@ void GuideCamera::ClearDarks()
         Darks.erase(it);
     }
     CurrentDarkFrame = nullptr;
+    DarkMedians->Clear();
 }
 
 void GuideCamera::SubtractDark(usImage& img)
@@ -1422,6 +1444,8 @@ void GuideCamera::SubtractDark(usImage& img)
     // DarkFrameLock to protect against the dark frame disappearing when the main
     // thread does "Load Darks" or "Clear Darks"
 
+    LatencyMonitor::Mark(LAT_DOWNLOAD_END);
+
     wxCriticalSectionLocker lck(DarkFrameLock);
 
     if (CurrentDefectMap)
@@ -1430,8 +1454,10 @@ void GuideCamera::SubtractDark(usImage& img)
     }
     else if (CurrentDarkFrame)
     {
-        Subtract(img, *CurrentDarkFrame);
+        Subtract(img, *CurrentDarkFrame, DarkMedians);
     }
+
+    LatencyMonitor::Mark(LAT_DARK_END);
 }
 
 static void InitiateReconnect()
@@ -1498,8 +1524,24 @@ void GuideCamera::InitCapture()
 {
 }
 
+int GuideCamera::GetStackFrames() const
+{
+    return Stacker->GetFrames();
+}
+
+void GuideCamera::SetStackFrames(int frames)
+{
+    Stacker->SetFrames(frames);
+    pConfig->Profile.SetInt("/camera/StackFrames", Stacker->GetFrames());
+}
+
 bool GuideCamera::Capture(GuideCamera *camera, int duration, usImage& img, int captureOptions, const wxRect& subframe)
 {
+    // light frames can be stacked from sub-exposures; darks and the raw
+    // frames used to review the bad-pixel map never are
+    if (captureOptions == CAPTURE_LIGHT && camera->Stacker->Enabled())
+        return camera->Stacker->Capture(camera, duration, img, captureOptions, subframe);
+
     img.InitImgStartTime();
     img.BitsPerPixel = camera->BitsPerPixel();
     img.ImgExpDur = duration;
@@ -37,6 +37,8 @@
 
 typedef std::map<int, usImage *> ExposureImgMap; // map exposure to image
 class DefectMap;
+class DarkMedianCache;
+class FrameStacker;
 
 enum PropDlgType
 {
@@ -77,6 +79,7 @@ class CameraConfigDialogCtrlSet : public ConfigDialogCtrlSet
     wxTextCtrl *m_camSaturationADU;
     wxRadioButton *m_SaturationByProfile;
     wxRadioButton *m_SaturationByADU;
+    wxSpinCtrl *m_stackFrames;
 
     int m_prevBinning;
 
@@ -142,6 +145,8 @@ public:
     usImage        *CurrentDarkFrame;
     ExposureImgMap  Darks; // map exposure => dark frame
     DefectMap      *CurrentDefectMap;
+    DarkMedianCache *DarkMedians;   // subframe medians of CurrentDarkFrame
+    FrameStacker   *Stacker;        // integrates sub-exposures into light frames
 
     static wxArrayString GuideCameraList();
     static GuideCamera *Factory(const wxString& choice);
@@ -206,6 +211,9 @@ public:
     bool IsSaturationByADU() const;
     void SetSaturationByADU(bool saturationByADU, unsigned short saturationVal);
 
+    int GetStackFrames() const;
+    void SetStackFrames(int frames);
+
     int GetCameraGain() const;
     bool SetCameraGain(int cameraGain);
     virtual int GetDefaultCameraGain();
@@ -62,9 +62,11 @@ enum BRAIN_CTRL_IDS
     AD_szNoiseReduction,
     AD_szAutoExposure,
     AD_szVariableExposureDelay,
+    AD_szPipelinedExposures,
     AD_szSaturationOptions,
     AD_szCameraTimeout,
     AD_szTimeLapse,
+    AD_szFrameStacking,
     AD_szPixelSize,
     AD_szGain,
     AD_szDelay,
@@ -86,6 +88,7 @@ enum BRAIN_CTRL_IDS
     AD_cbSlewDetection,
     AD_cbUseDecComp,
     AD_cbBeepForLostStar,
+    AD_szMaxDisplayFps,
     AD_GUIDER_TAB_BOUNDARY,        // --------------- end of guiding tab controls
 
     AD_szBLCompCtrls,
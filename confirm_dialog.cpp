@@ -77,6 +77,15 @@ bool ConfirmDialog::Confirm(const wxString& prompt, const wxString& config_key,
     if (skip_confirm)
         return true;
 
+    if (wxGetApp().IsHeadless())
+    {
+        // nobody can answer the dialog; the request came from an event server
+        // client, so go ahead with it and tell the clients what was skipped
+        Debug.Write(wxString::Format("Confirm %s: headless, proceeding\n", config_key));
+        pFrame->Alert(prompt, wxICON_INFORMATION);
+        return true;
+    }
+
     wxString title(title_arg);
     if (title.IsEmpty())
         title = _("Confirm");
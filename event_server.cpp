@@ -1892,6 +1892,54 @@ static void set_variable_delay_settings(JObj& response, const json_value* params
     response << jrpc_result(0);
 }
 
+// interval times are in milliseconds over the most recent frames
+static void get_latency_stats(JObj& response, const json_value *params)
+{
+    std::vector<LatencyIntervalStats> stats;
+    unsigned int frames;
+    LatencyMonitor::GetStats(&stats, &frames);
+
+    JAry intervals;
+    for (const auto& s : stats)
+    {
+        JObj t;
+        t << NV("Name", s.name)
+          << NV("Count", s.count)
+          << NV("Mean", s.mean, 3)
+          << NV("P50", s.p50, 3)
+          << NV("P90", s.p90, 3)
+          << NV("Max", s.max, 3)
+          << NV("Histogram", s.histo);
+        intervals << t;
+    }
+
+    JObj rslt;
+    rslt << NV("Enabled", LatencyMonitor::IsEnabled())
+         << NV("Csv", LatencyMonitor::CsvEnabled())
+         << NV("Frames", frames)
+         << NV("HistoEdgesMs", LatencyMonitor::HistoEdges())
+         << NV("Intervals", intervals);
+
+    response << jrpc_result(rslt);
+}
+
+static void set_latency_monitor(JObj& response, const json_value *params)
+{
+    Params p("Enabled", "Csv", params);
+    const json_value *p0 = p.param("Enabled");
+    const json_value *p1 = p.param("Csv");
+    bool enable;
+    bool csv = LatencyMonitor::CsvEnabled();
+    if (!p0 || !bool_param(p0, &enable) || (p1 && !bool_param(p1, &csv)))
+    {
+        response << jrpc_error(JSONRPC_INVALID_PARAMS, "expected Enabled boolean param and optional Csv boolean param");
+        return;
+    }
+
+    LatencyMonitor::SetEnabled(enable, csv);
+    response << jrpc_result(0);
+}
+
 static GUIDE_DIRECTION dir_param(const json_value *p)
 {
     if (!p || p->type != JSON_STRING)
@@ -2216,7 +2264,9 @@ static bool handle_request(JRpcCall& call)
         { "get_ccd_temperature", &get_sensor_temperature, },
         { "export_config_settings", &export_config_settings, },
         { "get_variable_delay_settings", &get_variable_delay_settings},
-        { "set_variable_delay_settings", &set_variable_delay_settings}
+        { "set_variable_delay_settings", &set_variable_delay_settings},
+        { "get_latency_stats", &get_latency_stats, },
+        { "set_latency_monitor", &set_latency_monitor, },
     };
 
     for (unsigned int i = 0; i < WXSIZEOF(methods); i++)
@@ -2656,6 +2706,12 @@ void EventServer::NotifyGuideStep(const GuideStepInfo& step)
     if (step.starError)
        ev << NV("ErrorCode", step.starError);
 
+    if (step.starsUsed > 1 || step.starsRejected > 0)
+    {
+        ev << NV("StarsUsed", step.starsUsed)
+           << NV("StarsRejected", step.starsRejected);
+    }
+
     if (step.raLimited)
         ev << NV("RALimited", true);
 
@@ -0,0 +1,190 @@
+/*
+ *  frame_stacker.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "phd.h"
+#include "frame_stacker.h"
+#include "image_simd.h"
+#include "thread_pool.h"
+
+FrameStacker::FrameStacker()
+    :
+    m_frames(1),
+    m_lastFrames(0),
+    m_duration(0),
+    m_options(0)
+{
+}
+
+void FrameStacker::SetFrames(int frames)
+{
+    m_frames = wxMax(1, wxMin(frames, (int) MAX_FRAMES));
+}
+
+void FrameStacker::NotifyGuideMove(const PHD_Point& cameraOfs)
+{
+    wxCriticalSectionLocker lock(m_movedLock);
+    m_moved.X += cameraOfs.X;
+    m_moved.Y += cameraOfs.Y;
+}
+
+PHD_Point FrameStacker::GuideMoves()
+{
+    wxCriticalSectionLocker lock(m_movedLock);
+    return m_moved;
+}
+
+// img = the mean of the first n sub-exposures, in the geometry of the newest
+// one; returns true on error
+bool FrameStacker::Combine(usImage& img, int frames)
+{
+    unsigned int const n = frames;
+
+    const SubFrame& newest = m_subs[n - 1];
+    wxRect const rect = newest.img.Subframe.IsEmpty() ? wxRect(m_size) : newest.img.Subframe;
+
+    if (img.Init(m_size))
+        return true;
+
+    if (!newest.img.Subframe.IsEmpty())
+    {
+        img.Clear();
+        img.Subframe = newest.img.Subframe;
+    }
+
+    // whole-pixel shift of each sub-exposure onto the newest one by the guide
+    // moves completed in between, and the part of the frame it has data for
+    int dx[MAX_FRAMES], dy[MAX_FRAMES];
+    wxRect src[MAX_FRAMES];
+    int expDur = 0;
+    for (unsigned int k = 0; k < n; k++)
+    {
+        const SubFrame& sub = m_subs[k];
+        dx[k] = ROUND(newest.moved.X - sub.moved.X);
+        dy[k] = ROUND(newest.moved.Y - sub.moved.Y);
+        src[k] = sub.img.Subframe.IsEmpty() ? wxRect(m_size) : sub.img.Subframe;
+        expDur += sub.img.ImgExpDur;
+    }
+
+    int const x0 = rect.GetLeft();
+    int const w = rect.GetWidth();
+    int const rowsize = m_size.GetWidth();
+    int const nbands = ThreadPool::RowBands(rect.GetHeight(), 32);
+
+    // one row of sums per band; the buffer only grows
+    if (m_acc.size() < (size_t) nbands * w)
+        m_acc.resize((size_t) nbands * w);
+
+    ThreadPool::ParallelForRows(rect.GetHeight(), nbands, [&](int band, int r0, int r1) {
+        unsigned int *const acc = &m_acc[(size_t) band * w];
+
+        for (int y = rect.GetTop() + r0; y < rect.GetTop() + r1; y++)
+        {
+            std::fill(acc, acc + w, 0U);
+
+            for (unsigned int k = 0; k < n; k++)
+            {
+                // pixels that shift in from outside the sub-exposure's data
+                // repeat its edge pixels
+                const wxRect& s = src[k];
+                int const sy = wxMax(s.GetTop(), wxMin(y - dy[k], s.GetBottom()));
+                const unsigned short *row = m_subs[k].img.ImageData + sy * rowsize;
+
+                // output pixels [a, b) map to source pixels inside s
+                int a = wxMax(0, wxMin(s.GetLeft() + dx[k] - x0, w));
+                int b = wxMax(a, wxMin(s.GetRight() + dx[k] - x0 + 1, w));
+
+                unsigned int const left = row[s.GetLeft()];
+                unsigned int const right = row[s.GetRight()];
+                for (int i = 0; i < a; i++)
+                    acc[i] += left;
+                AccumulateRow(acc + a, row + x0 + a - dx[k], b - a);
+                for (int i = b; i < w; i++)
+                    acc[i] += right;
+            }
+
+            unsigned short *dst = img.ImageData + y * rowsize + x0;
+            for (int i = 0; i < w; i++)
+                dst[i] = (unsigned short)((acc[i] + n / 2) / n);
+        }
+    });
+
+    img.ImgStartTime = m_subs[0].img.ImgStartTime;
+    img.ImgExpDur = expDur;
+    img.ImgStackCnt = n;
+    img.BitsPerPixel = newest.img.BitsPerPixel;
+    img.Pedestal = newest.img.Pedestal;
+
+    return false;
+}
+
+bool FrameStacker::Capture(GuideCamera *camera, int duration, usImage& img, int captureOptions, const wxRect& subframe)
+{
+    int const frames = m_frames;
+
+    if (frames != m_lastFrames || duration != m_duration || captureOptions != m_options)
+    {
+        Debug.Write(wxString::Format("FrameStacker: stacking %d x %d ms\n", frames, duration));
+        m_lastFrames = frames;
+        m_duration = duration;
+        m_options = captureOptions;
+    }
+
+    // every guide frame is built from its own sub-exposures
+    for (int k = 0; k < frames; k++)
+    {
+        SubFrame& sub = m_subs[k];
+
+        sub.moved = GuideMoves();
+
+        sub.img.InitImgStartTime();
+        sub.img.BitsPerPixel = camera->BitsPerPixel();
+        sub.img.ImgExpDur = duration;
+        sub.img.ImgStackCnt = 1;
+
+        if (camera->Capture(duration, sub.img, captureOptions, subframe))
+            return true;
+
+        // the guider's subframe follows the star, but the sub-exposures of a
+        // frame must all have the size of the first one
+        if (k > 0 && sub.img.Size != m_size)
+        {
+            Debug.Write("FrameStacker: sub-exposure size changed, restarting the stack\n");
+            k = -1;
+            continue;
+        }
+        m_size = sub.img.Size;
+    }
+
+    return Combine(img, frames);
+}
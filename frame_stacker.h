@@ -0,0 +1,102 @@
+/*
+ *  frame_stacker.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef FRAME_STACKER_INCLUDED
+#define FRAME_STACKER_INCLUDED
+
+#include <atomic>
+#include <vector>
+
+class GuideCamera;
+
+// Integrates short sub-exposures into guide frames.
+//
+// Each capture takes N fresh sub-exposures into a set of frame buffers that
+// are reused from one frame to the next and returns their mean, so no
+// sub-exposure contributes to more than one guide frame and each guide
+// correction is measured on data taken after the previous one.
+//
+// When guide moves overlap the sub-exposures (exposure pipelining) the star
+// moves part way through a stack. The mount reports the camera-frame
+// displacement of every completed move, and each sub-exposure is shifted by
+// the whole pixels the star has been moved since it was taken, so the
+// stack lines up on the newest sub-exposure without having to find the star
+// in each one.
+//
+// Capture runs on the camera worker thread and guide moves are reported from
+// the mount worker threads; the settings may be changed from the main thread
+// at any time and take effect on the next capture.
+
+class FrameStacker
+{
+public:
+    enum { MAX_FRAMES = 16 };
+
+private:
+    struct SubFrame
+    {
+        usImage img;
+        PHD_Point moved;        // guide moves completed when the sub-exposure started
+    };
+
+    std::atomic<int> m_frames;
+
+    wxCriticalSection m_movedLock;
+    PHD_Point m_moved;          // running sum of the star displacement from guide moves
+
+    SubFrame m_subs[MAX_FRAMES];
+    int m_lastFrames;
+    int m_duration;
+    int m_options;
+    wxSize m_size;
+    std::vector<unsigned int> m_acc;
+
+    PHD_Point GuideMoves();
+    bool Combine(usImage& img, int frames);
+
+public:
+    FrameStacker();
+
+    // number of sub-exposures in a guide frame; 1 turns stacking off
+    void SetFrames(int frames);
+    int GetFrames() const { return m_frames; }
+    bool Enabled() const { return m_frames > 1; }
+
+    // a guide move has completed that moved the star by the given camera
+    // coordinates; may be called from any thread
+    void NotifyGuideMove(const PHD_Point& cameraOfs);
+
+    bool Capture(GuideCamera *camera, int duration, usImage& img, int captureOptions, const wxRect& subframe);
+};
+
+#endif // FRAME_STACKER_INCLUDED
@@ -1128,7 +1128,7 @@ bool GearDialog::DoConnectCamera(bool autoReconnecting)
 
                     wxString msg = _("By changing cameras in this profile, you won't be able to use the existing dark library or bad-pixel maps. You should consider"
                         " creating a new profile for this set-up.  Do you want to connect to this camera anyway?");
-                    if (wxMessageBox(msg, _("Camera Change Warning"), wxYES_NO, this) == wxYES)
+                    if (m_pCamera->wxMessageBox(msg, _("Camera Change Warning"), wxYES_NO | wxICON_WARNING, this) == wxYES)
                     {
                         m_camWarningIssued = true;
                         m_lastCamera = newCam;          // make consistent with what's in the UI
@@ -1250,6 +1250,10 @@ void GearDialog::OnButtonDisconnectCamera(wxCommandEvent& event)
 
         m_pCamera->Disconnect();
 
+        // the next camera may have a different frame size, release the idle frame buffers
+        ImageBufferPool::LogStats();
+        ImageBufferPool::Purge();
+
         if (m_pScope && m_pScope->RequiresCamera() && m_pScope->IsConnected())
         {
             Debug.Write("gear_dialog: scope requires camera so disconnecting scope\n");
@@ -1406,7 +1410,7 @@ void GearDialog::OnButtonConnectScope(wxCommandEvent& event)
             if (m_pScope && m_ascomScopeSelected && !m_pScope->CanPulseGuide())
             {
                 m_pScope->Disconnect();
-                wxMessageBox(wxString::Format(_("Mount does not support the required PulseGuide interface"), _("Error")));
+                m_pScope->wxMessageBox(_("Mount does not support the required PulseGuide interface"), _("Error"), wxOK | wxICON_ERROR, this);
                 throw THROW_INFO("OnButtonConnectScope: PulseGuide commands not supported");
             }
 
@@ -99,11 +99,14 @@ inline void DeflectionLogger::Log(const PHD_Point&) { }
 
 static const int DefaultOverlayMode  = OVERLAY_NONE;
 static const bool DefaultScaleImage  = true;
+static const int DefaultMaxDisplayFps = 10;
+static const int MaxDisplayFpsLimit = 60;
 
 BEGIN_EVENT_TABLE(Guider, wxWindow)
     EVT_PAINT(Guider::OnPaint)
     EVT_CLOSE(Guider::OnClose)
     EVT_ERASE_BACKGROUND(Guider::OnErase)
+    EVT_TIMER(wxID_ANY, Guider::OnRepaintTimer)
 END_EVENT_TABLE()
 
 static void SaveBookmarks(const std::vector<wxRealPoint>& vec)
@@ -156,6 +159,11 @@ Guider::Guider(wxWindow *parent, int xSize, int ySize) :
     m_scaleFactor = 1.0;
     m_showBookmarks = true;
     m_displayedImage = new wxImage(XWinSize,YWinSize,true);
+    m_renderedImage = nullptr;
+    m_renderedSource = nullptr;
+    m_displayedBitmapValid = false;
+    m_maxDisplayFps = DefaultMaxDisplayFps;
+    m_repaintTimer.SetOwner(this);
     m_paused = PAUSE_NONE;
     m_starFoundTimestamp = 0;
     m_avgDistanceNeedReset = false;
@@ -196,6 +204,7 @@ Guider::Guider(wxWindow *parent, int xSize, int ySize) :
 Guider::~Guider()
 {
     delete m_displayedImage;
+    delete m_renderedImage;
     delete m_pCurrentImage;
 
     s_deflectionLogger.Uninit();
@@ -209,6 +218,8 @@ void Guider::LoadProfileSettings()
     bool scaleImage = pConfig->Profile.GetBoolean("/guider/ScaleImage", DefaultScaleImage);
     SetScaleImage(scaleImage);
 
+    SetMaxDisplayFps(pConfig->Profile.GetInt("/guider/MaxDisplayFps", DefaultMaxDisplayFps));
+
     double minHFD = pConfig->Profile.GetDouble("/guider/StarMinHFD", GetMinStarHFDDefault());
     // Handle upgrades from earlier releases that allowed zero MinHFD values.  Values below floor
     // are considered to be bogus and usually zero.  Set those to the default value (1.5).
@@ -253,8 +264,7 @@ PauseType Guider::SetPaused(PauseType pause)
 
     if (pause != prev)
     {
-        Refresh();
-        Update();
+        RequestRepaint();
     }
 
     return prev;
@@ -306,8 +316,7 @@ bool Guider::SetOverlayMode(int overlayMode)
         bError = true;
     }
 
-    Refresh();
-    Update();
+    RequestRepaint();
 
     return bError;
 }
@@ -384,8 +393,7 @@ void Guider::SetOverlaySlitCoords(const wxPoint& center, const wxSize& size, int
         m_overlaySlitCoords.corners[4] = m_overlaySlitCoords.corners[0];
     }
 
-    Refresh();
-    Update();
+    RequestRepaint();
 }
 
 void Guider::EnableFastRecenter(bool enable)
@@ -428,6 +436,14 @@ void Guider::OnClose(wxCloseEvent& evt)
     Destroy();
 }
 
+static void ClearImageRect(wxImage *img, const wxRect& rect)
+{
+    int const width = img->GetWidth();
+    unsigned char *data = img->GetData();
+    for (int y = rect.GetTop(); y <= rect.GetBottom(); y++)
+        memset(data + 3 * (y * width + rect.GetLeft()), 0, 3 * rect.GetWidth());
+}
+
 bool Guider::PaintHelper(wxAutoBufferedPaintDCBase& dc, wxMemoryDC& memDC)
 {
     bool bError = false;
@@ -437,11 +453,54 @@ bool Guider::PaintHelper(wxAutoBufferedPaintDCBase& dc, wxMemoryDC& memDC)
         GUIDER_STATE state = GetState();
         GetSize(&XWinSize, &YWinSize);
 
+        m_sincePaint.Start();
+
+        // without an image there is no conversion to key the cache on
+        bool rebuild = !m_pCurrentImage->ImageData;
+
         if (m_pCurrentImage->ImageData)
         {
+            m_pCurrentImage->CalcFiltStats();
             int blevel = m_pCurrentImage->FiltMin;
             int wlevel = m_pCurrentImage->FiltMax;
-            m_pCurrentImage->CopyToImage(&m_displayedImage, blevel, wlevel, pFrame->Stretch_gamma);
+            double gamma = pFrame->Stretch_gamma;
+
+            // Converting a large frame to RGB takes a while, so repaints for
+            // overlay changes or window exposure reuse the last conversion
+            if (m_renderedSource != m_pCurrentImage || blevel != m_renderedBlevel ||
+                wlevel != m_renderedWlevel || gamma != m_renderedGamma)
+            {
+                const usImage *img = m_pCurrentImage;
+                wxRect rect = img->Subframe.IsEmpty() ? wxRect(img->Size) : img->Subframe;
+
+                // only the subframe gets converted; black out anything the
+                // previous conversion drew outside of it
+                if (m_renderedImage && m_renderedImage->GetSize() == img->Size && !rect.Contains(m_renderedRect))
+                    ClearImageRect(m_renderedImage, m_renderedRect);
+
+                m_pCurrentImage->CopyToImage(&m_renderedImage, rect, blevel, wlevel, gamma);
+
+                m_renderedSource = m_pCurrentImage;
+                m_renderedRect = rect;
+                m_renderedBlevel = blevel;
+                m_renderedWlevel = wlevel;
+                m_renderedGamma = gamma;
+                rebuild = true;
+            }
+        }
+
+        // Scaling a large frame to the window takes a while too, so the
+        // scaled bitmap is reused until the conversion, the window size or
+        // the scaling option changes
+        wxSize const winSize(XWinSize, YWinSize);
+        if (!m_displayedBitmapValid || winSize != m_displayedBitmapWinSize || m_scaleImage != m_displayedBitmapScaled)
+            rebuild = true;
+
+        if (rebuild && m_pCurrentImage->ImageData)
+        {
+            // the rescale below replaces m_displayedImage's data rather than
+            // modifying it, so m_renderedImage is left intact
+            *m_displayedImage = *m_renderedImage;
         }
 
         int imageWidth   = m_displayedImage->GetWidth();
@@ -449,7 +508,7 @@ bool Guider::PaintHelper(wxAutoBufferedPaintDCBase& dc, wxMemoryDC& memDC)
 
         // scale the image if necessary
 
-        if (imageWidth != XWinSize || imageHeight != YWinSize)
+        if (rebuild && (imageWidth != XWinSize || imageHeight != YWinSize))
         {
             // The image is not the exact right size -- figure out what to do.
             double xScaleFactor = imageWidth / (double)XWinSize;
@@ -497,13 +556,20 @@ bool Guider::PaintHelper(wxAutoBufferedPaintDCBase& dc, wxMemoryDC& memDC)
             }
         }
 
-        // important to provide explicit color for r,g,b, optional args to Size().
-        // If default args are provided wxWidgets performs some expensive histogram
-        // operations.
-        wxBitmap DisplayedBitmap(m_displayedImage->Size(wxSize(XWinSize, YWinSize), wxPoint(0, 0), 0, 0, 0));
-        memDC.SelectObject(DisplayedBitmap);
+        if (rebuild)
+        {
+            // important to provide explicit color for r,g,b, optional args to Size().
+            // If default args are provided wxWidgets performs some expensive histogram
+            // operations.
+            m_displayedBitmap = wxBitmap(m_displayedImage->Size(winSize, wxPoint(0, 0), 0, 0, 0));
+            m_displayedBitmapValid = true;
+            m_displayedBitmapWinSize = winSize;
+            m_displayedBitmapScaled = m_scaleImage;
+        }
 
-        dc.Blit(0, 0, DisplayedBitmap.GetWidth(), DisplayedBitmap.GetHeight(), &memDC, 0, 0, wxCOPY, false);
+        memDC.SelectObject(m_displayedBitmap);
+        dc.Blit(0, 0, m_displayedBitmap.GetWidth(), m_displayedBitmap.GetHeight(), &memDC, 0, 0, wxCOPY, false);
+        memDC.SelectObject(wxNullBitmap);
 
         int XImgSize = m_displayedImage->GetWidth();
         int YImgSize = m_displayedImage->GetHeight();
@@ -730,19 +796,57 @@ void Guider::UpdateImageDisplay(usImage *pImage)
         pImage = m_pCurrentImage;
     }
 
-    Debug.Write(wxString::Format("UpdateImageDisplay: Size=(%d,%d) min=%u, max=%u, med=%u, FiltMin=%u, FiltMax=%u, Gamma=%.3f\n",
+    // nothing is drawn when running headless
+    if (wxGetApp().IsHeadless())
+        return;
+
+    // the display stretch (FiltMin/FiltMax) is computed when the frame is
+    // painted, so frames replaced before the next repaint cost nothing
+    Debug.Write(wxString::Format("UpdateImageDisplay: Size=(%d,%d) min=%u, max=%u, med=%u, Gamma=%.3f\n",
                                  pImage->Size.x, pImage->Size.y, pImage->MinADU, pImage->MaxADU, pImage->MedianADU,
-                                 pImage->FiltMin, pImage->FiltMax, pFrame->Stretch_gamma));
+                                 pFrame->Stretch_gamma));
+
+    RequestRepaint();
+}
 
+// Repaints are asynchronous and rate limited: a request made less than a
+// display frame interval after the last paint starts a timer instead, and
+// requests made while the timer runs are absorbed by it. The paint always
+// draws the current frame, so intermediate frames are simply never drawn.
+void Guider::RequestRepaint()
+{
+    if (m_repaintTimer.IsRunning())
+        return;
+
+    long wait = m_maxDisplayFps > 0 ? 1000 / m_maxDisplayFps - m_sincePaint.Time() : 0;
+    if (wait > 0)
+        m_repaintTimer.StartOnce(wait);
+    else
+        Refresh();
+}
+
+void Guider::OnRepaintTimer(wxTimerEvent& evt)
+{
     Refresh();
-    Update();
+}
+
+void Guider::SetMaxDisplayFps(int fps)
+{
+    if (fps < 0)
+        fps = 0;
+    if (fps > MaxDisplayFpsLimit)
+        fps = MaxDisplayFpsLimit;
+
+    Debug.Write(wxString::Format("setting max display fps = %d\n", fps));
+
+    m_maxDisplayFps = fps;
+    pConfig->Profile.SetInt("/guider/MaxDisplayFps", m_maxDisplayFps);
 }
 
 void Guider::SetDefectMapPreview(const DefectMap *defectMap)
 {
     m_defectMapPreview = defectMap;
-    Refresh();
-    Update();
+    RequestRepaint();
 }
 
 bool Guider::SaveCurrentImage(const wxString& fileName)
@@ -1217,6 +1321,7 @@ void Guider::DisplayImage(usImage *img)
     // switch in the new image
     usImage *prev = m_pCurrentImage;
     m_pCurrentImage = img;
+    m_renderedSource = nullptr;
 
     ImageLogger::SaveImage(prev);
 
@@ -1262,6 +1367,7 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
 
             usImage *pPrevImage = m_pCurrentImage;
             m_pCurrentImage = pImage;
+            m_renderedSource = nullptr;
 
             ImageLogger::SaveImage(pPrevImage);
         }
@@ -1280,7 +1386,8 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
             throw THROW_INFO("Stopped Guiding");
         }
 
-        assert(!pMount || !pMount->IsBusy());
+        // with pipelined exposures the previous frame's move may still be running
+        assert(!pMount || !pMount->IsBusy() || pFrame->GetPipelinedExposures());
 
         // shift lock position
         if (LockPosShiftEnabled() && IsGuiding())
@@ -1297,7 +1404,11 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
         GuiderOffset ofs;
         FrameDroppedInfo info;
 
-        if (UpdateCurrentPosition(pImage, &ofs, &info))           // true means error
+        LatencyMonitor::Mark(LAT_FIND_START);
+        bool findError = UpdateCurrentPosition(pImage, &ofs, &info);
+        LatencyMonitor::Mark(LAT_FIND_END);
+
+        if (findError)           // true means error
         {
             info.frameNumber = pImage->FrameNum;
             info.time = pFrame->TimeSinceGuidingStarted();
@@ -1337,6 +1448,9 @@ void Guider::UpdateGuideState(usImage *pImage, bool bStopping)
                     static GuiderOffset ZERO_OFS;
                     pFrame->SchedulePrimaryMove(pMount, ZERO_OFS, MOVEOPTS_DEDUCED_MOVE);
 
+                    if (wxGetApp().IsHeadless())
+                        break;
+
                     wxColor prevColor = GetBackgroundColour();
                     SetBackgroundColour(wxColour(64,0,0));
                     ClearBackground();
@@ -1710,6 +1824,7 @@ void Guider::GuiderConfigDialogPane::LayoutControls(Guider *pGuider, BrainCtrlId
     CondAddCtrl(pSharedSizer, CtrlMap, AD_cbReverseDecOnFlip);
     CondAddCtrl(pSharedSizer, CtrlMap, AD_cbEnableGuiding, wxSizerFlags(0).Border(wxLEFT, 35));
     CondAddCtrl(pSharedSizer, CtrlMap, AD_cbSlewDetection);
+    pSharedSizer->Add(GetSizerCtrl(CtrlMap, AD_szMaxDisplayFps));
     pShared->Add(pSharedSizer, def_flags);
     pShared->Layout();
 
@@ -1735,6 +1850,13 @@ ConfigDialogCtrlSet(pParent, pAdvancedDialog, CtrlMap)
     m_pScaleImage = new wxCheckBox(GetParentWindow(AD_cbScaleImages), wxID_ANY, _("Always scale images"));
     AddCtrl(CtrlMap, AD_cbScaleImages, m_pScaleImage, _("Always scale images to fill window"));
 
+    int width = StringWidth(_T("000"));
+    m_pMaxDisplayFps = pFrame->MakeSpinCtrl(GetParentWindow(AD_szMaxDisplayFps), wxID_ANY, _T(" "), wxDefaultPosition,
+        wxSize(width, -1), wxSP_ARROW_KEYS, 0, MaxDisplayFpsLimit, DefaultMaxDisplayFps, _T("MaxDisplayFps"));
+    AddLabeledCtrl(CtrlMap, AD_szMaxDisplayFps, _("Maximum display rate (fps)"), m_pMaxDisplayFps,
+        _("How many times per second the guider image may be redrawn. When frames arrive faster than this, only the latest "
+          "one is shown. 0 = no limit"));
+
     m_pEnableFastRecenter = new wxCheckBox(GetParentWindow(AD_cbFastRecenter), wxID_ANY, _("Fast recenter after calibration or dither"));
     AddCtrl(CtrlMap, AD_cbFastRecenter, m_pEnableFastRecenter, _("Speed up calibration and dithering by using larger guide pulses to return the star to the center position. Un-check to use the old, slower method of recentering after calibration or dither."));
 }
@@ -1743,12 +1865,14 @@ void GuiderConfigDialogCtrlSet::LoadValues()
 {
     m_pEnableFastRecenter->SetValue(m_pGuider->IsFastRecenterEnabled());
     m_pScaleImage->SetValue(m_pGuider->GetScaleImage());
+    m_pMaxDisplayFps->SetValue(m_pGuider->GetMaxDisplayFps());
 }
 
 void GuiderConfigDialogCtrlSet::UnloadValues()
 {
     m_pGuider->EnableFastRecenter(m_pEnableFastRecenter->GetValue());
     m_pGuider->SetScaleImage(m_pScaleImage->GetValue());
+    m_pGuider->SetMaxDisplayFps(m_pMaxDisplayFps->GetValue());
 }
 
 EXPOSED_STATE Guider::GetExposedState()
@@ -1844,8 +1968,7 @@ void Guider::SetBookmarksShown(bool show)
     m_showBookmarks = show;
     if (prev != show && m_bookmarks.size())
     {
-        Refresh();
-        Update();
+        RequestRepaint();
     }
 }
 
@@ -1866,8 +1989,7 @@ void Guider::DeleteAllBookmarks()
             SaveBookmarks(m_bookmarks);
             if (m_showBookmarks)
             {
-                Refresh();
-                Update();
+                RequestRepaint();
             }
         }
     }
@@ -1920,8 +2042,7 @@ void Guider::BookmarkLockPosition()
 {
     if (BookmarkPos(LockPosition(), m_bookmarks) && m_showBookmarks)
     {
-        Refresh();
-        Update();
+        RequestRepaint();
     }
 }
 
@@ -1929,7 +2050,6 @@ void Guider::BookmarkCurPosition()
 {
     if (BookmarkPos(CurrentPosition(), m_bookmarks) && m_showBookmarks)
     {
-        Refresh();
-        Update();
+        RequestRepaint();
     }
 }
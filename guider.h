@@ -120,6 +120,7 @@ class GuiderConfigDialogCtrlSet : public ConfigDialogCtrlSet
     Guider *m_pGuider;
     wxCheckBox *m_pEnableFastRecenter;
     wxCheckBox *m_pScaleImage;
+    wxSpinCtrl *m_pMaxDisplayFps;
 
 public:
     GuiderConfigDialogCtrlSet(wxWindow *pParent, Guider *pGuider, AdvancedDialog* pAdvancedDialog, BrainCtrlIdMap& CtrlMap);
@@ -138,6 +139,19 @@ struct GuiderOffset
 class Guider : public wxWindow
 {
     wxImage *m_displayedImage;
+    wxImage *m_renderedImage;           // m_pCurrentImage converted to RGB, before scaling
+    const usImage *m_renderedSource;    // image m_renderedImage came from, null when stale
+    wxRect m_renderedRect;              // area that was converted, the rest is black
+    int m_renderedBlevel;
+    int m_renderedWlevel;
+    double m_renderedGamma;
+    wxBitmap m_displayedBitmap;         // m_displayedImage scaled and sized to the window
+    bool m_displayedBitmapValid;
+    wxSize m_displayedBitmapWinSize;    // window size m_displayedBitmap was made for
+    bool m_displayedBitmapScaled;       // m_scaleImage when m_displayedBitmap was made
+    int m_maxDisplayFps;                // repaint rate limit, 0 for none
+    wxTimer m_repaintTimer;             // runs while a rate-limited repaint is pending
+    wxStopWatch m_sincePaint;
     OVERLAY_MODE m_overlayMode;
     OverlaySlitCoords m_overlaySlitCoords;
     const DefectMap *m_defectMapPreview;
@@ -219,6 +233,7 @@ public:
     bool IsGuiding() const;
     void OnClose(wxCloseEvent& evt);
     void OnErase(wxEraseEvent& evt);
+    void OnRepaintTimer(wxTimerEvent& evt);
     void UpdateImageDisplay(usImage *pImage = nullptr);
 
     bool MoveLockPosition(const PHD_Point& mountDelta);
@@ -251,6 +266,9 @@ public:
 
     bool SetScaleImage(bool newScaleValue);
     bool GetScaleImage() const;
+    int GetMaxDisplayFps() const;
+    void SetMaxDisplayFps(int fps);
+    void RequestRepaint();
 
     int GetSearchRegion() const;
     double CurrentError(bool raOnly);
@@ -311,6 +329,9 @@ public:
     virtual bool GetMultiStarMode() const { return false; }
     virtual void SetMultiStarMode(bool On) {};
     virtual wxString GetStarCount() const { return wxEmptyString; }
+    // stars that contributed to the last offset, and stars rejected as outliers
+    virtual unsigned int StarsUsed() const { return 1; }
+    virtual unsigned int StarsRejected() const { return 0; }
 
     usImage *CurrentImage() const;
     wxImage *DisplayedImage() const;
@@ -346,6 +367,11 @@ inline bool Guider::GetScaleImage() const
     return m_scaleImage;
 }
 
+inline int Guider::GetMaxDisplayFps() const
+{
+    return m_maxDisplayFps;
+}
+
 inline const ShiftPoint& Guider::LockPosition() const
 {
     return m_lockPosition;
@@ -41,6 +41,7 @@
  */
 
 #include "phd.h"
+#include "thread_pool.h"
 
 #include <wx/dir.h>
 #include <algorithm>
@@ -189,6 +190,234 @@ public:
     }
 };
 
+// Stars seen during the session. The catalog is filled from the AutoFind
+// result and kept up to date from the stars tracked on each frame, so that
+// star selection and a lost primary star can be handled with a few local
+// searches around the predicted star positions instead of a full-frame
+// search. The catalog is kept when capture or guiding stops; a catalog that
+// no longer matches the field fails verification, and AutoFind replaces it.
+// It is cleared when the user selects a star.
+class StarCatalog
+{
+    enum { MAX_ENTRIES = 24 };
+
+    struct Entry
+    {
+        PHD_Point pos;      // last known position
+        double mass;
+        double snr;
+        double hfd;
+    };
+
+    std::vector<Entry> m_entries;   // m_entries[0] is the primary star
+    wxSize m_frameSize;
+    PierSide m_pierSide;            // side of pier when the stars were recorded
+
+    static Entry MakeEntry(const Star& star)
+    {
+        Entry e;
+        e.pos = star;
+        e.mass = star.Mass;
+        e.snr = star.SNR;
+        e.hfd = star.HFD;
+        return e;
+    }
+
+public:
+    StarCatalog() : m_pierSide(PIER_SIDE_UNKNOWN) { }
+
+    bool IsEmpty() const { return m_entries.empty(); }
+
+    void Clear()
+    {
+        if (!m_entries.empty())
+            Debug.Write("StarCatalog: cleared\n");
+        m_entries.clear();
+    }
+
+    // replace the catalog with an AutoFind result, primary star first
+    void Record(const std::vector<GuideStar>& stars, const wxSize& frameSize, PierSide pierSide)
+    {
+        m_entries.clear();
+        m_frameSize = frameSize;
+        m_pierSide = pierSide;
+        for (auto it = stars.begin(); it != stars.end() && m_entries.size() < MAX_ENTRIES; ++it)
+            m_entries.push_back(MakeEntry(*it));
+        Debug.Write(wxString::Format("StarCatalog: recorded %u stars, pier side %d\n", (unsigned int) m_entries.size(), pierSide));
+    }
+
+    // update the catalog from the stars tracked on the latest frame; stars
+    // that do not match a catalog entry are added
+    void Update(const Star& primary, const std::vector<GuideStar>& stars, const wxSize& frameSize, double matchDist)
+    {
+        // the catalog is only started by Record(), which knows the pier side
+        if (m_entries.empty())
+            return;
+
+        if (frameSize != m_frameSize)
+        {
+            Clear();
+            return;
+        }
+
+        m_entries[0] = MakeEntry(primary);
+
+        // stars[0] is the primary star when it was selected; the secondary
+        // stars follow
+        for (auto it = stars.begin() + std::min<size_t>(1, stars.size()); it != stars.end(); ++it)
+        {
+            if (it->wasLost || !it->WasFound())
+                continue;
+
+            Entry *best = nullptr;
+            double bestDist = matchDist;
+            for (auto e = m_entries.begin() + 1; e != m_entries.end(); ++e)
+            {
+                double d = e->pos.Distance(*it);
+                if (d < bestDist)
+                {
+                    bestDist = d;
+                    best = &*e;
+                }
+            }
+
+            if (best)
+                *best = MakeEntry(*it);
+            else if (m_entries.size() < MAX_ENTRIES)
+                m_entries.push_back(MakeEntry(*it));
+        }
+    }
+
+    // Look for the catalog stars in image. The first catalog star found near
+    // its last known position gives the field shift; at least two other
+    // stars must then be found where the shift predicts them. Only stars that
+    // pass the AutoFind filters (not saturated, SNR >= minSNR, at least
+    // edgeDist from the frame edges) are returned. On success, found receives
+    // them in catalog order with the primary star first. With keepPrimary the
+    // primary star must be the catalog's primary star, otherwise it is the
+    // first usable star.
+    //
+    // The positions are only predicted for the side of pier the stars were
+    // recorded on, as reported by the mount; after a meridian flip the field
+    // must be found again with AutoFind.
+    bool Reacquire(const usImage *image, int searchRegion, int edgeDist, double minHFD, double maxHFD, double minSNR,
+                   unsigned short saturation, PierSide pierSide, bool keepPrimary, std::vector<GuideStar>& found)
+    {
+        // predicted positions must be verified within this distance
+        double const VERIFY_DIST = 3.0;
+        // the anchor and this many other stars must be found
+        unsigned int const MIN_VERIFIED = 2;
+
+        if (m_entries.size() < 1 + MIN_VERIFIED || image->Size != m_frameSize || !image->Subframe.IsEmpty())
+            return false;
+
+        if (pierSide != PIER_SIDE_UNKNOWN && m_pierSide != PIER_SIDE_UNKNOWN && pierSide != m_pierSide)
+        {
+            Debug.Write(wxString::Format("StarCatalog: recorded on pier side %d, mount is on %d\n", m_pierSide, pierSide));
+            return false;
+        }
+
+        wxStopWatch swatch;
+
+        std::vector<GuideStar> stars(m_entries.size());
+        std::vector<bool> ok(m_entries.size(), false);
+
+        int anchor = -1;
+        PHD_Point shift;
+        for (unsigned int i = 0; i < m_entries.size() && anchor < 0; i++)
+        {
+            const PHD_Point& pos = m_entries[i].pos;
+            if (stars[i].Find(image, searchRegion, ROUND(pos.X), ROUND(pos.Y), Star::FIND_CENTROID, minHFD, maxHFD, saturation,
+                              Star::FIND_LOGGING_MINIMAL))
+            {
+                anchor = i;
+                ok[i] = true;
+                shift = stars[i] - pos;
+            }
+        }
+
+        if (anchor < 0)
+        {
+            Debug.Write("StarCatalog: no catalog star found\n");
+            return false;
+        }
+
+        unsigned int verified = 0;
+        for (unsigned int i = 0; i < m_entries.size(); i++)
+        {
+            if ((int) i == anchor)
+                continue;
+            PHD_Point const predicted = m_entries[i].pos + shift;
+            if (stars[i].Find(image, searchRegion, ROUND(predicted.X), ROUND(predicted.Y), Star::FIND_CENTROID, minHFD, maxHFD,
+                              saturation, Star::FIND_LOGGING_MINIMAL) &&
+                stars[i].Distance(predicted) <= VERIFY_DIST)
+            {
+                ok[i] = true;
+                ++verified;
+            }
+        }
+
+        if (verified < MIN_VERIFIED)
+        {
+            Debug.Write(wxString::Format("StarCatalog: only %u of %u other stars verified, anchor %d shift (%.1f, %.1f)\n",
+                                         verified, (unsigned int) m_entries.size() - 1, anchor, shift.X, shift.Y));
+            return false;
+        }
+
+        // the AutoFind filters
+        unsigned int usable = 0;
+        for (unsigned int i = 0; i < m_entries.size(); i++)
+        {
+            const GuideStar& s = stars[i];
+            if (ok[i] && (s.GetError() == Star::STAR_SATURATED || s.SNR < minSNR ||
+                          s.X <= edgeDist || s.X >= image->Size.GetWidth() - edgeDist ||
+                          s.Y <= edgeDist || s.Y >= image->Size.GetHeight() - edgeDist))
+            {
+                ok[i] = false;
+            }
+            if (ok[i])
+                ++usable;
+        }
+
+        // the primary star: the first usable star in catalog order
+        int primary = -1;
+        for (unsigned int i = 0; i < m_entries.size() && primary < 0; i++)
+            if (ok[i])
+                primary = i;
+
+        if (primary < 0 || (keepPrimary && primary != 0))
+        {
+            Debug.Write("StarCatalog: no usable primary star\n");
+            return false;
+        }
+
+        found.clear();
+        PHD_Point const primaryRef(stars[primary].X, stars[primary].Y);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (unsigned int i = 0; i < m_entries.size(); i++)
+            {
+                if (!ok[i] || (pass == 0) != ((int) i == primary))
+                    continue;
+                GuideStar s(stars[i]);
+                s.referencePoint.X = s.X;
+                s.referencePoint.Y = s.Y;
+                s.offsetFromPrimary = s.referencePoint - primaryRef;
+                found.push_back(s);
+            }
+        }
+
+        Debug.Write(wxString::Format("StarCatalog: reacquired %u of %u stars (%u verified), anchor %d shift (%.1f, %.1f) in %ld ms\n",
+                                     usable, (unsigned int) m_entries.size(), verified, anchor, shift.X, shift.Y, swatch.Time()));
+        return true;
+    }
+};
+
+static PierSide CurrentPierSide()
+{
+    return pPointingSource && pPointingSource->CanReportPosition() ? pPointingSource->SideOfPier() : PIER_SIDE_UNKNOWN;
+}
+
 static const double DefaultMassChangeThreshold = 0.5;
 
 enum {
@@ -197,7 +426,8 @@ enum {
     MAX_SEARCH_REGION = 50,
     DEFAULT_MAX_STAR_COUNT = 9,
     DEFAULT_STABILITY_SIGMAX = 5,
-    MAX_LIST_SIZE = 12
+    MAX_LIST_SIZE = 12,
+    REACQUIRE_LOST_FRAMES = 3,      // frames the primary star must be lost before the catalog is searched
 };
 
 BEGIN_EVENT_TABLE(GuiderMultiStar, Guider)
@@ -209,10 +439,14 @@ END_EVENT_TABLE()
 GuiderMultiStar::GuiderMultiStar(wxWindow *parent)
     : Guider(parent, XWinSize, YWinSize),
       m_massChecker(new MassChecker()),
+      m_catalog(new StarCatalog()),
       m_stabilizing(false), m_multiStarMode(true), m_lastPrimaryDistance(0),
       m_lockPositionMoved(false),
+      m_lostFrames(0),
       m_maxStars(DEFAULT_MAX_STAR_COUNT),
       m_stabilitySigmaX(DEFAULT_STABILITY_SIGMAX),
+      m_starsRejected(0),
+      m_starsIncluded(1),
       m_lastStarsUsed(0)
 {
     SetState(STATE_UNINITIALIZED);
@@ -222,6 +456,7 @@ GuiderMultiStar::GuiderMultiStar(wxWindow *parent)
 GuiderMultiStar::~GuiderMultiStar()
 {
     delete m_massChecker;
+    delete m_catalog;
     delete m_primaryDistStats;
 }
 
@@ -469,12 +704,30 @@ bool GuiderMultiStar::AutoSelect(const wxRect& roi)
         if (pSecondaryMount && pSecondaryMount->IsConnected() && !pSecondaryMount->IsCalibrated())
             edgeAllowance = wxMax(edgeAllowance, pSecondaryMount->CalibrationTotDistance());
 
+        // try the stars already seen in this field before searching the whole frame
         GuideStar newStar;
-        if (!newStar.AutoFind(*image, edgeAllowance, m_searchRegion, roi, m_guideStars, MAX_LIST_SIZE))
+        std::vector<GuideStar> found;
+        if (roi.IsEmpty() &&
+            m_catalog->Reacquire(image, m_searchRegion, m_searchRegion + edgeAllowance, GetMinStarHFD(), GetMaxStarHFD(),
+                                 GetAFMinStarSNR(), pCamera->GetSaturationADU(), CurrentPierSide(), false, found))
+        {
+            if (found.size() > MAX_LIST_SIZE)
+                found.resize(MAX_LIST_SIZE);
+            m_guideStars = found;
+            newStar = found[0];
+        }
+        else
         {
-            throw ERROR_INFO("Unable to AutoFind");
+            if (!newStar.AutoFind(*image, edgeAllowance, m_searchRegion, roi, m_guideStars, MAX_LIST_SIZE))
+            {
+                throw ERROR_INFO("Unable to AutoFind");
+            }
         }
 
+        // the selected star becomes the catalog's primary star
+        m_catalog->Record(m_guideStars, image->Size, CurrentPierSide());
+        m_lostFrames = 0;
+
         m_massChecker->Reset();
 
         if (!m_primaryStar.Find(image, m_searchRegion, newStar.X, newStar.Y, Star::FIND_CENTROID, GetMinStarHFD(), GetMaxStarHFD(),
@@ -696,6 +949,16 @@ struct DistanceChecker
     }
 };
 
+unsigned int GuiderMultiStar::StarsUsed() const
+{
+    return m_starsIncluded;
+}
+
+unsigned int GuiderMultiStar::StarsRejected() const
+{
+    return m_starsRejected;
+}
+
 wxString GuiderMultiStar::GetStarCount() const
 {
     // no weird displays if stars are being removed from list
@@ -709,16 +972,146 @@ static void AppendStarUse(wxString& secondaryInfo, int starNum, double dX, doubl
     secondaryInfo += wxString::Format("[#%d %0.2f,%0.2f,%0.2f,%s] ", starNum, dX, dY, weight, flag);
 }
 
+// Robust estimate of the displacement shared by the guide stars: iteratively
+// reweighted least squares with Huber weights, followed by rejection of the
+// stars that are still far from the estimate. The star data is kept as
+// separate arrays so the per-star loops vectorize, and both the star count
+// and the number of iterations are bounded, which bounds the time per frame.
+class OffsetEstimator
+{
+public:
+    enum { MAX_STARS = MAX_LIST_SIZE + 1 };
+
+private:
+    enum { MAX_ITERATIONS = 10 };
+
+    double m_dx[MAX_STARS];         // star displacements
+    double m_dy[MAX_STARS];
+    double m_w[MAX_STARS];          // prior weight of each star
+    double m_u[MAX_STARS];          // final weight of each star, 0 if rejected
+    double m_r[MAX_STARS];          // distance from the current estimate
+    int m_tag[MAX_STARS];
+    unsigned int m_count;
+
+    double Median(const double *v) const
+    {
+        double tmp[MAX_STARS];
+        std::copy(v, v + m_count, tmp);
+        unsigned int const mid = m_count / 2;
+        std::nth_element(tmp, tmp + mid, tmp + m_count);
+        if (m_count & 1)
+            return tmp[mid];
+        return (tmp[mid] + *std::max_element(tmp, tmp + mid)) / 2.;
+    }
+
+    void Residuals(double x, double y)
+    {
+        for (unsigned int i = 0; i < m_count; i++)
+        {
+            double const ex = m_dx[i] - x;
+            double const ey = m_dy[i] - y;
+            m_r[i] = sqrt(ex * ex + ey * ey);
+        }
+    }
+
+    // weighted mean of the displacements with the Huber weights for
+    // threshold c; stars farther than reject are dropped
+    void WeightedMean(double c, double reject, double *x, double *y)
+    {
+        double sw = 0., sx = 0., sy = 0.;
+        for (unsigned int i = 0; i < m_count; i++)
+        {
+            double const r = m_r[i];
+            double const u = r > reject ? 0. : m_w[i] * (r > c ? c / r : 1.);
+            m_u[i] = u;
+            sw += u;
+            sx += u * m_dx[i];
+            sy += u * m_dy[i];
+        }
+        if (sw > 0.)
+        {
+            *x = sx / sw;
+            *y = sy / sw;
+        }
+    }
+
+public:
+
+    OffsetEstimator() : m_count(0) { }
+
+    unsigned int Count() const { return m_count; }
+    bool Full() const { return m_count == MAX_STARS; }
+
+    void Add(double dx, double dy, double weight, int tag)
+    {
+        m_dx[m_count] = dx;
+        m_dy[m_count] = dy;
+        m_w[m_count] = weight;
+        m_u[m_count] = weight;
+        m_tag[m_count] = tag;
+        ++m_count;
+    }
+
+    double DX(unsigned int i) const { return m_dx[i]; }
+    double DY(unsigned int i) const { return m_dy[i]; }
+    double Weight(unsigned int i) const { return m_u[i]; }
+    bool Rejected(unsigned int i) const { return m_u[i] == 0.; }
+    int Tag(unsigned int i) const { return m_tag[i]; }
+
+    // Estimate the common displacement. scale receives the spread of the
+    // stars around it, estimated from their median distance to it.
+    void Solve(double *x, double *y, double *scale)
+    {
+        // the median distance of a 2-D normal distribution from its center
+        // is sqrt(2 ln 2) sigma
+        double const MEDIAN_TO_SIGMA = 1.0 / 1.17741;
+        // no rejection below this scale, in pixels; stars rarely agree to
+        // better than that
+        double const MIN_SCALE = 0.05;
+        double const HUBER_K = 2.0;
+        double const REJECT_K = 3.0;
+        double const TOLERANCE = 0.001;
+
+        // the component-wise median is a robust starting point
+        double ex = Median(m_dx);
+        double ey = Median(m_dy);
+        double s = MIN_SCALE;
+
+        for (int iter = 0; iter < MAX_ITERATIONS; iter++)
+        {
+            Residuals(ex, ey);
+            s = std::max(Median(m_r) * MEDIAN_TO_SIGMA, MIN_SCALE);
+
+            double nx = ex, ny = ey;
+            WeightedMean(HUBER_K * s, HUGE_VAL, &nx, &ny);
+
+            bool const converged = fabs(nx - ex) < TOLERANCE && fabs(ny - ey) < TOLERANCE;
+            ex = nx;
+            ey = ny;
+            if (converged)
+                break;
+        }
+
+        Residuals(ex, ey);
+        WeightedMean(HUBER_K * s, REJECT_K * s, &ex, &ey);
+
+        *x = ex;
+        *y = ey;
+        *scale = s;
+    }
+};
+
 // Use secondary stars to refine Offset value if appropriate.  Return of true means offset has been adjusted
 bool GuiderMultiStar::RefineOffset(const usImage *pImage, GuiderOffset *pOffset)
 {
     double primaryDistance;
-    double secondaryDistance;
     double primarySigma = 0;
     bool averaged = false;
     int validStars = 0;
     GuiderOffset origOffset = *pOffset;
     m_starsUsed = 1;
+    m_starsRejected = 0;
+    m_starsIncluded = 1;
     bool erasures = false;
     bool refined = false;
 
@@ -727,7 +1120,15 @@ bool GuiderMultiStar::RefineOffset(const usImage *pImage, GuiderOffset *pOffset)
     {
         if (IsGuiding() && m_guideStars.size() > 1 && pMount->GetGuidingEnabled() && !PhdController::IsSettling())
         {
-            double sumWeights = 1;
+            wxStopWatch swatch;
+
+            // read the settings once; the secondary stars are searched on
+            // pool threads
+            Star::FindMode const findMode = pFrame->GetStarFindMode();
+            double const minHFD = GetMinStarHFD();
+            double const maxHFD = GetMaxStarHFD();
+            unsigned short const saturation = pCamera->GetSaturationADU();
+
             double sumX = origOffset.cameraOfs.X;
             double sumY = origOffset.cameraOfs.Y;
             primaryDistance = hypot(sumX, sumY);
@@ -754,17 +1155,18 @@ bool GuiderMultiStar::RefineOffset(const usImage *pImage, GuiderOffset *pOffset)
                         {
                             m_lockPositionMoved = false;
                             Debug.Write("MultiStar: updating star positions after lock position change\n");
+                            std::vector<char> found(m_guideStars.size());
+                            ThreadPool::ParallelFor(m_guideStars.size() - 1, [&](int i) {
+                                GuideStar& gs = m_guideStars[i + 1];
+                                PHD_Point expectedLoc = m_primaryStar + gs.offsetFromPrimary;
+                                if (!IsValidSecondaryStarPosition(expectedLoc))
+                                    expectedLoc = gs;
+                                found[i + 1] = gs.Find(pImage, m_searchRegion, expectedLoc.X, expectedLoc.Y, findMode,
+                                    minHFD, maxHFD, saturation, Star::FIND_LOGGING_VERBOSE);
+                            });
                             for (auto pGS = m_guideStars.begin() + 1; pGS != m_guideStars.end();)
                             {
-                                PHD_Point expectedLoc = m_primaryStar + pGS->offsetFromPrimary;
-                                bool found;
-                                if (IsValidSecondaryStarPosition (expectedLoc))
-                                    found = pGS->Find(pImage, m_searchRegion, expectedLoc.X, expectedLoc.Y, pFrame->GetStarFindMode(),
-                                        GetMinStarHFD(), GetMaxStarHFD(), pCamera->GetSaturationADU(), Star::FIND_LOGGING_VERBOSE);
-                                else
-                                    found = pGS->Find(pImage, m_searchRegion, pGS->X, pGS->Y, pFrame->GetStarFindMode(),
-                                        GetMinStarHFD(), GetMaxStarHFD(), pCamera->GetSaturationADU(), Star::FIND_LOGGING_VERBOSE);
-                                if (found)
+                                if (found[Iter_Inx(pGS)])
                                 {
                                     pGS->referencePoint.X = pGS->X;
                                     pGS->referencePoint.Y = pGS->Y;
@@ -789,22 +1191,35 @@ bool GuiderMultiStar::RefineOffset(const usImage *pImage, GuiderOffset *pOffset)
             if (!m_stabilizing && m_guideStars.size() > 1 && (sumX != 0 || sumY != 0))
             {
                 wxString secondaryInfo = "MultiStar: ";
+
+                // Measure the secondary stars concurrently. Each search writes
+                // only its own copy of the star, and the results are applied
+                // below in list order, so the outcome is the same as searching
+                // for the stars one after another.
+                std::vector<GuideStar> measured(m_guideStars.begin() + 1, m_guideStars.end());
+                std::vector<char> measuredFound(measured.size());
+                ThreadPool::ParallelFor(measured.size(), [&](int i) {
+                    GuideStar& gs = measured[i];
+                    // Look for a lost star based on its original offset from
+                    // the primary star, otherwise where we last found it
+                    PHD_Point expectedLoc = gs.wasLost ? m_primaryStar + gs.offsetFromPrimary : PHD_Point(gs);
+                    measuredFound[i] = gs.Find(pImage, m_searchRegion, expectedLoc.X, expectedLoc.Y, findMode,
+                        minHFD, maxHFD, saturation, Star::FIND_LOGGING_MINIMAL);
+                });
+                unsigned int nextMeasured = 0;
+
+                // the primary star is always the first star of the estimate
+                OffsetEstimator estimator;
+                estimator.Add(sumX, sumY, 1., 0);
+
                 for (auto pGS = m_guideStars.begin() + 1; pGS != m_guideStars.end();)
                 {
-                    if (m_starsUsed >= m_maxStars || m_guideStars.size() == 1)
+                    if (m_starsUsed >= m_maxStars || m_guideStars.size() == 1 || estimator.Full())
                         break;
-                    bool found = false;
-                    if (pGS->wasLost)
-                    {
-                        // Look for it based on its original offset from the primary star
-                        PHD_Point expectedLoc = m_primaryStar + pGS->offsetFromPrimary;
-                        found = pGS->Find(pImage, m_searchRegion, expectedLoc.X, expectedLoc.Y, pFrame->GetStarFindMode(),
-                            GetMinStarHFD(), GetMaxStarHFD(), pCamera->GetSaturationADU(), Star::FIND_LOGGING_MINIMAL);
-                    }
-                    else
-                        // Look for it where we last found it
-                        found = pGS->Find(pImage, m_searchRegion, pGS->X, pGS->Y, pFrame->GetStarFindMode(),
-                            GetMinStarHFD(), GetMaxStarHFD(), pCamera->GetSaturationADU(), Star::FIND_LOGGING_MINIMAL);
+                    // keep the per-star counters, which the searches do not touch
+                    unsigned int const idx = nextMeasured++;
+                    static_cast<Star&>(*pGS) = measured[idx];
+                    bool found = measuredFound[idx] != 0;
                     if (found)
                     {
                         double dX = pGS->X - pGS->referencePoint.X;
@@ -829,37 +1244,9 @@ bool GuiderMultiStar::RefineOffset(const usImage *pImage, GuiderOffset *pOffset)
                                 continue;
                             }
 
-                            // Handle suspicious excursions - counted as "misses"
-                            secondaryDistance = hypot(dX, dY);
-                            if (secondaryDistance > 2.5 * primarySigma)
-                            {
-                                if (++pGS->missCount > 10)
-                                {
-                                    // Reset the reference point to wherever it is now
-                                    pGS->referencePoint.X = pGS->X;
-                                    pGS->referencePoint.Y = pGS->Y;
-                                    pGS->missCount = 0;
-                                    AppendStarUse(secondaryInfo, Iter_Inx(pGS), dX, dY, 0, "R");
-                                }
-                                else
-                                    AppendStarUse(secondaryInfo, Iter_Inx(pGS), dX, dY, 0, "M" + std::to_string(pGS->missCount));
-                                ++pGS;
-                                continue;
-                            }
-                            else if (pGS->missCount > 0)
-                            {
-                                --pGS->missCount;
-                            }
-
-                            // At this point we have usable data from the secondary star
-                            double wt = (pGS->SNR / m_primaryStar.SNR);
-                            sumX += wt * dX;
-                            sumY += wt * dY;
-                            sumWeights += wt;
-                            averaged = true;
-                            validStars++;
-
-                            AppendStarUse(secondaryInfo, Iter_Inx(pGS), dX, dY, wt, "U");
+                            // At this point we have usable data from the secondary star;
+                            // the robust estimate below decides whether it is used
+                            estimator.Add(dX, dY, pGS->SNR / m_primaryStar.SNR, Iter_Inx(pGS));
                         }
                         else                                          // exactly zero on both axes, probably a hot pixel, drop it
                         {
@@ -879,20 +1266,65 @@ bool GuiderMultiStar::RefineOffset(const usImage *pImage, GuiderOffset *pOffset)
                     else
                         erasures = false;
                 }                                   // End of looping through secondary stars
-                Debug.Write(secondaryInfo + "\n");
+
+                double scale = 0.;
+                if (estimator.Count() > 1)
+                {
+                    estimator.Solve(&sumX, &sumY, &scale);
+
+                    for (unsigned int i = 1; i < estimator.Count(); i++)
+                    {
+                        auto pGS = m_guideStars.begin() + estimator.Tag(i);
+                        double dX = estimator.DX(i);
+                        double dY = estimator.DY(i);
+
+                        // Stars that disagree with the others are counted as "misses"
+                        if (estimator.Rejected(i))
+                        {
+                            ++m_starsRejected;
+                            if (++pGS->missCount > 10)
+                            {
+                                // Reset the reference point to wherever it is now
+                                pGS->referencePoint.X = pGS->X;
+                                pGS->referencePoint.Y = pGS->Y;
+                                pGS->missCount = 0;
+                                AppendStarUse(secondaryInfo, estimator.Tag(i), dX, dY, 0, "R");
+                            }
+                            else
+                                AppendStarUse(secondaryInfo, estimator.Tag(i), dX, dY, 0, "M" + std::to_string(pGS->missCount));
+                            continue;
+                        }
+
+                        if (pGS->missCount > 0)
+                            --pGS->missCount;
+
+                        averaged = true;
+                        validStars++;
+                        AppendStarUse(secondaryInfo, estimator.Tag(i), dX, dY, estimator.Weight(i), "U");
+                    }
+
+                    if (estimator.Rejected(0))
+                    {
+                        ++m_starsRejected;
+                        secondaryInfo += "[primary rejected] ";
+                    }
+                }
+
+                Debug.Write(secondaryInfo + wxString::Format("(%u searched, %.2f ms)\n", (unsigned int) measured.size(),
+                    swatch.TimeInMicro().ToDouble() / 1000.));
 
                 if (averaged)
                 {
-                    sumX = sumX / sumWeights;
-                    sumY = sumY / sumWeights;
                     if (hypot(sumX, sumY) < primaryDistance)                                   // Apply average only if its smaller than single-star delta
                     {
                         pOffset->cameraOfs.X = sumX;
                         pOffset->cameraOfs.Y = sumY;
                         refined = true;
+                        // the stars the estimate was computed from
+                        m_starsIncluded = validStars + (estimator.Rejected(0) ? 0 : 1);
                     }
-                    Debug.Write(wxString::Format("%s, %d included, MultiStar: {%0.2f, %0.2f}, one-star: {%0.2f, %0.2f}\n", (refined ? "refined" : "single-star"),
-                        validStars, sumX, sumY,
+                    Debug.Write(wxString::Format("%s, %d included, %u rejected, scale %0.2f, MultiStar: {%0.2f, %0.2f}, one-star: {%0.2f, %0.2f}\n", (refined ? "refined" : "single-star"),
+                        validStars, m_starsRejected, scale, sumX, sumY,
                         origOffset.cameraOfs.X, origOffset.cameraOfs.Y));
                 }
             }
@@ -910,6 +1342,38 @@ bool GuiderMultiStar::RefineOffset(const usImage *pImage, GuiderOffset *pOffset)
 
 static DistanceChecker s_distanceChecker;
 
+// Recovery path for a lost primary star: once the star has been lost for a few
+// frames while guiding, look for the catalog stars around their predicted
+// positions. This runs on the full frames that follow a lost star. Only the
+// primary star itself is accepted, and the lock position stays where it is,
+// so the mount is guided back to it.
+bool GuiderMultiStar::ReacquireLostStar(const usImage *pImage, Star *newStar)
+{
+    if (++m_lostFrames < REACQUIRE_LOST_FRAMES || GetState() != STATE_GUIDING || m_catalog->IsEmpty() ||
+        !pImage->Subframe.IsEmpty())
+    {
+        return false;
+    }
+
+    std::vector<GuideStar> found;
+    if (!m_catalog->Reacquire(pImage, m_searchRegion, m_searchRegion, GetMinStarHFD(), GetMaxStarHFD(), GetAFMinStarSNR(),
+                              pCamera->GetSaturationADU(), CurrentPierSide(), true, found))
+    {
+        return false;
+    }
+
+    if (found.size() > MAX_LIST_SIZE)
+        found.resize(MAX_LIST_SIZE);
+
+    *newStar = found[0];
+    m_guideStars = found;
+    m_massChecker->Reset();
+    m_primaryDistStats->ClearAll();
+
+    pFrame->StatusMsg(_("Stars reacquired"));
+    return true;
+}
+
 bool GuiderMultiStar::UpdateCurrentPosition(const usImage *pImage, GuiderOffset *ofs, FrameDroppedInfo *errorInfo)
 {
     if (!m_primaryStar.IsValid() && m_primaryStar.X == 0.0 && m_primaryStar.Y == 0.0)
@@ -930,8 +1394,13 @@ bool GuiderMultiStar::UpdateCurrentPosition(const usImage *pImage, GuiderOffset
     {
         Star newStar(m_primaryStar);
 
-        if (!newStar.Find(pImage, m_searchRegion, pFrame->GetStarFindMode(), GetMinStarHFD(),
-            GetMaxStarHFD(), pCamera->GetSaturationADU(), Star::FIND_LOGGING_VERBOSE))
+        bool found = newStar.Find(pImage, m_searchRegion, pFrame->GetStarFindMode(), GetMinStarHFD(),
+            GetMaxStarHFD(), pCamera->GetSaturationADU(), Star::FIND_LOGGING_VERBOSE);
+
+        if (!found && ReacquireLostStar(pImage, &newStar))
+            found = true;
+
+        if (!found)
         {
             errorInfo->starError = newStar.GetError();
             errorInfo->starMass = 0.0;
@@ -946,6 +1415,8 @@ bool GuiderMultiStar::UpdateCurrentPosition(const usImage *pImage, GuiderOffset
             throw ERROR_INFO("UpdateCurrentPosition():newStar not found");
         }
 
+        m_lostFrames = 0;
+
         // check to see if it seems like the star we just found was the
         // same as the original star by comparing the mass
         if (m_massChangeThresholdEnabled)
@@ -1022,7 +1493,13 @@ bool GuiderMultiStar::UpdateCurrentPosition(const usImage *pImage, GuiderOffset
                     distance = hypot(ofs->cameraOfs.X, ofs->cameraOfs.Y);       // Distance is reported to server clients
             }
             else
+            {
                 m_starsUsed = 1;
+                m_starsRejected = 0;
+                m_starsIncluded = 1;
+            }
+
+            m_catalog->Update(m_primaryStar, m_guideStars, pImage->Size, m_searchRegion);
 
             if (pMount && pMount->IsCalibrated())
                 pMount->TransformCameraCoordinatesToMountCoordinates(ofs->cameraOfs, ofs->mountOfs, true);
@@ -1098,8 +1575,7 @@ void GuiderMultiStar::OnLClick(wxMouseEvent &mevent)
             ToggleBookmark(pt);
             m_showBookmarks = true;
             pFrame->bookmarks_menu->Check(MENU_BOOKMARKS_SHOW, GetBookmarksShown());
-            Refresh();
-            Update();
+            RequestRepaint();
             return;
         }
 
@@ -1144,6 +1620,7 @@ void GuiderMultiStar::OnLClick(wxMouseEvent &mevent)
             else
             {
                 SetLockPosition(m_primaryStar);
+                m_catalog->Clear();
                 if (m_guideStars.size() > 1)
                     ClearSecondaryStars();
                 if (m_guideStars.size() == 0)
@@ -1159,8 +1636,7 @@ void GuiderMultiStar::OnLClick(wxMouseEvent &mevent)
                 pFrame->pProfile->UpdateData(pImage, m_primaryStar.X, m_primaryStar.Y);
             }
 
-            Refresh();
-            Update();
+            RequestRepaint();
         }
     }
     catch (const wxString& Msg)
@@ -1423,6 +1899,12 @@ GuiderMultiStarConfigDialogCtrlSet::GuiderMultiStarConfigDialogCtrlSet(wxWindow
         _("Downsampling factor for star auto-selection camera frames. Choose a value greater than 1 if star "
         "auto-selection is failing to recognize misshapen guide stars."));
 
+    wxString modes[] = { _("Centroid"), _("PSF fit") };
+    m_starFindMode = new wxChoice(GetParentWindow(AD_szStarTracking), wxID_ANY, wxDefaultPosition, wxDefaultSize, WXSIZEOF(modes), modes);
+    wxSizer *findMode = MakeLabeledControl(AD_szStarTracking, _("Star position measurement"), m_starFindMode,
+        _("How the guide star position is measured. Centroid works well for most setups. PSF fit refines the centroid by "
+        "fitting the star profile, which gives lower noise on small, undersampled stars, at a higher processing cost."));
+
     m_pBeepForLostStarCtrl = new wxCheckBox(GetParentWindow(AD_cbBeepForLostStar), wxID_ANY, _("Beep on lost star"));
     m_pBeepForLostStarCtrl->SetToolTip(_("Issue an audible alarm any time the guide star is lost"));
 
@@ -1449,6 +1931,7 @@ GuiderMultiStarConfigDialogCtrlSet::GuiderMultiStarConfigDialogCtrlSet(wxWindow
     pTrackingParams->Add(m_pUseMultiStars, wxSizerFlags(0).Border(wxLEFT, 75));
     pTrackingParams->Add(m_pBeepForLostStarCtrl, wxSizerFlags().Border(wxTOP, 3));
     pTrackingParams->Add(dsamp, wxSizerFlags().Border(wxTOP, 3).Right());
+    pTrackingParams->Add(findMode, wxSizerFlags().Border(wxTOP, 3));
 
     AddGroup(CtrlMap, AD_szStarTracking, pTrackingParams);
 }
@@ -1469,6 +1952,7 @@ void GuiderMultiStarConfigDialogCtrlSet::LoadValues()
     m_MinSNR->SetValue(m_pGuiderMultiStar->GetAFMinStarSNR());
     m_MaxHFD->SetValue(m_pGuiderMultiStar->GetMaxStarHFD());
     m_autoSelDownsample->SetSelection(m_pGuiderMultiStar->GetAutoSelDownsample());
+    m_starFindMode->SetSelection(pFrame->GetStarFindMode() == Star::FIND_PSF_FIT ? 1 : 0);
     m_pBeepForLostStarCtrl->SetValue(pFrame->GetBeepForLostStar());
     m_pUseMultiStars->SetValue(m_pGuiderMultiStar->GetMultiStarMode());
     GuiderConfigDialogCtrlSet::LoadValues();
@@ -1484,6 +1968,9 @@ void GuiderMultiStarConfigDialogCtrlSet::UnloadValues()
     m_pGuiderMultiStar->SetMaxStarHFD(wxMax(m_MaxHFD->GetValue(), min_hfd + 2.0));
     m_pGuiderMultiStar->SetAFMinStarSNR(m_MinSNR->GetValue());
     m_pGuiderMultiStar->SetAutoSelDownsample(m_autoSelDownsample->GetSelection());
+    Star::FindMode findMode = m_starFindMode->GetSelection() == 1 ? Star::FIND_PSF_FIT : Star::FIND_CENTROID;
+    pFrame->SetStarFindMode(findMode);
+    pConfig->Profile.SetInt("/StarFindMode", findMode);
     if (m_pBeepForLostStarCtrl->GetValue() != pFrame->GetBeepForLostStar())
         pFrame->SetBeepForLostStar(m_pBeepForLostStarCtrl->GetValue());
     m_pGuiderMultiStar->SetMultiStarMode(m_pUseMultiStars->GetValue());
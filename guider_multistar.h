@@ -45,6 +45,7 @@
 #define GUIDER_MULTISTAR_H_INCLUDED
 
 class MassChecker;
+class StarCatalog;
 class GuiderMultiStar;
 class GuiderConfigDialogCtrlSet;
 
@@ -60,6 +61,7 @@ public:
     wxSpinCtrlDouble *m_pMassChangeThreshold;
     wxSpinCtrlDouble *m_MinHFD;
     wxChoice *m_autoSelDownsample;
+    wxChoice *m_starFindMode;
     wxCheckBox *m_pBeepForLostStarCtrl;
     wxCheckBox *m_pUseMultiStars;
     wxSpinCtrlDouble *m_MinSNR;
@@ -77,11 +79,15 @@ class GuiderMultiStar : public Guider
     std::vector<GuideStar> m_guideStars;
     DescriptiveStats *m_primaryDistStats;
     MassChecker *m_massChecker;
+    StarCatalog *m_catalog;
     double m_lastPrimaryDistance;
     bool m_multiStarMode;
     bool m_stabilizing;
     bool m_lockPositionMoved;
+    unsigned int m_lostFrames;          // consecutive frames with the primary star lost
     unsigned int m_starsUsed;
+    unsigned int m_starsRejected;       // stars rejected by the robust offset estimate on the last frame
+    unsigned int m_starsIncluded;       // stars that contributed to the offset on the last frame, primary included
     unsigned int m_lastStarsUsed;
 
     // parameters
@@ -113,6 +119,7 @@ public:
     bool SetTolerateJumps(bool enable, double threshold);
     bool SetSearchRegion(int searchRegion);
     bool RefineOffset(const usImage *pImage, GuiderOffset* pOffset);
+    bool ReacquireLostStar(const usImage *pImage, Star *newStar);
 
     friend class GuiderMultiStarConfigDialogPane;
     friend class GuiderMultiStarConfigDialogCtrlSet;
@@ -132,6 +139,8 @@ public:
     const Star& PrimaryStar() const override;
     bool GetMultiStarMode() const override;
     wxString GetStarCount() const override;
+    unsigned int StarsUsed() const override;
+    unsigned int StarsRejected() const override;
     void SetMultiStarMode(bool val) override;
     void ClearSecondaryStars();
     wxString GetSettingsSummary() const override;
@@ -83,6 +83,8 @@ struct GuideStepInfo
     double starHFD;
     double avgDist;
     int starError;
+    unsigned int starsUsed;
+    unsigned int starsRejected;
 };
 
 struct FrameDroppedInfo
@@ -34,12 +34,15 @@
 
 #include "phd.h"
 #include "image_math.h"
+#include "image_simd.h"
+#include "thread_pool.h"
 
 #include <wx/wfstream.h>
 #include <wx/txtstrm.h>
 #include <wx/tokenzr.h>
 
 #include <algorithm>
+#include <memory>
 
 int dbl_sort_func (double *first, double *second)
 {
@@ -157,15 +160,11 @@ bool Median3(usImage& img)
         return true;
     }
 
-    if (img.Subframe.IsEmpty())
-    {
-        Median3(tmp.ImageData, img.ImageData, img.Size, wxRect(img.Size));
-    }
-    else
-    {
+    // only the subframe is filtered, the rest of the frame is left black
+    if (!img.Subframe.IsEmpty())
         tmp.Clear();
-        Median3(tmp.ImageData, img.ImageData, img.Size, img.Subframe);
-    }
+
+    Median3(tmp.ImageData, img.View());
 
     img.SwapImageData(tmp);
 
@@ -179,43 +178,6 @@ inline static void swap(unsigned short& a, unsigned short& b)
     b = t;
 }
 
-inline static unsigned short median9(const unsigned short l[9])
-{
-    unsigned short l0 = l[0], l1 = l[1], l2 = l[2], l3 = l[3], l4 = l[4];
-    unsigned short x;
-    x = l[5];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
-    x = l[6];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
-    x = l[7];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
-    x = l[8];
-    if (x < l0) swap(x, l0);
-    if (x < l1) swap(x, l1);
-    if (x < l2) swap(x, l2);
-    if (x < l3) swap(x, l3);
-    if (x < l4) swap(x, l4);
-
-    if (l1 > l0) l0 = l1;
-    if (l2 > l0) l0 = l2;
-    if (l3 > l0) l0 = l3;
-    if (l4 > l0) l0 = l4;
-
-    return l0;
-}
-
 inline static unsigned short median8(const unsigned short l[8])
 {
     unsigned short l0 = l[0], l1 = l[1], l2 = l[2], l3 = l[3], l4 = l[4];
@@ -320,52 +282,51 @@ inline static unsigned short median3(const unsigned short l[3])
     return l0;
 }
 
-void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect)
+void Median3Line(unsigned short *dst, const ImageView& view, int y)
 {
-    int const W = size.GetWidth();
-    int const RX = rect.GetX();
-    int const RY = rect.GetY();
-    int const RW = rect.GetWidth();
-    int const RH = rect.GetHeight();
+    const unsigned short *const src = view.base;
+    int const W = view.stride;
+    int const RX = view.rect.GetX();
+    int const RY = view.rect.GetY();
+    int const RW = view.rect.GetWidth();
+    int const RH = view.rect.GetHeight();
 
-    unsigned short a[9];
-    unsigned short *d;
+    unsigned short a[6];
+    unsigned short *d = dst;
 
 #define IX(x_, y_) ((RY + (y_)) * W + RX + (x_))
 
-    // top row
-    d = &dst[IX(0, 0)];
-
-    // top-left corner
-    a[0] = src[IX(0, 0)];
-    a[1] = src[IX(1, 0)];
-    a[2] = src[IX(0, 1)];
-    a[3] = src[IX(1, 1)];
-    *d++ = median4(a);
-
-    // top row middle pixels
-    for (int x = 1; x <= RW - 2; x++)
+    if (y == 0 || y == RH - 1)
     {
-        a[0] = src[IX(x - 1, 0)];
-        a[1] = src[IX(x,     0)];
-        a[2] = src[IX(x + 1, 0)];
-        a[3] = src[IX(x - 1, 1)];
-        a[4] = src[IX(x,     1)];
-        a[5] = src[IX(x + 1, 1)];
-        *d++ = median6(a);
-    }
+        // top or bottom row: 2x2 windows at the corners, 3x2 windows in between
+        int const y0 = y == 0 ? 0 : RH - 2;
+        int const y1 = y0 + 1;
 
-    // top-right corner
-    a[0] = src[IX(RW - 2, 0)];
-    a[1] = src[IX(RW - 1, 0)];
-    a[2] = src[IX(RW - 2, 1)];
-    a[3] = src[IX(RW - 1, 1)];
-    *d = median4(a);
+        a[0] = src[IX(0, y0)];
+        a[1] = src[IX(1, y0)];
+        a[2] = src[IX(0, y1)];
+        a[3] = src[IX(1, y1)];
+        *d++ = median4(a);
 
-    for (int y = 1; y <= RH - 2; y++)
-    {
-        d = &dst[IX(0, y)];
+        for (int x = 1; x <= RW - 2; x++)
+        {
+            a[0] = src[IX(x - 1, y0)];
+            a[1] = src[IX(x,     y0)];
+            a[2] = src[IX(x + 1, y0)];
+            a[3] = src[IX(x - 1, y1)];
+            a[4] = src[IX(x,     y1)];
+            a[5] = src[IX(x + 1, y1)];
+            *d++ = median6(a);
+        }
 
+        a[0] = src[IX(RW - 2, y0)];
+        a[1] = src[IX(RW - 1, y0)];
+        a[2] = src[IX(RW - 2, y1)];
+        a[3] = src[IX(RW - 1, y1)];
+        *d = median4(a);
+    }
+    else
+    {
         // leftmost pixel
         a[0] = src[IX(0, y - 1)];
         a[1] = src[IX(1, y - 1)];
@@ -375,18 +336,11 @@ void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size,
         a[5] = src[IX(1, y + 1)];
         *d++ = median6(a);
 
-        for (int x = 1; x <= RW - 2; x++)
+        // interior pixels: vectorized median of 9
+        if (RW > 2)
         {
-            a[0] = src[IX(x - 1, y - 1)];
-            a[1] = src[IX(x    , y - 1)];
-            a[2] = src[IX(x + 1, y - 1)];
-            a[3] = src[IX(x - 1, y    )];
-            a[4] = src[IX(x    , y    )];
-            a[5] = src[IX(x + 1, y    )];
-            a[6] = src[IX(x - 1, y + 1)];
-            a[7] = src[IX(x    , y + 1)];
-            a[8] = src[IX(x + 1, y + 1)];
-            *d++ = median9(a);
+            Median3Row(d, &src[IX(1, y - 1)], &src[IX(1, y)], &src[IX(1, y + 1)], RW - 2);
+            d += RW - 2;
         }
 
         // rightmost pixel
@@ -396,39 +350,23 @@ void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size,
         a[3] = src[IX(RW - 1, y    )];
         a[4] = src[IX(RW - 2, y + 1)];
         a[5] = src[IX(RW - 1, y + 1)];
-        *d++ = median6(a);
+        *d = median6(a);
     }
 
-    // bottom row
-    d = &dst[IX(0, RH - 1)];
-
-    // bottom-left corner
-    a[0] = src[IX(0, RH - 2)];
-    a[1] = src[IX(1, RH - 2)];
-    a[2] = src[IX(0, RH - 1)];
-    a[3] = src[IX(1, RH - 1)];
-    *d++ = median4(a);
+#undef IX
+}
 
-    // bottom row middle pixels
-    for (int x = 1; x <= RW - 2; x++)
-    {
-        a[0] = src[IX(x - 1, RH - 2)];
-        a[1] = src[IX(x    , RH - 2)];
-        a[2] = src[IX(x + 1, RH - 2)];
-        a[3] = src[IX(x - 1, RH - 1)];
-        a[4] = src[IX(x    , RH - 1)];
-        a[5] = src[IX(x + 1, RH - 1)];
-        *d++ = median6(a);
-    }
+void Median3(unsigned short *dst, const ImageView& src)
+{
+    const wxRect& rect = src.rect;
+    int const height = rect.GetHeight();
 
-    // bottom-right corner
-    a[0] = src[IX(RW - 2, RH - 2)];
-    a[1] = src[IX(RW - 1, RH - 2)];
-    a[2] = src[IX(RW - 2, RH - 1)];
-    a[3] = src[IX(RW - 1, RH - 1)];
-    *d = median4(a);
+    enum { MIN_BAND_ROWS = 64 };
 
-#undef IX
+    ThreadPool::ParallelForRows(height, ThreadPool::RowBands(height, MIN_BAND_ROWS), [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+            Median3Line(&dst[(rect.GetY() + y) * src.stride + rect.GetX()], src, y);
+    });
 }
 
 static unsigned short MedianBorderingPixels(const usImage& img, int x, int y)
@@ -572,49 +510,191 @@ bool SquarePixels(usImage& img, float xsize, float ysize)
     return false;
 }
 
+// One output row of BxB software binning. B is a compile-time constant so
+// the block loops unroll and the division by B*B becomes a multiply.
+template<int B, typename TD, typename TS>
+struct BinRow
+{
+    static void Run(TD *dst, const TS *src, int srcw, int n)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            const TS *p = src + x * B;
+            unsigned int sum = 0;
+            for (int j = 0; j < B; j++, p += srcw)
+                for (int i = 0; i < B; i++)
+                    sum += p[i];
+            dst[x] = (TD) (sum / (B * B));
+        }
+    }
+};
+
+// 2x2 binning into 16-bit pixels uses the vectorized row kernel
+template<typename TS>
+struct BinRow<2, unsigned short, TS>
+{
+    static void Run(unsigned short *dst, const TS *src, int srcw, int n)
+    {
+        Bin2x2Row(dst, src, src + srcw, n);
+    }
+};
+
+template<int B, typename TD, typename TS>
+static void BinPixelsN(TD *dst, const TS *src, const wxSize& srcsize)
+{
+    int const srcw = srcsize.x;
+    int const dstw = srcsize.x / B;
+    int const dsth = srcsize.y / B;
+
+    if (dstw == 0 || dsth == 0)
+        return;
+
+    enum { MIN_BAND_ROWS = 64 };
+
+    ThreadPool::ParallelForRows(dsth, ThreadPool::RowBands(dsth, MIN_BAND_ROWS), [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+            BinRow<B, TD, TS>::Run(dst + y * dstw, src + y * B * srcw, srcw, dstw);
+    });
+}
+
+// binning factors without a specialization
+template<typename TD, typename TS>
+static void BinPixelsAny(TD *dst, const TS *src, const wxSize& srcsize, unsigned int binning)
+{
+    int const srcw = srcsize.x;
+    int const dstw = srcsize.x / binning;
+    int const dsth = srcsize.y / binning;
+
+    for (int y = 0; y < dsth; y++)
+    {
+        for (int x = 0; x < dstw; x++)
+        {
+            const TS *p = src + y * binning * srcw + x * binning;
+            unsigned int sum = 0;
+            for (unsigned int j = 0; j < binning; j++, p += srcw)
+                for (unsigned int i = 0; i < binning; i++)
+                    sum += p[i];
+            *dst++ = (TD) (sum / (binning * binning));
+        }
+    }
+}
+
+template<typename TD, typename TS>
+static void BinPixelsImpl(TD *dst, const TS *src, const wxSize& srcsize, unsigned int binning)
+{
+    switch (binning)
+    {
+    case 0:
+        break;
+    case 2:
+        BinPixelsN<2>(dst, src, srcsize);
+        break;
+    case 3:
+        BinPixelsN<3>(dst, src, srcsize);
+        break;
+    case 4:
+        BinPixelsN<4>(dst, src, srcsize);
+        break;
+    default:
+        BinPixelsAny(dst, src, srcsize, binning);
+        break;
+    }
+}
+
+void BinPixels(unsigned char *dst, const unsigned char *src, const wxSize& srcsize, unsigned int binning)
+{
+    BinPixelsImpl(dst, src, srcsize, binning);
+}
+
+void BinPixels(unsigned short *dst, const unsigned short *src, const wxSize& srcsize, unsigned int binning)
+{
+    BinPixelsImpl(dst, src, srcsize, binning);
+}
+
+void BinPixels(unsigned short *dst, const unsigned char *src, const wxSize& srcsize, unsigned int binning)
+{
+    BinPixelsImpl(dst, src, srcsize, binning);
+}
+
 // Dark subtraction algorithm:
 //     Pedestal = max(median(dark_frame) - median(light_frame), 0) - handles overall gain/gradient differences
 //     Dark_corrected(i) = min(max(light(i) + pedestal - dark(i), 0), 65335)
-bool Subtract(usImage& light, const usImage& dark)
+// median ADU of the dark frame within a subframe region
+static unsigned short SubframeMedian(const usImage& dark, const wxRect& subframe)
+{
+    // histogram the subframe in place rather than copying it out for nth_element
+    static thread_local std::vector<unsigned int> s_histo;
+    s_histo.assign(65536, 0);
+
+    ImageView const view = dark.View(subframe);
+    for (int y = view.rect.GetTop(); y <= view.rect.GetBottom(); y++)
+    {
+        const unsigned short *p = view.Row(y) + view.rect.GetLeft();
+        for (const unsigned short *end = p + view.rect.GetWidth(); p < end; p++)
+            ++s_histo[*p];
+    }
+
+    // the value at index pixcnt/2 in sorted order
+    unsigned int n = (unsigned int) (view.rect.GetWidth() * view.rect.GetHeight()) / 2;
+    unsigned int i;
+    for (i = 0; i < 65535; i++)
+    {
+        if (s_histo[i] > n)
+            break;
+        n -= s_histo[i];
+    }
+    return (unsigned short) i;
+}
+
+void DarkMedianCache::Clear()
+{
+    m_dark = nullptr;
+    m_entries.clear();
+}
+
+unsigned short DarkMedianCache::GetMedian(const usImage& dark, const wxRect& subframe)
+{
+    if (&dark != m_dark)
+    {
+        m_entries.clear();
+        m_dark = &dark;
+    }
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        if (it->first == subframe)
+            return it->second;
+    }
+
+    unsigned short median = SubframeMedian(dark, subframe);
+
+    if (m_entries.size() >= MAX_ENTRIES)
+        m_entries.erase(m_entries.begin());
+    m_entries.push_back(std::make_pair(subframe, median));
+
+    return median;
+}
+
+bool Subtract(usImage& light, const usImage& dark, DarkMedianCache *medianCache)
 {
-    if (!light.ImageData || !dark.ImageData)
+    if ((!light.ImageData) || (!dark.ImageData))
         return true;
+
     if (light.Size != dark.Size)
         return true;
 
-    unsigned int left, top, width, height;
+    wxRect const rect = light.Subframe.IsEmpty() ? wxRect(light.Size) : light.Subframe;
+
     unsigned short median_light, median_dark;
     median_light = light.MedianADU;    // median of frame or subframe
 
     if (!light.Subframe.IsEmpty())
     {
-        left = light.Subframe.GetLeft();
-        width = light.Subframe.GetWidth();
-        top = light.Subframe.GetTop();
-        height = light.Subframe.GetHeight();
-
         // compute the dark's median ADU within the subframe region
-        unsigned int pixcnt = width * height;
-        unsigned short *tmp = new unsigned short[pixcnt];
-        const unsigned short *src = dark.ImageData + left + top * light.Size.GetWidth();
-        unsigned short *dst = tmp;
-        for (int y = 0; y < height; y++)
-        {
-            memcpy(dst, src, width * sizeof(unsigned short));
-            src += light.Size.GetWidth();
-            dst += width;
-        }
-        std::nth_element(tmp, tmp + pixcnt / 2, tmp + pixcnt);
-        median_dark = tmp[pixcnt / 2];
-        delete[] tmp;
+        median_dark = medianCache ? medianCache->GetMedian(dark, rect) : SubframeMedian(dark, rect);
     }
     else
-    {
-        left = top = 0;
-        width = light.Size.GetWidth();
-        height = light.Size.GetHeight();
         median_dark = dark.MedianADU; // use the pre-computed full frame median ADU
-    }
 
     if (median_dark > median_light)
     {
@@ -622,22 +702,9 @@ bool Subtract(usImage& light, const usImage& dark)
         light.Pedestal = median_dark - median_light;   // Needed for saturation detection in find-star
     }
 
-    unsigned short *pl0 = &light.Pixel(left, top);
-    const unsigned short *pd0 = &dark.Pixel(left, top);
-    for (unsigned int r = 0; r < height;
-         r++, pl0 += light.Size.GetWidth(), pd0 += light.Size.GetWidth())
-    {
-        unsigned short *const endl = pl0 + width;
-        unsigned short *pl;
-        const unsigned short *pd;
-        for (pl = pl0, pd = pd0; pl < endl; pl++, pd++)
-        {
-            int newval = (int) *pl + light.Pedestal - (int) *pd;
-            if (newval < 0) newval = 0; // hot pixel in dark frame isn't present in light frame
-            else if (newval > 65535) newval = 65535;
-            *pl = (unsigned short) newval;
-        }
-    }
+    int const width = rect.GetWidth();
+    for (int y = rect.GetTop(); y <= rect.GetBottom(); y++)
+        SubtractDarkRow(&light.Pixel(rect.GetLeft(), y), &dark.Pixel(rect.GetLeft(), y), light.Pedestal, width);
 
     return false;
 }
@@ -661,89 +728,170 @@ inline static unsigned short histo_median(unsigned short histo1[256], unsigned s
     return i;
 }
 
-static void MedianFilter(usImage& dst, const usImage& src, int halfWidth)
+namespace
 {
-    dst.Init(src.Size);
-    unsigned short *d = &dst.ImageData[0];
+// 2-level histogram of the pixels inside the sliding median window
+struct MedianHisto
+{
+    unsigned short histo1[256];
+    unsigned short histo2[65536];
+    unsigned int n;
+
+    void Clear()
+    {
+        memset(&histo1[0], 0, sizeof(histo1));
+        memset(&histo2[0], 0, sizeof(histo2));
+        n = 0;
+    }
+    void AddRow(const unsigned short *p, int cnt)
+    {
+        for (const unsigned short *end = p + cnt; p < end; p++)
+        {
+            ++histo1[*p >> 8];
+            ++histo2[*p];
+        }
+        n += cnt;
+    }
+    void RemoveRow(const unsigned short *p, int cnt)
+    {
+        for (const unsigned short *end = p + cnt; p < end; p++)
+        {
+            --histo1[*p >> 8];
+            --histo2[*p];
+        }
+        n -= cnt;
+    }
+    void AddCol(const unsigned short *p, int cnt, int stride)
+    {
+        for (int j = 0; j < cnt; j++, p += stride)
+        {
+            ++histo1[*p >> 8];
+            ++histo2[*p];
+        }
+        n += cnt;
+    }
+    void RemoveCol(const unsigned short *p, int cnt, int stride)
+    {
+        for (int j = 0; j < cnt; j++, p += stride)
+        {
+            --histo1[*p >> 8];
+            --histo2[*p];
+        }
+        n -= cnt;
+    }
+    unsigned short Median() { return histo_median(histo1, histo2, n); }
+};
+} // namespace
 
+// Median filter rows [y0, y1) of src into dst. The window slides across a
+// row, steps down one row, and slides back the other way, so the histogram is
+// only built once per band.
+static void MedianFilterBand(usImage& dst, const usImage& src, int halfWidth, int y0, int y1, MedianHisto& h)
+{
     int const width = src.Size.GetWidth();
     int const height = src.Size.GetHeight();
 
-    for (int y = 0; y < height; y++)
+    int top = std::max(0, y0 - halfWidth);
+    int bot = std::min(y0 + halfWidth, height - 1);
+
+    h.Clear();
+    for (int j = top; j <= bot; j++)
+        h.AddRow(&src.Pixel(0, j), std::min(halfWidth, width - 1) + 1);
+
+    int x = 0;
+    int y = y0;
+    for (;;)
     {
-        int top = std::max(0, y - halfWidth);
-        int bot = std::min(y + halfWidth, height - 1);
-        int left = 0;
-        int right = halfWidth;
-
-        // TODO: we initialize the histogram at the start of each row, but we could make this faster
-        // if we scan left to right, move down, scan right to left, move down so we never need to
-        // reinitialize the histogram
-
-        // initialize 2-level histogram
-        unsigned short histo1[256];
-        unsigned short histo2[65536];
-        memset(&histo1[0], 0, sizeof(histo1));
-        memset(&histo2[0], 0, sizeof(histo2));
+        unsigned short *d = &dst.Pixel(x, y);
+        *d = h.Median();
 
-        for (int j = top; j <= bot; j++)
+        if (((y - y0) & 1) == 0)
         {
-            const unsigned short *p = &src.Pixel(left, j);
-            for (int i = left; i <= right; i++, p++)
+            // left to right
+            for (x = 1; x < width; x++)
             {
-                ++histo1[*p >> 8];
-                ++histo2[*p];
+                if (x - halfWidth - 1 >= 0)
+                    h.RemoveCol(&src.Pixel(x - halfWidth - 1, top), bot - top + 1, width);
+                if (x + halfWidth < width)
+                    h.AddCol(&src.Pixel(x + halfWidth, top), bot - top + 1, width);
+                *++d = h.Median();
             }
+            x = width - 1;
         }
-        unsigned int n = (right - left + 1) * (bot - top + 1);
-
-        // read off first value for this row
-        *d++ = histo_median(histo1, histo2, n);
-
-        // loop across remaining columns for this row
-        for (int i = 1; i < width; i++)
+        else
         {
-            left = std::max(0, i - halfWidth);
-            right = std::min(i + halfWidth, width - 1);
-
-            // remove leftmost column
-            if (left > 0)
+            // right to left
+            for (x = width - 2; x >= 0; x--)
             {
-                const unsigned short *p = &src.Pixel(left - 1, top);
-                for (int j = top; j <= bot; j++, p += width)
-                {
-                    --histo1[*p >> 8];
-                    --histo2[*p];
-                }
-                n -= (bot - top + 1);
+                if (x + halfWidth + 1 < width)
+                    h.RemoveCol(&src.Pixel(x + halfWidth + 1, top), bot - top + 1, width);
+                if (x - halfWidth >= 0)
+                    h.AddCol(&src.Pixel(x - halfWidth, top), bot - top + 1, width);
+                *--d = h.Median();
             }
+            x = 0;
+        }
 
-            // add new column on right
-            if (i + halfWidth <= width - 1)
-            {
-                const unsigned short *p = &src.Pixel(right, top);
-                for (int j = top; j <= bot; j++, p += width)
-                {
-                    ++histo1[*p >> 8];
-                    ++histo2[*p];
-                }
-                n += (bot - top + 1);
-            }
+        if (++y >= y1)
+            break;
 
-            *d++ = histo_median(histo1, histo2, n);
-        }
+        // move the window down one row
+        int left = std::max(0, x - halfWidth);
+        int right = std::min(x + halfWidth, width - 1);
+        if (y - halfWidth - 1 >= 0)
+            h.RemoveRow(&src.Pixel(left, y - halfWidth - 1), right - left + 1);
+        if (y + halfWidth < height)
+            h.AddRow(&src.Pixel(left, y + halfWidth), right - left + 1);
+        top = std::max(0, y - halfWidth);
+        bot = std::min(y + halfWidth, height - 1);
     }
 }
 
+void MedianFilter(usImage& dst, const usImage& src, int halfWidth)
+{
+    dst.Init(src.Size);
+
+    int const height = src.Size.GetHeight();
+    if (height == 0 || src.Size.GetWidth() == 0)
+        return;
+
+    // each band pays for one histogram fill, which is small compared to a
+    // band's worth of rows
+    enum { MIN_BAND_ROWS = 16 };
+
+    ThreadPool::ParallelForRows(height, ThreadPool::RowBands(height, MIN_BAND_ROWS), [&](int, int y0, int y1) {
+        std::unique_ptr<MedianHisto> h(new MedianHisto());
+        MedianFilterBand(dst, src, halfWidth, y0, y1, *h);
+    });
+}
+
 struct ImageStatsWork
 {
     ImageStats stats;
-    usImage temp;
+    std::vector<unsigned int> histo;
+    std::vector<unsigned int> devHisto;
 };
 
+// value at index n of the sorted pixels counted in histo
+static unsigned short HistoNth(const std::vector<unsigned int>& histo, unsigned int n)
+{
+    unsigned int i;
+    for (i = 0; i < 65535; i++)
+    {
+        if (histo[i] > n)
+            break;
+        n -= histo[i];
+    }
+    return (unsigned short) i;
+}
+
 static void GetImageStats(ImageStatsWork& w, const usImage& img, const wxRect& win)
 {
-    w.temp.Init(img.Size);
+    // the window is read in place; the median and MAD come from histograms
+    // rather than from sorting a copy of the pixels
+    ImageView const view = img.View(win);
+
+    w.histo.assign(65536, 0);
 
     // Determine the mean and standard deviation
     double a = 0.0;
@@ -751,14 +899,13 @@ static void GetImageStats(ImageStatsWork& w, const usImage& img, const wxRect& w
     double k = 1.0;
     double km1 = 0.0;
 
-    const unsigned short *p0 = &img.Pixel(win.GetLeft(), win.GetTop());
-    unsigned short *dst = &w.temp.ImageData[0];
-    for (int y = 0; y < win.GetHeight(); y++)
+    for (int y = win.GetTop(); y <= win.GetBottom(); y++)
     {
+        const unsigned short *p0 = view.Row(y) + win.GetLeft();
         const unsigned short *end = p0 + win.GetWidth();
         for (const unsigned short *p = p0; p < end; p++)
         {
-            *dst++ = *p;
+            ++w.histo[*p];
             double const x = (double) *p;
             double const a0 = a;
             a += (x - a) / k;
@@ -766,27 +913,20 @@ static void GetImageStats(ImageStatsWork& w, const usImage& img, const wxRect& w
             km1 = k;
             k += 1.0;
         }
-        p0 += img.Size.GetWidth();
     }
 
     w.stats.mean = a;
     w.stats.stdev = sqrt(q / km1);
 
-    int winPixels = win.GetWidth() * win.GetHeight();
-    unsigned short *tmp = &w.temp.ImageData[0];
-    std::nth_element(tmp, tmp + winPixels / 2, tmp + winPixels);
+    unsigned int winPixels = win.GetWidth() * win.GetHeight();
+    int const median = HistoNth(w.histo, winPixels / 2);
+    w.stats.median = median;
 
-    w.stats.median = tmp[winPixels / 2];
-
-    // replace each pixel with the absolute deviation from the median
-    unsigned short *p = tmp;
-    for (int i = 0; i < winPixels; i++)
-    {
-        unsigned short ad = (unsigned short) std::abs((int) *p - (int) w.stats.median);
-        *p++ = ad;
-    }
-    std::nth_element(tmp, tmp + winPixels / 2, tmp + winPixels);
-    w.stats.mad = tmp[winPixels / 2];
+    // histogram of the absolute deviations from the median
+    w.devHisto.assign(65536, 0);
+    for (int v = 0; v < 65536; v++)
+        w.devHisto[std::abs(v - median)] += w.histo[v];
+    w.stats.mad = HistoNth(w.devHisto, winPixels / 2);
 }
 
 void DefectMapDarks::BuildFilteredDark()
@@ -1041,38 +1181,19 @@ const wxArrayString& DefectMapBuilder::GetMapInfo() const
 
 bool RemoveDefects(usImage& light, const DefectMap& defectMap)
 {
-    // Check to make sure the light frame is valid
     if (!light.ImageData)
         return true;
 
-    if (!light.Subframe.IsEmpty())
-    {
-        // Step over each defect and replace the light value
-        // with the median of the surrounding pixels
-        for (DefectMap::const_iterator it = defectMap.begin(); it != defectMap.end(); ++it)
-        {
-            const wxPoint& pt = *it;
-            // Check to see if we are within the subframe before correcting the defect
-            if (light.Subframe.Contains(pt))
-            {
-                light.Pixel(pt.x, pt.y) = MedianBorderingPixels(light, pt.x, pt.y);
-            }
-        }
-    }
-    else
-    {
-        // Step over each defect and replace the light value
-        // with the median of the surrounding pixels
-        for (DefectMap::const_iterator it = defectMap.begin(); it != defectMap.end(); ++it)
-        {
-            int const x = it->x;
-            int const y = it->y;
+    wxRect const rect = light.Subframe.IsEmpty() ? wxRect(light.Size) : light.Subframe;
 
-            if (x >= 0 && x < light.Size.GetWidth() && y >= 0 && y < light.Size.GetHeight())
-            {
-                light.Pixel(x, y) = MedianBorderingPixels(light, x, y);
-            }
-        }
+    // Step over each defect in the frame or subframe and replace the light
+    // value with the median of the surrounding pixels
+    DefectMap::const_iterator it, end;
+    defectMap.GetRows(rect.GetTop(), rect.GetBottom(), &it, &end);
+    for (; it != end; ++it)
+    {
+        if (it->x >= rect.GetLeft() && it->x <= rect.GetRight())
+            light.Pixel(it->x, it->y) = MedianBorderingPixels(light, it->x, it->y);
     }
 
     return false;
@@ -1190,18 +1311,74 @@ void DefectMap::Save(const wxArrayString& info) const
 }
 
 DefectMap::DefectMap()
-    : m_profileId(pConfig->GetCurrentProfileId())
+    : m_profileId(pConfig->GetCurrentProfileId()),
+    m_indexValid(false)
 {
 }
 
 DefectMap::DefectMap(int profileId)
-    : m_profileId(profileId)
+    : m_profileId(profileId),
+    m_indexValid(false)
 {
 }
 
+inline static bool RowMajorLess(const wxPoint& a, const wxPoint& b)
+{
+    return a.y < b.y || (a.y == b.y && a.x < b.x);
+}
+
+void DefectMap::BuildIndex() const
+{
+    m_sorted.clear();
+    m_sorted.reserve(m_defects.size());
+
+    int maxY = -1;
+    for (const_iterator it = m_defects.begin(); it != m_defects.end(); ++it)
+    {
+        // points off the sensor can never be applied
+        if (it->x < 0 || it->y < 0)
+            continue;
+        m_sorted.push_back(*it);
+        maxY = std::max(maxY, it->y);
+    }
+
+    std::sort(m_sorted.begin(), m_sorted.end(), RowMajorLess);
+
+    m_rowStart.assign(maxY + 2, 0);
+    for (const_iterator it = m_sorted.begin(); it != m_sorted.end(); ++it)
+        ++m_rowStart[it->y + 1];
+    for (unsigned int y = 1; y < m_rowStart.size(); y++)
+        m_rowStart[y] += m_rowStart[y - 1];
+
+    m_indexValid = true;
+}
+
+void DefectMap::GetRows(int top, int bottom, const_iterator *first, const_iterator *last) const
+{
+    if (!m_indexValid)
+        BuildIndex();
+
+    top = std::max(top, 0);
+    bottom = std::min(bottom, (int) m_rowStart.size() - 2);
+
+    if (top > bottom)
+    {
+        *first = *last = m_sorted.end();
+        return;
+    }
+
+    *first = m_sorted.begin() + m_rowStart[top];
+    *last = m_sorted.begin() + m_rowStart[bottom + 1];
+}
+
 bool DefectMap::FindDefect(const wxPoint& pt) const
 {
-    return std::find(begin(), end(), pt) != end();
+    if (pt.x < 0 || pt.y < 0)
+        return std::find(m_defects.begin(), m_defects.end(), pt) != m_defects.end(); // not indexed
+
+    const_iterator first, last;
+    GetRows(pt.y, pt.y, &first, &last);
+    return std::binary_search(first, last, pt, RowMajorLess);
 }
 
 void DefectMap::AddDefect(const wxPoint& pt)
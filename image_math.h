@@ -36,11 +36,24 @@
 #ifndef IMAGE_MATH_INCLUDED
 #define IMAGE_MATH_INCLUDED
 
-class DefectMap : public std::vector<wxPoint>
+// The defect list is kept in the order the defects were added (the order
+// they appear in the defect map file). A row index, sorted by (y, x), is
+// built on demand for lookups and for applying the map to a subframe.
+class DefectMap
 {
     int m_profileId;
+    std::vector<wxPoint> m_defects;
+
+    mutable bool m_indexValid;
+    mutable std::vector<wxPoint> m_sorted;         // defects with x, y >= 0 sorted by (y, x)
+    mutable std::vector<unsigned int> m_rowStart;  // row y is m_sorted[m_rowStart[y] .. m_rowStart[y + 1])
+
     DefectMap(int profileId);
+    void BuildIndex() const;
+
 public:
+    typedef std::vector<wxPoint>::const_iterator const_iterator;
+
     static void DeleteDefectMap(int profileId);
     static bool DefectMapExists(int profileId, bool showAlert);
     static DefectMap *LoadDefectMap(int profileId);
@@ -51,17 +64,49 @@ public:
     bool FindDefect(const wxPoint& pt) const;
     void AddDefect(const wxPoint& pt);
 
+    const_iterator begin() const { return m_defects.begin(); }
+    const_iterator end() const { return m_defects.end(); }
+    size_t size() const { return m_defects.size(); }
+    bool empty() const { return m_defects.empty(); }
+    void push_back(const wxPoint& pt) { m_defects.push_back(pt); m_indexValid = false; }
+    void clear() { m_defects.clear(); m_indexValid = false; }
+
+    // defects in rows [top, bottom], sorted by (y, x)
+    void GetRows(int top, int bottom, const_iterator *first, const_iterator *last) const;
 };
 
 extern bool QuickLRecon(usImage& img);
-extern void Median3(unsigned short *dst, const unsigned short *src, const wxSize& size, const wxRect& rect);
+// 3x3 median filter of the view, written to the same position in dst (which
+// has the view's stride); Median3Line filters row y of the view only
+extern void Median3(unsigned short *dst, const ImageView& src);
+extern void Median3Line(unsigned short *dst, const ImageView& src, int y);
 extern bool Median3(usImage& img);
+extern void MedianFilter(usImage& dst, const usImage& src, int halfWidth);
 extern bool SquarePixels(usImage& img, float xsize, float ysize);
 extern int dbl_sort_func(double *first, double *second);
-extern bool Subtract(usImage& light, const usImage& dark);
 extern double CalcSlope(const ArrayOfDbl& y);
 extern bool RemoveDefects(usImage& light, const DefectMap& defectMap);
 
+// Caches the median ADU of a dark frame over subframe rectangles so dark
+// subtraction does not rescan the dark on every subframe exposure.
+// Clear() must be called before the dark frame is deleted.
+class DarkMedianCache
+{
+    enum { MAX_ENTRIES = 8 };
+
+    const usImage *m_dark;
+    std::vector<std::pair<wxRect, unsigned short>> m_entries;
+
+public:
+    DarkMedianCache() : m_dark(nullptr) { }
+    void Clear();
+    unsigned short GetMedian(const usImage& dark, const wxRect& subframe);
+};
+
+// Dark-subtract the light frame (or its subframe); the dark's subframe
+// median is taken from medianCache when one is given
+extern bool Subtract(usImage& light, const usImage& dark, DarkMedianCache *medianCache = nullptr);
+
 struct DefectMapBuilderImpl;
 
 struct DefectMapDarks
@@ -151,76 +196,13 @@ inline static double LST(double longitude)
     return LST(time(0), longitude);
 }
 
-template<typename T>
-static void BinPixels(T *dst, const T *src, const wxSize& srcsize, unsigned int binning)
-{
-    int const srcw = srcsize.x;
-    int const srch = srcsize.y;
-
-    T *dstp = dst;
-
-    if (binning == 2)
-    {
-        for (int srcy = 0; srcy < srch; srcy += 2)
-        {
-            for (int srcx = 0; srcx < srcw; srcx += 2)
-            {
-                *dstp++ =
-                    ((unsigned int) src[srcy * srcw + srcx] +
-                     (unsigned int) src[srcy * srcw + srcx + 1] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx + 1]) / 4;
-            }
-        }
-    }
-    else if (binning == 3)
-    {
-        int tw = (srcw / binning) * binning;
-        int th = (srch / binning) * binning;
-        for (int srcy = 0; srcy < th; srcy += 3)
-        {
-            for (int srcx = 0; srcx < tw; srcx += 3)
-            {
-                *dstp++ =
-                    ((unsigned int) src[srcy * srcw + srcx] +
-                     (unsigned int) src[srcy * srcw + srcx + 1] +
-                     (unsigned int) src[srcy * srcw + srcx + 2] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx + 1] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx + 2] +
-                     (unsigned int) src[(srcy + 2) * srcw + srcx] +
-                     (unsigned int) src[(srcy + 2) * srcw + srcx + 1] +
-                     (unsigned int) src[(srcy + 2) * srcw + srcx + 2]) / 9;
-            }
-        }
-    }
-    else if (binning == 4)
-    {
-        for (int srcy = 0; srcy < srch; srcy += 4)
-        {
-            for (int srcx = 0; srcx < srcw; srcx += 4)
-            {
-                *dstp++ =
-                    ((unsigned int) src[srcy * srcw + srcx] +
-                     (unsigned int) src[srcy * srcw + srcx + 1] +
-                     (unsigned int) src[srcy * srcw + srcx + 2] +
-                     (unsigned int) src[srcy * srcw + srcx + 3] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx + 1] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx + 2] +
-                     (unsigned int) src[(srcy + 1) * srcw + srcx + 3] +
-                     (unsigned int) src[(srcy + 2) * srcw + srcx] +
-                     (unsigned int) src[(srcy + 2) * srcw + srcx + 1] +
-                     (unsigned int) src[(srcy + 2) * srcw + srcx + 2] +
-                     (unsigned int) src[(srcy + 2) * srcw + srcx + 3] +
-                     (unsigned int) src[(srcy + 3) * srcw + srcx] +
-                     (unsigned int) src[(srcy + 3) * srcw + srcx + 1] +
-                     (unsigned int) src[(srcy + 3) * srcw + srcx + 2] +
-                     (unsigned int) src[(srcy + 3) * srcw + srcx + 3]) / 16;
-            }
-        }
-    }
-}
+// Average software binning of a srcsize frame into dst, which holds
+// (srcsize / binning) pixels. Rows and columns at the right and bottom edges
+// that do not fill a whole bin are dropped. The 8-bit to 16-bit variant bins
+// camera data straight into usImage pixels.
+extern void BinPixels(unsigned char *dst, const unsigned char *src, const wxSize& srcsize, unsigned int binning);
+extern void BinPixels(unsigned short *dst, const unsigned short *src, const wxSize& srcsize, unsigned int binning);
+extern void BinPixels(unsigned short *dst, const unsigned char *src, const wxSize& srcsize, unsigned int binning);
 
 inline static void BinPixels8(void *dst, const void *src, const wxSize& srcsize, unsigned int binning)
 {
@@ -0,0 +1,1213 @@
+/*
+ *  image_simd.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+#include "image_simd.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+# define SIMD_X86 1
+# include <emmintrin.h>
+# include <immintrin.h>
+# if defined(_MSC_VER)
+#  include <intrin.h>
+# endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__) || defined(_M_ARM64)
+# define SIMD_NEON 1
+# include <arm_neon.h>
+#endif
+
+// gcc and clang need per-function target attributes to emit instructions that
+// are not enabled for the whole translation unit; msvc always allows intrinsics
+#if defined(__GNUC__) || defined(__clang__)
+# define SIMD_TARGET(t) __attribute__((target(t)))
+#else
+# define SIMD_TARGET(t)
+#endif
+
+static SimdLevel DetectLevel()
+{
+#if defined(SIMD_X86)
+# if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    int const maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    bool const sse2 = (regs[3] & (1 << 26)) != 0;
+    bool const osxsave = (regs[2] & (1 << 27)) != 0;
+    bool const avx = (regs[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(regs, 7, 0);
+        avx2 = (regs[1] & (1 << 5)) != 0;
+    }
+# else
+    __builtin_cpu_init();
+    bool const sse2 = __builtin_cpu_supports("sse2");
+    bool const avx2 = __builtin_cpu_supports("avx2");
+# endif
+    if (avx2)
+        return SIMD_AVX2;
+    if (sse2)
+        return SIMD_SSE2;
+    return SIMD_NONE;
+#elif defined(SIMD_NEON)
+    return SIMD_NEON;
+#else
+    return SIMD_NONE;
+#endif
+}
+
+SimdLevel SimdDetect()
+{
+    static SimdLevel s_detected = DetectLevel();
+    return s_detected;
+}
+
+static SimdLevel s_level = SimdDetect();
+
+SimdLevel SimdGetLevel()
+{
+    return s_level;
+}
+
+bool SimdLevelSupported(SimdLevel level)
+{
+    SimdLevel const cpu = SimdDetect();
+
+    switch (level)
+    {
+    case SIMD_NONE:
+        return true;
+    case SIMD_SSE2:
+        return cpu == SIMD_SSE2 || cpu == SIMD_AVX2;
+    case SIMD_AVX2:
+        return cpu == SIMD_AVX2;
+    case SIMD_NEON:
+        return cpu == SIMD_NEON;
+    }
+    return false;
+}
+
+bool SimdSetLevel(SimdLevel level)
+{
+    if (!SimdLevelSupported(level))
+        return false;
+    s_level = level;
+    return true;
+}
+
+const char *SimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SIMD_NONE: return "scalar";
+    case SIMD_SSE2: return "SSE2";
+    case SIMD_AVX2: return "AVX2";
+    case SIMD_NEON: return "NEON";
+    }
+    return "?";
+}
+
+// ---------------------------------------------------------------------------
+// 3x3 median
+//
+// The median of 9 is computed by sorting each of the three columns, then
+// taking the median of (max of the column minimums, median of the column
+// medians, min of the column maximums). This is exact, and uses only min/max
+// operations, so it maps directly onto SIMD instructions.
+
+#define SORT2(a, b) do { unsigned short const t_ = std::min(a, b); b = std::max(a, b); a = t_; } while (0)
+
+inline static void sort3(unsigned short& a, unsigned short& b, unsigned short& c)
+{
+    SORT2(a, b);
+    SORT2(b, c);
+    SORT2(a, b);
+}
+
+inline static unsigned short med3(unsigned short a, unsigned short b, unsigned short c)
+{
+    return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
+
+static void Median3RowScalar(unsigned short *dst, const unsigned short *r0, const unsigned short *r1,
+                             const unsigned short *r2, int n)
+{
+    for (int x = 0; x < n; x++)
+    {
+        unsigned short a0 = r0[x - 1], a1 = r1[x - 1], a2 = r2[x - 1];
+        unsigned short b0 = r0[x    ], b1 = r1[x    ], b2 = r2[x    ];
+        unsigned short c0 = r0[x + 1], c1 = r1[x + 1], c2 = r2[x + 1];
+        sort3(a0, a1, a2);
+        sort3(b0, b1, b2);
+        sort3(c0, c1, c2);
+        unsigned short const lo = std::max(std::max(a0, b0), c0);
+        unsigned short const hi = std::min(std::min(a2, b2), c2);
+        unsigned short const mid = med3(a1, b1, c1);
+        dst[x] = med3(lo, mid, hi);
+    }
+}
+
+#undef SORT2
+
+#if defined(SIMD_X86)
+
+// SSE2 only has signed 16-bit min/max; flipping the sign bit maps unsigned
+// order onto signed order, so we bias on load and un-bias on store
+#define SSE_SORT2(a, b) do { __m128i const t_ = _mm_min_epi16(a, b); b = _mm_max_epi16(a, b); a = t_; } while (0)
+
+SIMD_TARGET("sse2")
+static void Median3RowSSE2(unsigned short *dst, const unsigned short *r0, const unsigned short *r1,
+                           const unsigned short *r2, int n)
+{
+    __m128i const bias = _mm_set1_epi16((short) 0x8000);
+    int x = 0;
+
+#define LD(p) _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), bias)
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i a0 = LD(r0 + x - 1), a1 = LD(r1 + x - 1), a2 = LD(r2 + x - 1);
+        __m128i b0 = LD(r0 + x    ), b1 = LD(r1 + x    ), b2 = LD(r2 + x    );
+        __m128i c0 = LD(r0 + x + 1), c1 = LD(r1 + x + 1), c2 = LD(r2 + x + 1);
+
+        SSE_SORT2(a0, a1); SSE_SORT2(a1, a2); SSE_SORT2(a0, a1);
+        SSE_SORT2(b0, b1); SSE_SORT2(b1, b2); SSE_SORT2(b0, b1);
+        SSE_SORT2(c0, c1); SSE_SORT2(c1, c2); SSE_SORT2(c0, c1);
+
+        __m128i const lo = _mm_max_epi16(_mm_max_epi16(a0, b0), c0);
+        __m128i const hi = _mm_min_epi16(_mm_min_epi16(a2, b2), c2);
+        __m128i const mid = _mm_max_epi16(_mm_min_epi16(a1, b1), _mm_min_epi16(_mm_max_epi16(a1, b1), c1));
+        __m128i const med = _mm_max_epi16(_mm_min_epi16(lo, mid), _mm_min_epi16(_mm_max_epi16(lo, mid), hi));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_xor_si128(med, bias));
+    }
+#undef LD
+
+    Median3RowScalar(dst + x, r0 + x, r1 + x, r2 + x, n - x);
+}
+
+#undef SSE_SORT2
+
+#define AVX_SORT2(a, b) do { __m256i const t_ = _mm256_min_epu16(a, b); b = _mm256_max_epu16(a, b); a = t_; } while (0)
+
+SIMD_TARGET("avx2")
+static void Median3RowAVX2(unsigned short *dst, const unsigned short *r0, const unsigned short *r1,
+                           const unsigned short *r2, int n)
+{
+    int x = 0;
+
+#define LD(p) _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))
+    for (; x + 16 <= n; x += 16)
+    {
+        __m256i a0 = LD(r0 + x - 1), a1 = LD(r1 + x - 1), a2 = LD(r2 + x - 1);
+        __m256i b0 = LD(r0 + x    ), b1 = LD(r1 + x    ), b2 = LD(r2 + x    );
+        __m256i c0 = LD(r0 + x + 1), c1 = LD(r1 + x + 1), c2 = LD(r2 + x + 1);
+
+        AVX_SORT2(a0, a1); AVX_SORT2(a1, a2); AVX_SORT2(a0, a1);
+        AVX_SORT2(b0, b1); AVX_SORT2(b1, b2); AVX_SORT2(b0, b1);
+        AVX_SORT2(c0, c1); AVX_SORT2(c1, c2); AVX_SORT2(c0, c1);
+
+        __m256i const lo = _mm256_max_epu16(_mm256_max_epu16(a0, b0), c0);
+        __m256i const hi = _mm256_min_epu16(_mm256_min_epu16(a2, b2), c2);
+        __m256i const mid = _mm256_max_epu16(_mm256_min_epu16(a1, b1), _mm256_min_epu16(_mm256_max_epu16(a1, b1), c1));
+        __m256i const med = _mm256_max_epu16(_mm256_min_epu16(lo, mid), _mm256_min_epu16(_mm256_max_epu16(lo, mid), hi));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), med);
+    }
+#undef LD
+
+    Median3RowScalar(dst + x, r0 + x, r1 + x, r2 + x, n - x);
+}
+
+#undef AVX_SORT2
+
+#endif // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+#define NEON_SORT2(a, b) do { uint16x8_t const t_ = vminq_u16(a, b); b = vmaxq_u16(a, b); a = t_; } while (0)
+
+static void Median3RowNEON(unsigned short *dst, const unsigned short *r0, const unsigned short *r1,
+                           const unsigned short *r2, int n)
+{
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        uint16x8_t a0 = vld1q_u16(r0 + x - 1), a1 = vld1q_u16(r1 + x - 1), a2 = vld1q_u16(r2 + x - 1);
+        uint16x8_t b0 = vld1q_u16(r0 + x    ), b1 = vld1q_u16(r1 + x    ), b2 = vld1q_u16(r2 + x    );
+        uint16x8_t c0 = vld1q_u16(r0 + x + 1), c1 = vld1q_u16(r1 + x + 1), c2 = vld1q_u16(r2 + x + 1);
+
+        NEON_SORT2(a0, a1); NEON_SORT2(a1, a2); NEON_SORT2(a0, a1);
+        NEON_SORT2(b0, b1); NEON_SORT2(b1, b2); NEON_SORT2(b0, b1);
+        NEON_SORT2(c0, c1); NEON_SORT2(c1, c2); NEON_SORT2(c0, c1);
+
+        uint16x8_t const lo = vmaxq_u16(vmaxq_u16(a0, b0), c0);
+        uint16x8_t const hi = vminq_u16(vminq_u16(a2, b2), c2);
+        uint16x8_t const mid = vmaxq_u16(vminq_u16(a1, b1), vminq_u16(vmaxq_u16(a1, b1), c1));
+        uint16x8_t const med = vmaxq_u16(vminq_u16(lo, mid), vminq_u16(vmaxq_u16(lo, mid), hi));
+
+        vst1q_u16(dst + x, med);
+    }
+
+    Median3RowScalar(dst + x, r0 + x, r1 + x, r2 + x, n - x);
+}
+
+#undef NEON_SORT2
+
+#endif // SIMD_NEON
+
+void Median3Row(unsigned short *dst, const unsigned short *r0, const unsigned short *r1,
+                const unsigned short *r2, int n)
+{
+    switch (s_level)
+    {
+#if defined(SIMD_X86)
+    case SIMD_AVX2:
+        Median3RowAVX2(dst, r0, r1, r2, n);
+        break;
+    case SIMD_SSE2:
+        Median3RowSSE2(dst, r0, r1, r2, n);
+        break;
+#endif
+#if defined(SIMD_NEON)
+    case SIMD_NEON:
+        Median3RowNEON(dst, r0, r1, r2, n);
+        break;
+#endif
+    default:
+        Median3RowScalar(dst, r0, r1, r2, n);
+        break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// dark subtraction
+//
+// light + pedestal - dark, clamped to [0, 65535], computed with unsigned
+// saturating arithmetic only:
+//
+//   light >= dark:  sat(light - dark + pedestal)  = adds(subs(light, dark), pedestal)
+//   light <  dark:  max(pedestal - (dark - light), 0) = subs(pedestal, subs(dark, light))
+//
+// and since one of subs(light, dark) and subs(dark, light) is always zero,
+// both cases are  subs(adds(subs(light, dark), pedestal), subs(dark, light))
+
+static void SubtractDarkRowScalar(unsigned short *light, const unsigned short *dark, unsigned short pedestal, int n)
+{
+    for (int x = 0; x < n; x++)
+    {
+        int newval = (int) light[x] + pedestal - (int) dark[x];
+        if (newval < 0) newval = 0; // hot pixel in dark frame isn't present in light frame
+        else if (newval > 65535) newval = 65535;
+        light[x] = (unsigned short) newval;
+    }
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2")
+static void SubtractDarkRowSSE2(unsigned short *light, const unsigned short *dark, unsigned short pedestal, int n)
+{
+    __m128i const ped = _mm_set1_epi16((short) pedestal);
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i const l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(light + x));
+        __m128i const d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dark + x));
+        __m128i const r = _mm_subs_epu16(_mm_adds_epu16(_mm_subs_epu16(l, d), ped), _mm_subs_epu16(d, l));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(light + x), r);
+    }
+
+    SubtractDarkRowScalar(light + x, dark + x, pedestal, n - x);
+}
+
+SIMD_TARGET("avx2")
+static void SubtractDarkRowAVX2(unsigned short *light, const unsigned short *dark, unsigned short pedestal, int n)
+{
+    __m256i const ped = _mm256_set1_epi16((short) pedestal);
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m256i const l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(light + x));
+        __m256i const d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dark + x));
+        __m256i const r = _mm256_subs_epu16(_mm256_adds_epu16(_mm256_subs_epu16(l, d), ped), _mm256_subs_epu16(d, l));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(light + x), r);
+    }
+
+    SubtractDarkRowScalar(light + x, dark + x, pedestal, n - x);
+}
+
+#endif // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+static void SubtractDarkRowNEON(unsigned short *light, const unsigned short *dark, unsigned short pedestal, int n)
+{
+    uint16x8_t const ped = vdupq_n_u16(pedestal);
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        uint16x8_t const l = vld1q_u16(light + x);
+        uint16x8_t const d = vld1q_u16(dark + x);
+        vst1q_u16(light + x, vqsubq_u16(vqaddq_u16(vqsubq_u16(l, d), ped), vqsubq_u16(d, l)));
+    }
+
+    SubtractDarkRowScalar(light + x, dark + x, pedestal, n - x);
+}
+
+#endif // SIMD_NEON
+
+void SubtractDarkRow(unsigned short *light, const unsigned short *dark, unsigned short pedestal, int n)
+{
+    switch (s_level)
+    {
+#if defined(SIMD_X86)
+    case SIMD_AVX2:
+        SubtractDarkRowAVX2(light, dark, pedestal, n);
+        break;
+    case SIMD_SSE2:
+        SubtractDarkRowSSE2(light, dark, pedestal, n);
+        break;
+#endif
+#if defined(SIMD_NEON)
+    case SIMD_NEON:
+        SubtractDarkRowNEON(light, dark, pedestal, n);
+        break;
+#endif
+    default:
+        SubtractDarkRowScalar(light, dark, pedestal, n);
+        break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// display rendering: 16-bit gray through a lookup table to 24-bit RGB
+//
+// The table lookup itself is a gather and stays scalar; the vector code
+// handles the expansion of each gray byte into an R, G, B triple.
+
+static void GrayToRGBRowScalar(unsigned char *rgb, const unsigned short *src, const unsigned char *lut, int n)
+{
+    for (int x = 0; x < n; x++)
+    {
+        unsigned char const d = lut[src[x]];
+        *rgb++ = d;
+        *rgb++ = d;
+        *rgb++ = d;
+    }
+}
+
+#if defined(SIMD_X86)
+
+// SSSE3 is always present on AVX2 CPUs, and pshufb does the byte expansion
+// in one instruction per output vector
+SIMD_TARGET("ssse3")
+static void GrayToRGBRowSSSE3(unsigned char *rgb, const unsigned short *src, const unsigned char *lut, int n)
+{
+    __m128i const s0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    __m128i const s1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    __m128i const s2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        unsigned char gray[16];
+        for (int i = 0; i < 16; i++)
+            gray[i] = lut[src[x + i]];
+
+        __m128i const g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(gray));
+        __m128i *const out = reinterpret_cast<__m128i *>(rgb + 3 * x);
+        _mm_storeu_si128(out + 0, _mm_shuffle_epi8(g, s0));
+        _mm_storeu_si128(out + 1, _mm_shuffle_epi8(g, s1));
+        _mm_storeu_si128(out + 2, _mm_shuffle_epi8(g, s2));
+    }
+
+    GrayToRGBRowScalar(rgb + 3 * x, src + x, lut, n - x);
+}
+
+#endif // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+static void GrayToRGBRowNEON(unsigned char *rgb, const unsigned short *src, const unsigned char *lut, int n)
+{
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        unsigned char gray[16];
+        for (int i = 0; i < 16; i++)
+            gray[i] = lut[src[x + i]];
+
+        uint8x16x3_t v;
+        v.val[0] = v.val[1] = v.val[2] = vld1q_u8(gray);
+        vst3q_u8(rgb + 3 * x, v);
+    }
+
+    GrayToRGBRowScalar(rgb + 3 * x, src + x, lut, n - x);
+}
+
+#endif // SIMD_NEON
+
+void GrayToRGBRow(unsigned char *rgb, const unsigned short *src, const unsigned char *lut, int n)
+{
+    switch (s_level)
+    {
+#if defined(SIMD_X86)
+    case SIMD_AVX2:
+        GrayToRGBRowSSSE3(rgb, src, lut, n);
+        break;
+#endif
+#if defined(SIMD_NEON)
+    case SIMD_NEON:
+        GrayToRGBRowNEON(rgb, src, lut, n);
+        break;
+#endif
+    default:
+        GrayToRGBRowScalar(rgb, src, lut, n);
+        break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Star::Find smoothed peak search
+//
+// The smoothing kernel is separable, [1 2 1] x [1 2 1], so the vector code
+// first forms the vertical sums col = r0 + 2 r1 + r2 and then the horizontal
+// sum col[x-1] + 2 col[x] + col[x+1]. Sums reach 16 * 65535 and are computed
+// in 32-bit lanes. Each lane keeps its own maximum and the index where it
+// first occurred; the lanes are merged at the end of the row, preferring the
+// lowest index among equal maxima, which is the pixel the scalar scan finds.
+//
+// The three largest unsmoothed values only change when a bright pixel comes
+// along, so the vector code just tests whether any pixel in the vector
+// exceeds the current third largest and hands that vector to the scalar
+// insertion when one does.
+
+inline static void InsertMax3(unsigned short p, unsigned short max3[3])
+{
+    if (p > max3[0])
+        std::swap(p, max3[0]);
+    if (p > max3[1])
+        std::swap(p, max3[1]);
+    if (p > max3[2])
+        std::swap(p, max3[2]);
+}
+
+static unsigned int SmoothedPeakRowScalar(const unsigned short *r0, const unsigned short *r1, const unsigned short *r2,
+                                          int n, int *peakIdx, unsigned short max3[3])
+{
+    unsigned int best = 0;
+    int bestIdx = -1;
+
+    for (int x = 0; x < n; x++)
+    {
+        unsigned int val =
+            4 * (unsigned int) r1[x] +
+            r0[x - 1] + r0[x + 1] + r2[x - 1] + r2[x + 1] +
+            2 * ((unsigned int) r0[x] + r1[x - 1] + r1[x + 1] + r2[x]);
+
+        if (val > best)
+        {
+            best = val;
+            bestIdx = x;
+        }
+
+        InsertMax3(r1[x], max3);
+    }
+
+    *peakIdx = bestIdx;
+    return best;
+}
+
+// merge the per-lane maxima of a vector scan with the scalar scan of the row
+// tail starting at x
+static unsigned int SmoothedPeakFinish(const unsigned int *laneVal, const int *laneIdx, int lanes,
+                                       const unsigned short *r0, const unsigned short *r1, const unsigned short *r2, int x, int n,
+                                       int *peakIdx, unsigned short max3[3])
+{
+    unsigned int best = 0;
+    int bestIdx = -1;
+
+    for (int i = 0; i < lanes; i++)
+    {
+        if (laneVal[i] > best || (laneVal[i] == best && best > 0 && laneIdx[i] < bestIdx))
+        {
+            best = laneVal[i];
+            bestIdx = laneIdx[i];
+        }
+    }
+
+    int tailIdx;
+    unsigned int const tail = SmoothedPeakRowScalar(r0 + x, r1 + x, r2 + x, n - x, &tailIdx, max3);
+    if (tail > best)
+    {
+        best = tail;
+        bestIdx = x + tailIdx;
+    }
+
+    *peakIdx = bestIdx;
+    return best;
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2")
+static unsigned int SmoothedPeakRowSSE2(const unsigned short *r0, const unsigned short *r1, const unsigned short *r2,
+                                        int n, int *peakIdx, unsigned short max3[3])
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const four = _mm_set1_epi32(4);
+    __m128i bestVal = zero;
+    __m128i bestIdx = _mm_set1_epi32(-1);
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i thresh = _mm_set1_epi16((short) max3[2]);
+    int x = 0;
+
+#define LD(p) _mm_loadu_si128(reinterpret_cast<const __m128i *>(p))
+#define COL(lh, k) _mm_add_epi32(_mm_add_epi32(_mm_unpack##lh##_epi16(LD(r0 + x + k), zero),                    \
+                                               _mm_unpack##lh##_epi16(LD(r2 + x + k), zero)),                   \
+                                 _mm_slli_epi32(_mm_unpack##lh##_epi16(LD(r1 + x + k), zero), 1))
+#define UPDATE(lh)                                                                                                \
+    do {                                                                                                          \
+        __m128i const val = _mm_add_epi32(_mm_add_epi32(COL(lh, -1), COL(lh, 1)), _mm_slli_epi32(COL(lh, 0), 1)); \
+        __m128i const gt = _mm_cmpgt_epi32(val, bestVal);                                                        \
+        bestVal = _mm_or_si128(_mm_and_si128(gt, val), _mm_andnot_si128(gt, bestVal));                           \
+        bestIdx = _mm_or_si128(_mm_and_si128(gt, idx), _mm_andnot_si128(gt, bestIdx));                           \
+        idx = _mm_add_epi32(idx, four);                                                                           \
+    } while (0)
+
+    for (; x + 8 <= n; x += 8)
+    {
+        UPDATE(lo);
+        UPDATE(hi);
+
+        // any pixel above the third largest value?
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(LD(r1 + x), thresh), zero)) != 0xffff)
+        {
+            for (int i = 0; i < 8; i++)
+                InsertMax3(r1[x + i], max3);
+            thresh = _mm_set1_epi16((short) max3[2]);
+        }
+    }
+
+#undef UPDATE
+#undef COL
+#undef LD
+
+    unsigned int laneVal[4];
+    int laneIdx[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(laneVal), bestVal);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(laneIdx), bestIdx);
+
+    return SmoothedPeakFinish(laneVal, laneIdx, 4, r0, r1, r2, x, n, peakIdx, max3);
+}
+
+SIMD_TARGET("avx2")
+static unsigned int SmoothedPeakRowAVX2(const unsigned short *r0, const unsigned short *r1, const unsigned short *r2,
+                                        int n, int *peakIdx, unsigned short max3[3])
+{
+    __m256i const eight = _mm256_set1_epi32(8);
+    __m256i bestVal = _mm256_setzero_si256();
+    __m256i bestIdx = _mm256_set1_epi32(-1);
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i thresh = _mm_set1_epi16((short) max3[2]);
+    int x = 0;
+
+#define LD(p) _mm_loadu_si128(reinterpret_cast<const __m128i *>(p))
+#define COL(k) _mm256_add_epi32(_mm256_add_epi32(_mm256_cvtepu16_epi32(LD(r0 + x + k)),                        \
+                                                 _mm256_cvtepu16_epi32(LD(r2 + x + k))),                       \
+                                _mm256_slli_epi32(_mm256_cvtepu16_epi32(LD(r1 + x + k)), 1))
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256i const val = _mm256_add_epi32(_mm256_add_epi32(COL(-1), COL(1)), _mm256_slli_epi32(COL(0), 1));
+        __m256i const gt = _mm256_cmpgt_epi32(val, bestVal);
+        bestVal = _mm256_blendv_epi8(bestVal, val, gt);
+        bestIdx = _mm256_blendv_epi8(bestIdx, idx, gt);
+        idx = _mm256_add_epi32(idx, eight);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(LD(r1 + x), thresh), zero)) != 0xffff)
+        {
+            for (int i = 0; i < 8; i++)
+                InsertMax3(r1[x + i], max3);
+            thresh = _mm_set1_epi16((short) max3[2]);
+        }
+    }
+
+#undef COL
+#undef LD
+
+    unsigned int laneVal[8];
+    int laneIdx[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(laneVal), bestVal);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(laneIdx), bestIdx);
+
+    return SmoothedPeakFinish(laneVal, laneIdx, 8, r0, r1, r2, x, n, peakIdx, max3);
+}
+
+#endif // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+static unsigned int SmoothedPeakRowNEON(const unsigned short *r0, const unsigned short *r1, const unsigned short *r2,
+                                        int n, int *peakIdx, unsigned short max3[3])
+{
+    static const int idxInit[4] = { 0, 1, 2, 3 };
+    uint32x4_t const four = vdupq_n_u32(4);
+    uint32x4_t bestVal = vdupq_n_u32(0);
+    int32x4_t bestIdx = vdupq_n_s32(-1);
+    int32x4_t idx = vld1q_s32(idxInit);
+    uint16x8_t thresh = vdupq_n_u16(max3[2]);
+    int x = 0;
+
+#define COL(half, k) vaddq_u32(vaddl_u16(half(vld1q_u16(r0 + x + k)), half(vld1q_u16(r2 + x + k))), \
+                               vshll_n_u16(half(vld1q_u16(r1 + x + k)), 1))
+#define UPDATE(half)                                                                                \
+    do {                                                                                            \
+        uint32x4_t const val = vaddq_u32(vaddq_u32(COL(half, -1), COL(half, 1)), vshlq_n_u32(COL(half, 0), 1)); \
+        uint32x4_t const gt = vcgtq_u32(val, bestVal);                                              \
+        bestVal = vbslq_u32(gt, val, bestVal);                                                      \
+        bestIdx = vbslq_s32(gt, idx, bestIdx);                                                      \
+        idx = vaddq_s32(idx, vreinterpretq_s32_u32(four));                                          \
+    } while (0)
+
+    for (; x + 8 <= n; x += 8)
+    {
+        UPDATE(vget_low_u16);
+        UPDATE(vget_high_u16);
+
+        uint64x2_t const gt = vreinterpretq_u64_u16(vcgtq_u16(vld1q_u16(r1 + x), thresh));
+        if ((vgetq_lane_u64(gt, 0) | vgetq_lane_u64(gt, 1)) != 0)
+        {
+            for (int i = 0; i < 8; i++)
+                InsertMax3(r1[x + i], max3);
+            thresh = vdupq_n_u16(max3[2]);
+        }
+    }
+
+#undef UPDATE
+#undef COL
+
+    unsigned int laneVal[4];
+    int laneIdx[4];
+    vst1q_u32(laneVal, bestVal);
+    vst1q_s32(laneIdx, bestIdx);
+
+    return SmoothedPeakFinish(laneVal, laneIdx, 4, r0, r1, r2, x, n, peakIdx, max3);
+}
+
+#endif // SIMD_NEON
+
+unsigned int SmoothedPeakRow(const unsigned short *r0, const unsigned short *r1, const unsigned short *r2,
+                             int n, int *peakIdx, unsigned short max3[3])
+{
+    switch (s_level)
+    {
+#if defined(SIMD_X86)
+    case SIMD_AVX2:
+        return SmoothedPeakRowAVX2(r0, r1, r2, n, peakIdx, max3);
+    case SIMD_SSE2:
+        return SmoothedPeakRowSSE2(r0, r1, r2, n, peakIdx, max3);
+#endif
+#if defined(SIMD_NEON)
+    case SIMD_NEON:
+        return SmoothedPeakRowNEON(r0, r1, r2, n, peakIdx, max3);
+#endif
+    default:
+        return SmoothedPeakRowScalar(r0, r1, r2, n, peakIdx, max3);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 9x9 convolution with a kernel that is symmetric about both axes
+//
+// With w[a][b] the weight at |dx| = a, |dy| = b, the pixels at +/-dy are
+// summed first, v[b] = r[4 - b] + r[4 + b], then each column is reduced to one
+// value per horizontal distance, g[a] = sum_b w[a][b] v[b], and finally
+// dst[x] = g[0][x] + sum_a (g[a][x - a] + g[a][x + a]). This takes 45
+// operations per pixel instead of 81 multiply-adds. The vector variants
+// perform the same float operations in the same order as the scalar code.
+
+static void SymConv9ColScalar(float *const g[5], const float *const r[9], const float w[5][5], int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+    {
+        float const v0 = r[4][x];
+        float const v1 = r[3][x] + r[5][x];
+        float const v2 = r[2][x] + r[6][x];
+        float const v3 = r[1][x] + r[7][x];
+        float const v4 = r[0][x] + r[8][x];
+        for (int a = 0; a < 5; a++)
+            g[a][x] = w[a][0] * v0 + w[a][1] * v1 + w[a][2] * v2 + w[a][3] * v3 + w[a][4] * v4;
+    }
+}
+
+static void SymConv9SumScalar(float *dst, const float *const g[5], int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+    {
+        dst[x] = g[0][x] + (g[1][x - 1] + g[1][x + 1]) + (g[2][x - 2] + g[2][x + 2]) +
+            (g[3][x - 3] + g[3][x + 3]) + (g[4][x - 4] + g[4][x + 4]);
+    }
+}
+
+static void SymConv9RowScalar(float *dst, const float *const r[9], const float w[5][5], float *const g[5], int n)
+{
+    SymConv9ColScalar(g, r, w, 0, n);
+    SymConv9SumScalar(dst, g, 4, n - 4);
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2")
+static void SymConv9RowSSE2(float *dst, const float *const r[9], const float w[5][5], float *const g[5], int n)
+{
+    __m128 wv[5][5];
+    for (int a = 0; a < 5; a++)
+        for (int b = 0; b < 5; b++)
+            wv[a][b] = _mm_set1_ps(w[a][b]);
+
+    int x = 0;
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128 const v0 = _mm_loadu_ps(r[4] + x);
+        __m128 const v1 = _mm_add_ps(_mm_loadu_ps(r[3] + x), _mm_loadu_ps(r[5] + x));
+        __m128 const v2 = _mm_add_ps(_mm_loadu_ps(r[2] + x), _mm_loadu_ps(r[6] + x));
+        __m128 const v3 = _mm_add_ps(_mm_loadu_ps(r[1] + x), _mm_loadu_ps(r[7] + x));
+        __m128 const v4 = _mm_add_ps(_mm_loadu_ps(r[0] + x), _mm_loadu_ps(r[8] + x));
+        for (int a = 0; a < 5; a++)
+        {
+            __m128 s = _mm_mul_ps(wv[a][0], v0);
+            s = _mm_add_ps(s, _mm_mul_ps(wv[a][1], v1));
+            s = _mm_add_ps(s, _mm_mul_ps(wv[a][2], v2));
+            s = _mm_add_ps(s, _mm_mul_ps(wv[a][3], v3));
+            s = _mm_add_ps(s, _mm_mul_ps(wv[a][4], v4));
+            _mm_storeu_ps(g[a] + x, s);
+        }
+    }
+    SymConv9ColScalar(g, r, w, x, n);
+
+#define LD2(a) _mm_add_ps(_mm_loadu_ps(g[a] + x - a), _mm_loadu_ps(g[a] + x + a))
+    for (x = 4; x + 4 <= n - 4; x += 4)
+    {
+        __m128 s = _mm_add_ps(_mm_loadu_ps(g[0] + x), LD2(1));
+        s = _mm_add_ps(s, LD2(2));
+        s = _mm_add_ps(s, LD2(3));
+        s = _mm_add_ps(s, LD2(4));
+        _mm_storeu_ps(dst + x, s);
+    }
+#undef LD2
+    SymConv9SumScalar(dst, g, x, n - 4);
+}
+
+SIMD_TARGET("avx2")
+static void SymConv9RowAVX2(float *dst, const float *const r[9], const float w[5][5], float *const g[5], int n)
+{
+    __m256 wv[5][5];
+    for (int a = 0; a < 5; a++)
+        for (int b = 0; b < 5; b++)
+            wv[a][b] = _mm256_set1_ps(w[a][b]);
+
+    int x = 0;
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256 const v0 = _mm256_loadu_ps(r[4] + x);
+        __m256 const v1 = _mm256_add_ps(_mm256_loadu_ps(r[3] + x), _mm256_loadu_ps(r[5] + x));
+        __m256 const v2 = _mm256_add_ps(_mm256_loadu_ps(r[2] + x), _mm256_loadu_ps(r[6] + x));
+        __m256 const v3 = _mm256_add_ps(_mm256_loadu_ps(r[1] + x), _mm256_loadu_ps(r[7] + x));
+        __m256 const v4 = _mm256_add_ps(_mm256_loadu_ps(r[0] + x), _mm256_loadu_ps(r[8] + x));
+        for (int a = 0; a < 5; a++)
+        {
+            __m256 s = _mm256_mul_ps(wv[a][0], v0);
+            s = _mm256_add_ps(s, _mm256_mul_ps(wv[a][1], v1));
+            s = _mm256_add_ps(s, _mm256_mul_ps(wv[a][2], v2));
+            s = _mm256_add_ps(s, _mm256_mul_ps(wv[a][3], v3));
+            s = _mm256_add_ps(s, _mm256_mul_ps(wv[a][4], v4));
+            _mm256_storeu_ps(g[a] + x, s);
+        }
+    }
+    SymConv9ColScalar(g, r, w, x, n);
+
+#define LD2(a) _mm256_add_ps(_mm256_loadu_ps(g[a] + x - a), _mm256_loadu_ps(g[a] + x + a))
+    for (x = 4; x + 8 <= n - 4; x += 8)
+    {
+        __m256 s = _mm256_add_ps(_mm256_loadu_ps(g[0] + x), LD2(1));
+        s = _mm256_add_ps(s, LD2(2));
+        s = _mm256_add_ps(s, LD2(3));
+        s = _mm256_add_ps(s, LD2(4));
+        _mm256_storeu_ps(dst + x, s);
+    }
+#undef LD2
+    SymConv9SumScalar(dst, g, x, n - 4);
+}
+
+#endif // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+static void SymConv9RowNEON(float *dst, const float *const r[9], const float w[5][5], float *const g[5], int n)
+{
+    int x = 0;
+    for (; x + 4 <= n; x += 4)
+    {
+        float32x4_t const v0 = vld1q_f32(r[4] + x);
+        float32x4_t const v1 = vaddq_f32(vld1q_f32(r[3] + x), vld1q_f32(r[5] + x));
+        float32x4_t const v2 = vaddq_f32(vld1q_f32(r[2] + x), vld1q_f32(r[6] + x));
+        float32x4_t const v3 = vaddq_f32(vld1q_f32(r[1] + x), vld1q_f32(r[7] + x));
+        float32x4_t const v4 = vaddq_f32(vld1q_f32(r[0] + x), vld1q_f32(r[8] + x));
+        for (int a = 0; a < 5; a++)
+        {
+            float32x4_t s = vmulq_n_f32(v0, w[a][0]);
+            s = vaddq_f32(s, vmulq_n_f32(v1, w[a][1]));
+            s = vaddq_f32(s, vmulq_n_f32(v2, w[a][2]));
+            s = vaddq_f32(s, vmulq_n_f32(v3, w[a][3]));
+            s = vaddq_f32(s, vmulq_n_f32(v4, w[a][4]));
+            vst1q_f32(g[a] + x, s);
+        }
+    }
+    SymConv9ColScalar(g, r, w, x, n);
+
+#define LD2(a) vaddq_f32(vld1q_f32(g[a] + x - a), vld1q_f32(g[a] + x + a))
+    for (x = 4; x + 4 <= n - 4; x += 4)
+    {
+        float32x4_t s = vaddq_f32(vld1q_f32(g[0] + x), LD2(1));
+        s = vaddq_f32(s, LD2(2));
+        s = vaddq_f32(s, LD2(3));
+        s = vaddq_f32(s, LD2(4));
+        vst1q_f32(dst + x, s);
+    }
+#undef LD2
+    SymConv9SumScalar(dst, g, x, n - 4);
+}
+
+#endif // SIMD_NEON
+
+void SymConv9Row(float *dst, const float *const rows[9], const float w[5][5], float *const scratch[5], int n)
+{
+    switch (s_level)
+    {
+#if defined(SIMD_X86)
+    case SIMD_AVX2:
+        SymConv9RowAVX2(dst, rows, w, scratch, n);
+        break;
+    case SIMD_SSE2:
+        SymConv9RowSSE2(dst, rows, w, scratch, n);
+        break;
+#endif
+#if defined(SIMD_NEON)
+    case SIMD_NEON:
+        SymConv9RowNEON(dst, rows, w, scratch, n);
+        break;
+#endif
+    default:
+        SymConv9RowScalar(dst, rows, w, scratch, n);
+        break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// frame stacking: widen 16-bit pixels and add them to 32-bit sums
+
+static void AccumulateRowScalar(unsigned int *acc, const unsigned short *src, int n)
+{
+    for (int x = 0; x < n; x++)
+        acc[x] += src[x];
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2")
+static void AccumulateRowSSE2(unsigned int *acc, const unsigned short *src, int n)
+{
+    __m128i const zero = _mm_setzero_si128();
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i const s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+        __m128i *const a = reinterpret_cast<__m128i *>(acc + x);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_unpacklo_epi16(s, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(s, zero)));
+    }
+
+    AccumulateRowScalar(acc + x, src + x, n - x);
+}
+
+SIMD_TARGET("avx2")
+static void AccumulateRowAVX2(unsigned int *acc, const unsigned short *src, int n)
+{
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m128i const lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+        __m128i const hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 8));
+        __m256i *const a = reinterpret_cast<__m256i *>(acc + x);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_cvtepu16_epi32(lo)));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1), _mm256_cvtepu16_epi32(hi)));
+    }
+
+    AccumulateRowScalar(acc + x, src + x, n - x);
+}
+
+#endif // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+static void AccumulateRowNEON(unsigned int *acc, const unsigned short *src, int n)
+{
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        uint16x8_t const s = vld1q_u16(src + x);
+        vst1q_u32(acc + x, vaddw_u16(vld1q_u32(acc + x), vget_low_u16(s)));
+        vst1q_u32(acc + x + 4, vaddw_u16(vld1q_u32(acc + x + 4), vget_high_u16(s)));
+    }
+
+    AccumulateRowScalar(acc + x, src + x, n - x);
+}
+
+#endif // SIMD_NEON
+
+void AccumulateRow(unsigned int *acc, const unsigned short *src, int n)
+{
+    switch (s_level)
+    {
+#if defined(SIMD_X86)
+    case SIMD_AVX2:
+        AccumulateRowAVX2(acc, src, n);
+        break;
+    case SIMD_SSE2:
+        AccumulateRowSSE2(acc, src, n);
+        break;
+#endif
+#if defined(SIMD_NEON)
+    case SIMD_NEON:
+        AccumulateRowNEON(acc, src, n);
+        break;
+#endif
+    default:
+        AccumulateRowScalar(acc, src, n);
+        break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 2x2 software binning: dst[i] = (sum of the 2x2 block at 2i) / 4
+
+template<typename T>
+static void Bin2x2RowScalar(unsigned short *dst, const T *r0, const T *r1, int n)
+{
+    for (int x = 0; x < n; x++)
+    {
+        dst[x] = ((unsigned int) r0[2 * x] + r0[2 * x + 1] +
+                  (unsigned int) r1[2 * x] + r1[2 * x + 1]) / 4;
+    }
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2")
+static void Bin2x2RowSSE2(unsigned short *dst, const unsigned short *r0, const unsigned short *r1, int n)
+{
+    __m128i const lo16 = _mm_set1_epi32(0xffff);
+    __m128i const bias32 = _mm_set1_epi32(0x8000);
+    __m128i const bias16 = _mm_set1_epi16(-0x8000);
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i const a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + 2 * x));
+        __m128i const a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + 2 * x + 8));
+        __m128i const b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + 2 * x));
+        __m128i const b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + 2 * x + 8));
+
+        // each 32-bit lane holds a horizontal pixel pair; add the halves
+        __m128i s0 = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(a0, lo16), _mm_srli_epi32(a0, 16)),
+                                   _mm_add_epi32(_mm_and_si128(b0, lo16), _mm_srli_epi32(b0, 16)));
+        __m128i s1 = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(a1, lo16), _mm_srli_epi32(a1, 16)),
+                                   _mm_add_epi32(_mm_and_si128(b1, lo16), _mm_srli_epi32(b1, 16)));
+        s0 = _mm_sub_epi32(_mm_srli_epi32(s0, 2), bias32);
+        s1 = _mm_sub_epi32(_mm_srli_epi32(s1, 2), bias32);
+
+        // SSE2 has no unsigned 32 -> 16 pack; pack with a bias instead
+        __m128i const d = _mm_xor_si128(_mm_packs_epi32(s0, s1), bias16);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), d);
+    }
+
+    Bin2x2RowScalar(dst + x, r0 + 2 * x, r1 + 2 * x, n - x);
+}
+
+SIMD_TARGET("sse2")
+static void Bin2x2RowSSE2(unsigned short *dst, const unsigned char *r0, const unsigned char *r1, int n)
+{
+    __m128i const lo8 = _mm_set1_epi16(0xff);
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i const a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + 2 * x));
+        __m128i const b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + 2 * x));
+
+        // each 16-bit lane holds a horizontal pixel pair; the sum fits in 10 bits
+        __m128i const s = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, lo8), _mm_srli_epi16(a, 8)),
+                                        _mm_add_epi16(_mm_and_si128(b, lo8), _mm_srli_epi16(b, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_srli_epi16(s, 2));
+    }
+
+    Bin2x2RowScalar(dst + x, r0 + 2 * x, r1 + 2 * x, n - x);
+}
+
+SIMD_TARGET("avx2")
+static void Bin2x2RowAVX2(unsigned short *dst, const unsigned short *r0, const unsigned short *r1, int n)
+{
+    __m256i const lo16 = _mm256_set1_epi32(0xffff);
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m256i const a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r0 + 2 * x));
+        __m256i const a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r0 + 2 * x + 16));
+        __m256i const b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r1 + 2 * x));
+        __m256i const b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r1 + 2 * x + 16));
+
+        __m256i s0 = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(a0, lo16), _mm256_srli_epi32(a0, 16)),
+                                      _mm256_add_epi32(_mm256_and_si256(b0, lo16), _mm256_srli_epi32(b0, 16)));
+        __m256i s1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(a1, lo16), _mm256_srli_epi32(a1, 16)),
+                                      _mm256_add_epi32(_mm256_and_si256(b1, lo16), _mm256_srli_epi32(b1, 16)));
+        s0 = _mm256_srli_epi32(s0, 2);
+        s1 = _mm256_srli_epi32(s1, 2);
+
+        // the pack works within 128-bit lanes; restore the pixel order
+        __m256i const d = _mm256_permute4x64_epi64(_mm256_packus_epi32(s0, s1), 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), d);
+    }
+
+    Bin2x2RowSSE2(dst + x, r0 + 2 * x, r1 + 2 * x, n - x);
+}
+
+SIMD_TARGET("avx2")
+static void Bin2x2RowAVX2(unsigned short *dst, const unsigned char *r0, const unsigned char *r1, int n)
+{
+    __m256i const lo8 = _mm256_set1_epi16(0xff);
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m256i const a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r0 + 2 * x));
+        __m256i const b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r1 + 2 * x));
+
+        __m256i const s = _mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(a, lo8), _mm256_srli_epi16(a, 8)),
+                                           _mm256_add_epi16(_mm256_and_si256(b, lo8), _mm256_srli_epi16(b, 8)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), _mm256_srli_epi16(s, 2));
+    }
+
+    Bin2x2RowSSE2(dst + x, r0 + 2 * x, r1 + 2 * x, n - x);
+}
+
+#endif // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+static void Bin2x2RowNEON(unsigned short *dst, const unsigned short *r0, const unsigned short *r1, int n)
+{
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        uint32x4_t const s0 = vaddq_u32(vpaddlq_u16(vld1q_u16(r0 + 2 * x)), vpaddlq_u16(vld1q_u16(r1 + 2 * x)));
+        uint32x4_t const s1 = vaddq_u32(vpaddlq_u16(vld1q_u16(r0 + 2 * x + 8)), vpaddlq_u16(vld1q_u16(r1 + 2 * x + 8)));
+        vst1q_u16(dst + x, vcombine_u16(vshrn_n_u32(s0, 2), vshrn_n_u32(s1, 2)));
+    }
+
+    Bin2x2RowScalar(dst + x, r0 + 2 * x, r1 + 2 * x, n - x);
+}
+
+static void Bin2x2RowNEON(unsigned short *dst, const unsigned char *r0, const unsigned char *r1, int n)
+{
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        uint16x8_t const s = vaddq_u16(vpaddlq_u8(vld1q_u8(r0 + 2 * x)), vpaddlq_u8(vld1q_u8(r1 + 2 * x)));
+        vst1q_u16(dst + x, vshrq_n_u16(s, 2));
+    }
+
+    Bin2x2RowScalar(dst + x, r0 + 2 * x, r1 + 2 * x, n - x);
+}
+
+#endif // SIMD_NEON
+
+template<typename T>
+static void Bin2x2RowImpl(unsigned short *dst, const T *r0, const T *r1, int n)
+{
+    switch (s_level)
+    {
+#if defined(SIMD_X86)
+    case SIMD_AVX2:
+        Bin2x2RowAVX2(dst, r0, r1, n);
+        break;
+    case SIMD_SSE2:
+        Bin2x2RowSSE2(dst, r0, r1, n);
+        break;
+#endif
+#if defined(SIMD_NEON)
+    case SIMD_NEON:
+        Bin2x2RowNEON(dst, r0, r1, n);
+        break;
+#endif
+    default:
+        Bin2x2RowScalar(dst, r0, r1, n);
+        break;
+    }
+}
+
+void Bin2x2Row(unsigned short *dst, const unsigned short *r0, const unsigned short *r1, int n)
+{
+    Bin2x2RowImpl(dst, r0, r1, n);
+}
+
+void Bin2x2Row(unsigned short *dst, const unsigned char *r0, const unsigned char *r1, int n)
+{
+    Bin2x2RowImpl(dst, r0, r1, n);
+}
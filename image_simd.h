@@ -0,0 +1,97 @@
+/*
+ *  image_simd.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef IMAGE_SIMD_INCLUDED
+#define IMAGE_SIMD_INCLUDED
+
+// Vectorized image kernels with run-time CPU dispatch.
+//
+// Each kernel has a portable scalar implementation plus SSE2 / AVX2 (x86)
+// and NEON (ARM) variants. The best variant supported by the running CPU is
+// selected at run time, so a single binary runs on any machine of the target
+// architecture. All variants produce bit-identical results.
+
+enum SimdLevel
+{
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_NEON,
+};
+
+// best instruction set supported by the CPU we are running on
+extern SimdLevel SimdDetect();
+// instruction set currently used by the kernels
+extern SimdLevel SimdGetLevel();
+// override the instruction set used by the kernels (for benchmarking and
+// debugging). Returns false if the CPU does not support the requested level.
+extern bool SimdSetLevel(SimdLevel level);
+extern bool SimdLevelSupported(SimdLevel level);
+extern const char *SimdLevelName(SimdLevel level);
+
+// Compute the 3x3 median for n consecutive interior pixels of a row.
+// r0, r1, r2 point to the pixel above, at, and below the first output pixel;
+// the kernel reads one pixel to the left and right of each row.
+extern void Median3Row(unsigned short *dst, const unsigned short *r0, const unsigned short *r1,
+                       const unsigned short *r2, int n);
+
+// light[i] = clamp(light[i] + pedestal - dark[i], 0, 65535) for n pixels
+extern void SubtractDarkRow(unsigned short *light, const unsigned short *dark, unsigned short pedestal, int n);
+
+// rgb[3i] = rgb[3i+1] = rgb[3i+2] = lut[src[i]] for n pixels; lut has 65536 entries
+extern void GrayToRGBRow(unsigned char *rgb, const unsigned short *src, const unsigned char *lut, int n);
+
+// Smoothed peak search for one row of Star::Find. For n consecutive interior
+// pixels starting at r1 (r0 and r2 are the rows above and below) compute the
+// [1 2 1] x [1 2 1] smoothed value, return the largest one and store the index
+// of its first occurrence in *peakIdx (-1 if no value is above zero).
+// max3 holds the three largest unsmoothed values seen so far, in descending
+// order, and is updated with the row's pixels.
+extern unsigned int SmoothedPeakRow(const unsigned short *r0, const unsigned short *r1, const unsigned short *r2,
+                                    int n, int *peakIdx, unsigned short max3[3]);
+
+// 9x9 convolution of one row with a kernel symmetric about both axes;
+// w[a][b] is the weight at horizontal distance a and vertical distance b.
+// rows[0..8] are the source rows y-4 .. y+4, each n pixels wide. Writes
+// dst[4 .. n-5]; scratch is five caller-provided buffers of n floats.
+extern void SymConv9Row(float *dst, const float *const rows[9], const float w[5][5], float *const scratch[5], int n);
+
+// acc[i] += src[i] for n pixels
+extern void AccumulateRow(unsigned int *acc, const unsigned short *src, int n);
+
+// 2x2 software binning of one output row: dst[i] is the truncated mean of
+// r0[2i], r0[2i+1], r1[2i], r1[2i+1] for n output pixels
+extern void Bin2x2Row(unsigned short *dst, const unsigned short *r0, const unsigned short *r1, int n);
+extern void Bin2x2Row(unsigned short *dst, const unsigned char *r0, const unsigned char *r1, int n);
+
+#endif
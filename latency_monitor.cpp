@@ -0,0 +1,344 @@
+/*
+ *  latency_monitor.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+
+#include <algorithm>
+#include <chrono>
+
+enum
+{
+    RING_SIZE = 16,         // frame records; frames in flight plus FINALIZE_LAG, with room to spare
+    FINALIZE_LAG = 4,       // a record is folded in this many exposures after it was requested
+    WINDOW = 200,           // samples kept for the rolling statistics
+};
+
+struct LatencyInterval
+{
+    const char *name;
+    LatencyStage from;
+    LatencyStage to;
+    bool lessExposure;      // subtract the exposure duration
+};
+
+static const LatencyInterval s_intervals[] =
+{
+    { "Queue",          LAT_EXPOSE_REQUEST, LAT_EXPOSE_START, false },
+    { "Readout",        LAT_EXPOSE_START,   LAT_DOWNLOAD_END, true  },
+    { "Dark",           LAT_DOWNLOAD_END,   LAT_DARK_END,     false },
+    { "Camera",         LAT_DARK_END,       LAT_CAPTURE_END,  false },
+    { "NoiseReduction", LAT_CAPTURE_END,    LAT_NR_END,       false },
+    { "Stats",          LAT_NR_END,         LAT_STATS_END,    false },
+    { "Dispatch",       LAT_STATS_END,      LAT_FIND_START,   false },
+    { "FindStar",       LAT_FIND_START,     LAT_FIND_END,     false },
+    { "MoveQueue",      LAT_FIND_END,       LAT_MOVE_START,   false },
+    { "Algorithm",      LAT_MOVE_START,     LAT_ALGO_END,     false },
+    { "Pulse",          LAT_ALGO_END,       LAT_PULSE_END,    false },
+    { "FrameToPulse",   LAT_EXPOSE_START,   LAT_ALGO_END,     true  },
+    { "Cycle",          LAT_EXPOSE_REQUEST, LAT_PULSE_END,    false },
+};
+
+enum { NUM_INTERVALS = WXSIZEOF(s_intervals) };
+
+static const std::vector<double> s_histoEdges =
+    { 0.1, 0.2, 0.5, 1., 2., 5., 10., 20., 50., 100., 200., 500., 1000., 2000., 5000., 10000. };
+
+struct FrameRecord
+{
+    std::atomic<unsigned int> seq;
+    std::atomic<long long> t[LAT_NUM_STAGES];   // microseconds, 0 if the stage was not reached
+    int exposureDuration;
+};
+
+struct RollingStats
+{
+    double samples[WINDOW];
+    unsigned int next;
+    unsigned int count;
+    std::vector<unsigned int> histo;
+
+    static unsigned int Bin(double ms)
+    {
+        return std::upper_bound(s_histoEdges.begin(), s_histoEdges.end(), ms) - s_histoEdges.begin();
+    }
+
+    void Clear()
+    {
+        next = count = 0;
+        histo.assign(s_histoEdges.size() + 1, 0);
+    }
+
+    void Add(double ms)
+    {
+        if (count == WINDOW)
+            --histo[Bin(samples[next])];
+        else
+            ++count;
+        samples[next] = ms;
+        ++histo[Bin(ms)];
+        next = (next + 1) % WINDOW;
+    }
+};
+
+struct LM
+{
+    FrameRecord ring[RING_SIZE];
+    unsigned int lastSeq;       // main thread only, like everything below
+    unsigned int frames;
+    RollingStats stats[NUM_INTERVALS];
+    bool csv;
+    wxFFile csvFile;
+
+    void Reset()
+    {
+        for (unsigned int i = 0; i < RING_SIZE; i++)
+            ring[i].seq.store(0, std::memory_order_relaxed);
+        frames = 0;
+        for (unsigned int i = 0; i < NUM_INTERVALS; i++)
+            stats[i].Clear();
+    }
+
+    void OpenCsv()
+    {
+        wxString path = Debug.GetLogDir() + PATHSEPSTR +
+            wxGetApp().GetLogFileTime().Format(_T("PHD2_Latency_%Y-%m-%d_%H%M%S.csv"));
+        bool exists = wxFileExists(path);
+        if (!csvFile.Open(path, "a"))
+        {
+            Debug.Write(wxString::Format("LatencyMonitor: could not open %s\n", path));
+            csv = false;
+            return;
+        }
+        Debug.Write(wxString::Format("LatencyMonitor: logging to %s\n", path));
+        if (!exists)
+        {
+            wxString hdr("Seq,Exposure");
+            for (unsigned int i = 0; i < NUM_INTERVALS; i++)
+                hdr << ',' << s_intervals[i].name;
+            csvFile.Write(hdr + "\n");
+        }
+    }
+
+    void Finalize(unsigned int seq)
+    {
+        FrameRecord& r = ring[seq % RING_SIZE];
+        if (r.seq.load(std::memory_order_acquire) != seq)
+            return;
+
+        long long t[LAT_NUM_STAGES];
+        for (int i = 0; i < LAT_NUM_STAGES; i++)
+            t[i] = r.t[i].load(std::memory_order_relaxed);
+
+        // interrupted or failed exposure
+        if (!t[LAT_EXPOSE_START] || !t[LAT_CAPTURE_END])
+            return;
+
+        // without dark subtraction the driver stages collapse onto the end of the capture
+        if (!t[LAT_DOWNLOAD_END])
+            t[LAT_DOWNLOAD_END] = t[LAT_CAPTURE_END];
+        if (!t[LAT_DARK_END])
+            t[LAT_DARK_END] = t[LAT_CAPTURE_END];
+
+        ++frames;
+
+        wxString line;
+        if (csv)
+            line << seq << ',' << r.exposureDuration;
+
+        for (unsigned int i = 0; i < NUM_INTERVALS; i++)
+        {
+            const LatencyInterval& iv = s_intervals[i];
+            if (csv)
+                line << ',';
+            if (!t[iv.from] || !t[iv.to])
+                continue;
+            double ms = (double)(t[iv.to] - t[iv.from]) / 1000.;
+            if (iv.lessExposure)
+                ms -= r.exposureDuration;
+            stats[i].Add(ms);
+            if (csv)
+                line << wxString::Format("%.3f", ms);
+        }
+
+        if (csv)
+        {
+            if (!csvFile.IsOpened())
+                OpenCsv();
+            if (csvFile.IsOpened())
+            {
+                csvFile.Write(line + "\n");
+                csvFile.Flush();
+            }
+        }
+    }
+};
+
+static LM s_lm;
+std::atomic<bool> LatencyMonitor::s_enabled(false);
+static thread_local unsigned int s_threadFrame;
+
+static long long Now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyMonitor::Init()
+{
+    s_lm.lastSeq = 0;
+    s_lm.csv = false;
+    s_lm.Reset();
+}
+
+void LatencyMonitor::Destroy()
+{
+    s_enabled = false;
+    if (s_lm.csvFile.IsOpened())
+        s_lm.csvFile.Close();
+}
+
+bool LatencyMonitor::CsvEnabled()
+{
+    return s_lm.csv;
+}
+
+void LatencyMonitor::LoadSettings()
+{
+    SetEnabled(pConfig->Profile.GetBoolean("/LatencyMonitor/Enabled", false),
+               pConfig->Profile.GetBoolean("/LatencyMonitor/Csv", false));
+}
+
+void LatencyMonitor::SetEnabled(bool enable, bool csv)
+{
+    Debug.Write(wxString::Format("LatencyMonitor: enabled=%d csv=%d\n", enable, csv));
+
+    pConfig->Profile.SetBoolean("/LatencyMonitor/Enabled", enable);
+    pConfig->Profile.SetBoolean("/LatencyMonitor/Csv", csv);
+
+    if (enable && !IsEnabled())
+        s_lm.Reset();
+
+    s_lm.csv = enable && csv;
+    if (!s_lm.csv && s_lm.csvFile.IsOpened())
+        s_lm.csvFile.Close();
+
+    s_enabled = enable;
+}
+
+unsigned int LatencyMonitor::BeginFrame(int exposureDuration)
+{
+    if (!IsEnabled())
+        return 0;
+
+    unsigned int seq = ++s_lm.lastSeq;
+    if (seq == 0)
+        seq = ++s_lm.lastSeq; // 0 means no frame
+
+    if (seq > FINALIZE_LAG)
+        s_lm.Finalize(seq - FINALIZE_LAG);
+
+    FrameRecord& r = s_lm.ring[seq % RING_SIZE];
+    r.seq.store(0, std::memory_order_release);
+    for (int i = 0; i < LAT_NUM_STAGES; i++)
+        r.t[i].store(0, std::memory_order_relaxed);
+    r.exposureDuration = exposureDuration;
+    r.t[LAT_EXPOSE_REQUEST].store(Now(), std::memory_order_relaxed);
+    r.seq.store(seq, std::memory_order_release);
+
+    return seq;
+}
+
+void LatencyMonitor::DoMark(unsigned int seq, LatencyStage stage)
+{
+    if (!seq)
+        return;
+
+    FrameRecord& r = s_lm.ring[seq % RING_SIZE];
+    if (r.seq.load(std::memory_order_acquire) == seq)
+        r.t[stage].store(Now(), std::memory_order_relaxed);
+}
+
+unsigned int LatencyMonitor::ThreadFrame()
+{
+    return s_threadFrame;
+}
+
+unsigned int LatencyMonitor::SetThreadFrame(unsigned int seq)
+{
+    unsigned int prev = s_threadFrame;
+    s_threadFrame = seq;
+    return prev;
+}
+
+void LatencyMonitor::GetStats(std::vector<LatencyIntervalStats> *stats, unsigned int *frames)
+{
+    *frames = s_lm.frames;
+    stats->resize(NUM_INTERVALS);
+
+    std::vector<double> v;
+
+    for (unsigned int i = 0; i < NUM_INTERVALS; i++)
+    {
+        const RollingStats& rs = s_lm.stats[i];
+        LatencyIntervalStats& st = (*stats)[i];
+
+        st.name = s_intervals[i].name;
+        st.count = rs.count;
+        st.histo = rs.histo;
+        st.mean = st.p50 = st.p90 = st.max = 0.;
+
+        if (!rs.count)
+            continue;
+
+        v.assign(rs.samples, rs.samples + rs.count);
+        double sum = 0.;
+        for (double x : v)
+            sum += x;
+        st.mean = sum / v.size();
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        st.p50 = v[v.size() / 2];
+        std::nth_element(v.begin(), v.begin() + v.size() * 9 / 10, v.end());
+        st.p90 = v[v.size() * 9 / 10];
+        st.max = *std::max_element(v.begin(), v.end());
+    }
+}
+
+const std::vector<double>& LatencyMonitor::HistoEdges()
+{
+    return s_histoEdges;
+}
+
+void LatencyMonitor::Reset()
+{
+    s_lm.Reset();
+}
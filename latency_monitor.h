@@ -0,0 +1,134 @@
+/*
+ *  latency_monitor.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef LATENCY_MONITOR_INCLUDED
+#define LATENCY_MONITOR_INCLUDED
+
+#include <atomic>
+#include <vector>
+
+// Guide-loop latency instrumentation.
+//
+// Each exposure gets a sequence number when it is requested. The threads
+// that handle the frame stamp a monotonic time into the frame's record as
+// each stage finishes. Records are kept in a small ring and each stage is
+// written by exactly one thread, so no locks are needed. A few frames later,
+// when every stage has run, the main thread folds the record into rolling
+// per-interval statistics and optionally appends it to a CSV file in the
+// debug log directory.
+//
+// Stages deep inside camera and mount code find their frame through the
+// thread's current frame, set with LatencyFrameScope. When the monitor is
+// disabled frames get sequence number 0 and every stamp is a single relaxed
+// load.
+
+enum LatencyStage
+{
+    LAT_EXPOSE_REQUEST,     // exposure scheduled
+    LAT_EXPOSE_START,       // capture starts, after any exposure delay
+    LAT_DOWNLOAD_END,       // driver delivered the frame, dark subtraction starts
+    LAT_DARK_END,           // dark subtraction or defect removal done
+    LAT_CAPTURE_END,        // GuideCamera::Capture returned
+    LAT_NR_END,             // noise reduction done
+    LAT_STATS_END,          // CalcStats done, frame posted to the main thread
+    LAT_FIND_START,         // main thread starts locating the star
+    LAT_FIND_END,           // star position updated
+    LAT_MOVE_START,         // worker thread starts the guide move
+    LAT_ALGO_END,           // guide algorithm result computed, pulses issued
+    LAT_PULSE_END,          // guide pulses complete
+    LAT_NUM_STAGES
+};
+
+struct LatencyIntervalStats
+{
+    const char *name;
+    unsigned int count;     // samples in the rolling window
+    double mean;            // milliseconds
+    double p50;
+    double p90;
+    double max;
+    std::vector<unsigned int> histo; // counts per LatencyMonitor::HistoEdges() bin
+};
+
+class LatencyMonitor
+{
+    static std::atomic<bool> s_enabled;
+
+    static void DoMark(unsigned int seq, LatencyStage stage);
+
+public:
+
+    static void Init();
+    static void Destroy();
+
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static bool CsvEnabled();
+    static void LoadSettings();
+    static void SetEnabled(bool enable, bool csv);
+
+    // main thread: start the record of a new exposure, returns its sequence number
+    static unsigned int BeginFrame(int exposureDuration);
+
+    static void Mark(unsigned int seq, LatencyStage stage)
+    {
+        if (seq && IsEnabled())
+            DoMark(seq, stage);
+    }
+
+    // stamp the frame the calling thread is working on
+    static void Mark(LatencyStage stage)
+    {
+        if (IsEnabled())
+            DoMark(ThreadFrame(), stage);
+    }
+
+    static unsigned int ThreadFrame();
+    static unsigned int SetThreadFrame(unsigned int seq);
+
+    // main thread: rolling statistics for each interval between stages
+    static void GetStats(std::vector<LatencyIntervalStats> *stats, unsigned int *frames);
+    // upper bin edges of the histograms in milliseconds; the last bin is open
+    static const std::vector<double>& HistoEdges();
+    static void Reset();
+};
+
+// sets the calling thread's current frame for the lifetime of the scope
+class LatencyFrameScope
+{
+    unsigned int m_prev;
+public:
+    LatencyFrameScope(unsigned int seq) : m_prev(LatencyMonitor::SetThreadFrame(seq)) { }
+    ~LatencyFrameScope() { LatencyMonitor::SetThreadFrame(m_prev); }
+};
+
+#endif // LATENCY_MONITOR_INCLUDED
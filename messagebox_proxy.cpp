@@ -41,11 +41,29 @@ void wxMessageBoxProxy::showMessageBox(void)
     m_semaphore.Post();
 }
 
+// the button a message box with this style would have focused
+static int DefaultReply(int style)
+{
+    if (style & wxYES_NO)
+        return (style & wxNO_DEFAULT) ? wxNO : wxYES;
+    if ((style & wxCANCEL) && (style & wxCANCEL_DEFAULT))
+        return wxCANCEL;
+    return wxOK;
+}
+
 int wxMessageBoxProxy::wxMessageBox(const wxString& message, const wxString& caption, int style, wxWindow *parent, int x, int y)
 {
     int ret;
 
-    if (wxThread::IsMain())
+    if (wxGetApp().IsHeadless())
+    {
+        // nobody can dismiss a message box, so the message goes to the event
+        // server clients as an alert and the default button is the reply
+        ret = DefaultReply(style);
+        Debug.AddLine(wxString::Format(_T("wxMessageBoxProxy(%s) headless, reply %d"), message, ret));
+        pFrame->Alert(message, style & wxICON_MASK);
+    }
+    else if (wxThread::IsMain())
     {
         Debug.AddLine(wxString::Format(_T("wxMessageBoxProxy(%s)"), message));
         ret = ::wxMessageBox(message, caption, style, parent, x, y);
@@ -72,6 +90,28 @@ int wxMessageBoxProxy::wxMessageBox(const wxString& message, const wxString& cap
     return ret;
 }
 
+int wxMessageBoxProxy::wxGetSingleChoiceIndex(const wxString& message, const wxString& caption, const wxArrayString& choices,
+                                              int initialSelection)
+{
+    return wxGetSingleChoiceIndex(message, caption, choices, nullptr, wxDefaultCoord, wxDefaultCoord, true,
+                                  wxCHOICE_WIDTH, wxCHOICE_HEIGHT, initialSelection);
+}
+
+int wxMessageBoxProxy::wxGetSingleChoiceIndex(const wxString& message, const wxString& caption, const wxArrayString& choices,
+                                              wxWindow *parent, int x, int y, bool centre, int width, int height,
+                                              int initialSelection)
+{
+    if (wxGetApp().IsHeadless())
+    {
+        // take the preselected choice, which is usually the one saved in the profile
+        int ret = choices.IsEmpty() ? -1 : wxMax(0, wxMin(initialSelection, (int) choices.size() - 1));
+        Debug.AddLine(wxString::Format(_T("wxGetSingleChoiceIndex(%s) headless, choice %d"), message, ret));
+        return ret;
+    }
+
+    return ::wxGetSingleChoiceIndex(message, caption, choices, parent, x, y, centre, width, height, initialSelection);
+}
+
 void MyFrame::OnMessageBoxProxy(wxCommandEvent& evt)
 {
     wxMessageBoxProxy *pRequest = (wxMessageBoxProxy *)evt.GetClientData();
@@ -36,6 +36,9 @@
 #ifndef MESSAGEBOX_PROXY_H_INCLUDED
 #define MESSAGEBOX_PROXY_H_INCLUDED
 
+// Cameras and mounts derive from this class, so their calls to wxMessageBox
+// and wxGetSingleChoiceIndex go through it. It shows message boxes on the main
+// thread, and answers with the default reply when PHD2 runs headless.
 class wxMessageBoxProxy
 {
     wxString m_message;
@@ -50,6 +53,9 @@ class wxMessageBoxProxy
 public:
     void showMessageBox(void);
     int wxMessageBox(const wxString& message, const wxString& caption = "Message", int style = wxOK, wxWindow *parent = nullptr, int x = -1, int y = -1);
+    int wxGetSingleChoiceIndex(const wxString& message, const wxString& caption, const wxArrayString& choices, int initialSelection = 0);
+    int wxGetSingleChoiceIndex(const wxString& message, const wxString& caption, const wxArrayString& choices, wxWindow *parent,
+                               int x, int y, bool centre, int width, int height, int initialSelection);
 };
 
 #endif // MESSAGEBOX_PROXY_H_INCLUDED
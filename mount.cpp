@@ -37,6 +37,7 @@
 #include "backlash_comp.h"
 #include "guiding_assistant.h"
 #include "gaussian_process_guider.h"
+#include "frame_stacker.h"
 
 #include <wx/tokenzr.h>
 #include <cstdarg>
@@ -1014,11 +1015,24 @@ Mount::MOVE_RESULT Mount::MoveOffset(GuiderOffset *ofs, unsigned int moveOptions
             }
         }
 
+        LatencyMonitor::Mark(LAT_ALGO_END);
+
         // Figure out the guide directions based on the (possibly) updated distances
         GUIDE_DIRECTION xDirection = xDistance > 0.0 ? LEFT : RIGHT;
         GUIDE_DIRECTION yDirection = yDistance > 0.0 ? DOWN : UP;
 
         int requestedXAmount = ROUND(fabs(xDistance / m_xRate));
+
+        // let the main thread decide whether the next exposure may run
+        // during the guide pulses
+        if (!IsStepGuider() && (moveOptions & MOVEOPT_MANUAL) == 0)
+        {
+            int requestedYAmount = ROUND(fabs(yDistance / m_cal.yRate));
+            if (m_backlashComp)
+                requestedYAmount += m_backlashComp->GetCompPulse(moveOptions, yDistance);
+            pFrame->NotifyGuidePulsePlanned(this, requestedXAmount + requestedYAmount);
+        }
+
         MoveResultInfo xMoveResult;
         result = MoveAxis(xDirection, requestedXAmount, moveOptions, &xMoveResult);
 
@@ -1033,6 +1047,18 @@ Mount::MOVE_RESULT Mount::MoveOffset(GuiderOffset *ofs, unsigned int moveOptions
             result = MoveAxis(yDirection, requestedYAmount, moveOptions, &yMoveResult);
         }
 
+        // tell the frame stacker how far the move shifted the star so that it can
+        // register sub-exposures taken on either side of the move
+        if (pCamera && pCamera->Stacker->Enabled() && (xMoveResult.amountMoved || yMoveResult.amountMoved))
+        {
+            double xMoved = wxMin(fabs(xDistance), xMoveResult.amountMoved * fabs(m_xRate));
+            double yMoved = wxMin(fabs(yDistance), yMoveResult.amountMoved * fabs(m_cal.yRate));
+            PHD_Point mountMoved(xDistance > 0.0 ? -xMoved : xMoved, yDistance > 0.0 ? -yMoved : yMoved);
+            PHD_Point cameraMoved;
+            if (!TransformMountCoordinatesToCameraCoordinates(mountMoved, cameraMoved, false))
+                pCamera->Stacker->NotifyGuideMove(cameraMoved);
+        }
+
         // Record the info about the guide step. The info will be picked up back in the main UI thread.
         // We don't want to do anything with the info here in the worker thread since UI operations are
         // not allowed outside the main UI thread.
@@ -1059,6 +1085,8 @@ Mount::MOVE_RESULT Mount::MoveOffset(GuiderOffset *ofs, unsigned int moveOptions
         info.starHFD = star.HFD;
         info.avgDist = pFrame->CurrentGuideError();
         info.starError = star.GetError();
+        info.starsUsed = pFrame->pGuider->StarsUsed();
+        info.starsRejected = pFrame->pGuider->StarsRejected();
     }
     catch (const wxString& errMsg)
     {
@@ -295,6 +295,7 @@ public:
     static wxString PierSideStrTr(PierSide side);
 
     bool IsBusy() const;
+    int RequestCount() const;
     void IncrementRequestCount();
     void DecrementRequestCount();
 
@@ -401,6 +402,11 @@ inline bool Mount::IsBusy() const
     return m_requestCount > 0;
 }
 
+inline int Mount::RequestCount() const
+{
+    return m_requestCount;
+}
+
 inline int Mount::ErrorCount() const
 {
     return m_errorCount;
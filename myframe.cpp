@@ -66,6 +66,7 @@ static const int DefaultExposureDuration = 1000;
 static const int DefaultAutoExpMin = 1000;
 static const int DefaultAutoExpMax = 5000;
 static const double DefaultAutoExpSNR = 6.0;
+static const int DefaultPipelinePulseLimit = 0;
 
 wxDEFINE_EVENT(REQUEST_EXPOSURE_EVENT, wxCommandEvent);
 wxDEFINE_EVENT(REQUEST_MOUNT_MOVE_EVENT, wxCommandEvent);
@@ -160,6 +161,7 @@ wxBEGIN_EVENT_TABLE(MyFrame, wxFrame)
     EVT_CLOSE(MyFrame::OnClose)
     EVT_THREAD(MYFRAME_WORKER_THREAD_EXPOSE_COMPLETE, MyFrame::OnExposeComplete)
     EVT_THREAD(MYFRAME_WORKER_THREAD_MOVE_COMPLETE, MyFrame::OnMoveComplete)
+    EVT_THREAD(MYFRAME_WORKER_THREAD_PULSE_PLANNED, MyFrame::OnGuidePulsePlanned)
 
     EVT_COMMAND(wxID_ANY, REQUEST_EXPOSURE_EVENT, MyFrame::OnRequestExposure)
     EVT_COMMAND(wxID_ANY, WXMESSAGEBOX_PROXY_EVENT, MyFrame::OnMessageBoxProxy)
@@ -249,6 +251,7 @@ MyFrame::MyFrame()
     // Setup Status bar
     SetupStatusBar();
 
+    m_starFindMode = Star::FIND_CENTROID;
     LoadProfileSettings();
 
     // Setup container window for alert message info bar and guider window
@@ -366,7 +369,6 @@ MyFrame::MyFrame()
     pCalReviewDlg = nullptr;
     pCalibrationAssistant = nullptr;
     pierFlipToolWin = nullptr;
-    m_starFindMode = Star::FIND_CENTROID;
     m_rawImageMode = false;
     m_rawImageModeWarningDone = false;
 
@@ -374,7 +376,8 @@ MyFrame::MyFrame()
 
     SetupHelpFile();
 
-    if (m_serverMode)
+    // the event server is the only way to control a headless instance
+    if (m_serverMode || wxGetApp().IsHeadless())
     {
         tools_menu->Check(MENU_SERVER,true);
         StartServer(true);
@@ -389,6 +392,8 @@ MyFrame::MyFrame()
     m_continueCapturing = false;
     CaptureActive     = false;
     m_exposurePending = false;
+    m_exposureDeferred = false;
+    m_moveThreads[0] = m_moveThreads[1] = nullptr;
 
     m_singleExposure.enabled = false;
     m_singleExposure.duration = 0;
@@ -919,6 +924,12 @@ void MyFrame::LoadProfileSettings()
     SetExposureDuration(exposureDuration);
     m_beepForLostStar = pConfig->Profile.GetBoolean("/BeepForLostStar", true);
 
+    int starFindMode = pConfig->Profile.GetInt("/StarFindMode", Star::FIND_CENTROID);
+    SetStarFindMode(starFindMode == Star::FIND_PSF_FIT ? Star::FIND_PSF_FIT : Star::FIND_CENTROID);
+
+    m_pipelinedExposures = pConfig->Profile.GetBoolean("/frame/PipelinedExposures", false);
+    m_pipelinePulseLimit = pConfig->Profile.GetInt("/frame/PipelinePulseLimit", DefaultPipelinePulseLimit);
+
     int val = pConfig->Profile.GetInt("/Gamma", GAMMA_DEFAULT);
     if (val < GAMMA_MIN) val = GAMMA_MIN;
     if (val > GAMMA_MAX) val = GAMMA_MAX;
@@ -926,6 +937,7 @@ void MyFrame::LoadProfileSettings()
     Gamma_Slider->SetValue(val);
 
     LoadImageLoggerSettings();
+    LatencyMonitor::LoadSettings();
     INDIConfig::LoadProfileSettings();
 }
 
@@ -1255,6 +1267,12 @@ void MyFrame::DoAlert(const alert_params& params)
 {
     Debug.Write(wxString::Format("Alert: %s\n", params.msg));
 
+    if (wxGetApp().IsHeadless())
+    {
+        EvtServer.NotifyAlert(params.msg, params.flags);
+        return;
+    }
+
     m_alertDontShowFn = params.fnDontShow;
     m_alertSpecialFn = params.fnSpecial;
     m_alertFnArg = params.arg;
@@ -1669,6 +1687,7 @@ bool MyFrame::StopWorkerThread(WorkerThread*& pWorkerThread)
 void MyFrame::OnRequestExposure(wxCommandEvent& evt)
 {
     EXPOSE_REQUEST *req = (EXPOSE_REQUEST *) evt.GetClientData();
+    LatencyFrameScope latencyFrame(req->latencySeq);
     bool error = GuideCamera::Capture(pCamera, req->exposureDuration, *req->pImage, req->options, req->subframe);
     req->error = error;
     req->pSemaphore->Post();
@@ -1677,6 +1696,7 @@ void MyFrame::OnRequestExposure(wxCommandEvent& evt)
 void MyFrame::OnRequestMountMove(wxCommandEvent& evt)
 {
     MOVE_REQUEST *request = (MOVE_REQUEST *) evt.GetClientData();
+    LatencyFrameScope latencyFrame(request->latencySeq);
 
     Debug.Write("OnRequestMountMove() begins\n");
 
@@ -1719,11 +1739,90 @@ void MyFrame::ScheduleExposure()
     m_exposurePending = true;
 
     usImage *img = new usImage();
+    unsigned int latencySeq = LatencyMonitor::BeginFrame(exposureDuration);
 
     wxCriticalSectionLocker lock(m_CSpWorkerThread);
 
     if (m_pPrimaryWorkerThread) // can be null when app is shutting down (unlikely but possible)
-        m_pPrimaryWorkerThread->EnqueueWorkerThreadExposeRequest(img, exposureDuration, exposureOptions, subframe);
+        m_pPrimaryWorkerThread->EnqueueWorkerThreadExposeRequest(img, exposureDuration, exposureOptions, subframe, latencySeq);
+}
+
+static bool CanMoveDuringExposure(Mount *mount)
+{
+    return !mount || !mount->IsConnected() || !mount->SynchronousOnly();
+}
+
+// With pipelined exposures the next exposure starts as soon as a guide frame
+// arrives, so it runs while the frame is processed and its guide pulses are
+// issued. When a pipeline pulse limit is set, a longer pulse would smear the
+// star, so the exposure instead waits until the frame's pulses are known, and
+// until the mount is idle if one exceeds the limit. Only guiding is
+// pipelined; calibration and looping keep the strict expose-then-move order.
+// The primary worker thread is busy exposing, so guide moves go to the
+// secondary worker thread, which rules out mounts that must pulse
+// synchronously with the camera.
+bool MyFrame::PipelineActive() const
+{
+    return m_pipelinedExposures && m_continueCapturing && !m_singleExposure.enabled &&
+        pGuider->IsGuiding() && pCamera && pCamera->HasNonGuiCapture() &&
+        CanMoveDuringExposure(pMount) && CanMoveDuringExposure(pSecondaryMount);
+}
+
+// true if an exposure can run alongside the guide moves in flight: there is
+// no pulse limit, or every move's pulse is known and within the limit
+bool MyFrame::CanOverlapGuideMoves() const
+{
+    if (m_pipelinePulseLimit == 0)
+        return true;
+
+    Mount *const mounts[] = { pMount, pSecondaryMount };
+    for (int i = 0; i < 2; i++)
+    {
+        if (!mounts[i] || !mounts[i]->IsBusy())
+            continue;
+        // a move whose pulse is not known yet (or an AO step, which is never
+        // reported) holds the exposure until it completes
+        if ((int) m_plannedPulses[i].size() < mounts[i]->RequestCount())
+            return false;
+        for (int pulse : m_plannedPulses[i])
+            if (pulse > m_pipelinePulseLimit)
+                return false;
+    }
+    return true;
+}
+
+void MyFrame::StartDeferredExposure()
+{
+    m_exposureDeferred = false;
+    if (CaptureActive && m_continueCapturing && !m_exposurePending && pGuider->GetPauseType() != PAUSE_FULL)
+        ScheduleExposure();
+}
+
+// Called by Mount::MoveOffset on the thread doing the move, once the guide
+// pulses are known and before they are issued. The event goes through the
+// same queue as the move completion event, so it is handled first.
+void MyFrame::NotifyGuidePulsePlanned(Mount *mount, int pulseMs)
+{
+    wxThreadEvent *event = new wxThreadEvent(wxEVT_THREAD, MYFRAME_WORKER_THREAD_PULSE_PLANNED);
+    event->SetPayload<Mount *>(mount);
+    event->SetInt(pulseMs);
+    wxQueueEvent(this, event);
+}
+
+// OnMoveComplete relies on the moves for a mount completing in the order they
+// were scheduled, so while any are in flight, later ones go to the same worker
+// thread even if the pipeline has started or stopped in the meantime
+WorkerThread *MyFrame::MoveThread(Mount *mount, WorkerThread *preferred)
+{
+    int slot = mount == pMount ? 0 : mount == pSecondaryMount ? 1 : -1;
+    if (slot < 0)
+        return preferred;
+
+    if (mount->IsBusy() && m_moveThreads[slot])
+        return m_moveThreads[slot];
+
+    m_moveThreads[slot] = preferred;
+    return preferred;
 }
 
 void MyFrame::SchedulePrimaryMove(Mount *mount, const GuiderOffset& ofs, unsigned int moveOptions)
@@ -1734,12 +1833,15 @@ void MyFrame::SchedulePrimaryMove(Mount *mount, const GuiderOffset& ofs, unsigne
 
     assert(mount);
 
+    // while pipelined, the primary thread is exposing the next frame
+    WorkerThread *thread = MoveThread(mount, PipelineActive() ? m_pSecondaryWorkerThread : m_pPrimaryWorkerThread);
+
     // Manual moves do not affect the request count for IsBusy()
     if ((moveOptions & MOVEOPT_MANUAL) == 0)
         mount->IncrementRequestCount();
 
-    assert(m_pPrimaryWorkerThread);
-    m_pPrimaryWorkerThread->EnqueueWorkerThreadMoveRequest(mount, ofs, moveOptions);
+    assert(thread);
+    thread->EnqueueWorkerThreadMoveRequest(mount, ofs, moveOptions);
 }
 
 void MyFrame::ScheduleSecondaryMove(Mount *mount, const GuiderOffset& ofs, unsigned int moveOptions)
@@ -1758,11 +1860,13 @@ void MyFrame::ScheduleSecondaryMove(Mount *mount, const GuiderOffset& ofs, unsig
     }
     else
     {
+        WorkerThread *thread = MoveThread(mount, m_pSecondaryWorkerThread);
+
         if ((moveOptions & MOVEOPT_MANUAL) == 0)
             mount->IncrementRequestCount();
 
-        assert(m_pSecondaryWorkerThread);
-        m_pSecondaryWorkerThread->EnqueueWorkerThreadMoveRequest(mount, ofs, moveOptions);
+        assert(thread);
+        thread->EnqueueWorkerThreadMoveRequest(mount, ofs, moveOptions);
     }
 }
 
@@ -1772,11 +1876,13 @@ void MyFrame::ScheduleAxisMove(Mount *mount, const GUIDE_DIRECTION direction, in
 
     assert(mount);
 
+    WorkerThread *thread = MoveThread(mount, m_pPrimaryWorkerThread);
+
     if ((moveOptions & MOVEOPT_MANUAL) == 0)
         mount->IncrementRequestCount();
 
-    assert(m_pPrimaryWorkerThread);
-    m_pPrimaryWorkerThread->EnqueueWorkerThreadAxisMove(mount, direction, duration, moveOptions);
+    assert(thread);
+    thread->EnqueueWorkerThreadAxisMove(mount, direction, duration, moveOptions);
 }
 
 void MyFrame::ScheduleManualMove(Mount *mount, const GUIDE_DIRECTION direction, int duration)
@@ -1851,6 +1957,7 @@ void MyFrame::StartCapturing()
             m_continueCapturing = true;
 
         CaptureActive = true;
+        m_exposureDeferred = false;
         m_frameCounter = 0;
 
         CheckDarkFrameGeometry();
@@ -1887,6 +1994,7 @@ bool MyFrame::StopCapturing()
     {
         StatusMsgNoTimeout(_("Waiting for devices..."));
         m_continueCapturing = false;
+        m_exposureDeferred = false;
 
         if (m_exposurePending)
         {
@@ -1929,6 +2037,7 @@ void MyFrame::SetPaused(PauseType pause)
             Debug.Write("un-pause: clearing mount guide algorithm history\n");
             pMount->NotifyGuidingResumed();
         }
+        m_exposureDeferred = false;
         if (m_continueCapturing && !m_exposurePending)
             ScheduleExposure();
         StatusMsg(_("Resumed"));
@@ -2799,6 +2908,30 @@ void MyFrame::SetBeepForLostStar(bool beep)
     Debug.Write(wxString::Format("Beep for lost star set to %s\n", beep ? "true" : "false"));
 }
 
+bool MyFrame::GetPipelinedExposures() const
+{
+    return m_pipelinedExposures;
+}
+
+void MyFrame::SetPipelinedExposures(bool enable)
+{
+    m_pipelinedExposures = enable;
+    pConfig->Profile.SetBoolean("/frame/PipelinedExposures", enable);
+    Debug.Write(wxString::Format("Pipelined exposures set to %s\n", enable ? "true" : "false"));
+}
+
+int MyFrame::GetPipelinePulseLimit() const
+{
+    return m_pipelinePulseLimit;
+}
+
+void MyFrame::SetPipelinePulseLimit(int limitMs)
+{
+    m_pipelinePulseLimit = wxMax(0, limitMs);
+    pConfig->Profile.SetInt("/frame/PipelinePulseLimit", m_pipelinePulseLimit);
+    Debug.Write(wxString::Format("Pipeline pulse limit set to %d ms\n", m_pipelinePulseLimit));
+}
+
 wxString MyFrame::GetSettingsSummary() const
 {
     // return a loggable summary of current global configs managed by MyFrame
@@ -3198,6 +3331,24 @@ MyFrameConfigDialogCtrlSet::MyFrameConfigDialogCtrlSet(MyFrame *pFrame, Advanced
     wxStaticBoxSizer* varDelayGrp = new wxStaticBoxSizer(wxHORIZONTAL, parent, _("Variable Exposure Delay (High-precision encoder mounts)"));
     varDelayGrp->Add(sz2, wxSizerFlags(0).Expand());
     AddGroup(CtrlMap, AD_szVariableExposureDelay, varDelayGrp);
+
+    wxFlexGridSizer *sz3 = new wxFlexGridSizer(1, 2, 10, 10);
+    width = StringWidth(_T("00000"));
+    parent = GetParentWindow(AD_szPipelinedExposures);
+    m_pipelineEnabled = new wxCheckBox(parent, wxID_ANY, _("Expose during guide pulses"), wxDefaultPosition, wxDefaultSize);
+    m_pipelineEnabled->SetToolTip(_("While guiding, start the next exposure while the guide pulses for the last frame are running. "
+        "Not available with mounts that must guide synchronously with the camera."));
+    m_pipelineEnabled->Bind(wxEVT_COMMAND_CHECKBOX_CLICKED, &MyFrameConfigDialogCtrlSet::OnPipelinedExposuresChecked, this);
+    sz3->Add(m_pipelineEnabled, wxSizerFlags().Align(wxALIGN_CENTER_VERTICAL).Border(wxLEFT, 8));
+    m_pipelineHoldLimit = pFrame->MakeSpinCtrl(parent, wxID_ANY, _T(" "), wxDefaultPosition, wxSize(width, -1), wxSP_ARROW_KEYS, 0, 10000, 0,
+        _T("PipelinePulseLimit"));
+    sz3->Add(MakeLabeledControl(AD_szPipelinedExposures, _("Hold for pulses over (ms)"), m_pipelineHoldLimit,
+        _("0 starts the next exposure as soon as a frame arrives. Otherwise the next exposure waits until the guide pulses "
+        "for the frame are known, and until the mount has finished moving if a pulse is longer than this, "
+        "so it does not smear the star. Default = 0 (no hold)")));
+    wxStaticBoxSizer *pipelineGrp = new wxStaticBoxSizer(wxHORIZONTAL, parent, _("Pipelined Exposures"));
+    pipelineGrp->Add(sz3, wxSizerFlags(0).Expand());
+    AddGroup(CtrlMap, AD_szPipelinedExposures, pipelineGrp);
 }
 
 void MyFrameConfigDialogCtrlSet::LoadValues()
@@ -3220,6 +3371,9 @@ void MyFrameConfigDialogCtrlSet::LoadValues()
     m_pTimeLapse->Enable(!delayCfg.enabled);
     m_varExpDelayShort->Enable(delayCfg.enabled);
     m_varExpDelayLong->Enable(delayCfg.enabled);
+    m_pipelineEnabled->SetValue(m_pFrame->GetPipelinedExposures());
+    m_pipelineHoldLimit->SetValue(m_pFrame->GetPipelinePulseLimit());
+    m_pipelineHoldLimit->Enable(m_pFrame->GetPipelinedExposures());
 
     SetFocalLength(m_pFrame->GetFocalLength());
     m_pFocalLength->Enable(!pFrame->CaptureActive);
@@ -3306,6 +3460,8 @@ void MyFrameConfigDialogCtrlSet::UnloadValues()
         m_pFrame->SetDitherScaleFactor(m_ditherScaleFactor->GetValue());
         m_pFrame->SetTimeLapse(m_pTimeLapse->GetValue());
         pFrame->SetVariableDelayConfig(m_varExposureDelayEnabled->GetValue(), m_varExpDelayShort->GetValue() * 1000, m_varExpDelayLong->GetValue() * 1000);
+        m_pFrame->SetPipelinedExposures(m_pipelineEnabled->GetValue());
+        m_pFrame->SetPipelinePulseLimit(m_pipelineHoldLimit->GetValue());
         int oldFL = m_pFrame->GetFocalLength();
         int newFL = GetFocalLength();               // From UI control
         if (oldFL != newFL)                         // Validator insures fl is generally reasonable and non-zero
@@ -3416,6 +3572,11 @@ void MyFrameConfigDialogCtrlSet::OnVariableDelayChecked(wxCommandEvent& evt)
     m_varExpDelayLong->Enable(evt.IsChecked());
 }
 
+void MyFrameConfigDialogCtrlSet::OnPipelinedExposuresChecked(wxCommandEvent& evt)
+{
+    m_pipelineHoldLimit->Enable(evt.IsChecked());
+}
+
 void MyFrame::PlaceWindowOnScreen(wxWindow *win, int x, int y)
 {
     if (x < 0 || x > wxSystemSettings::GetMetric(wxSYS_SCREEN_X) - 20 ||
@@ -47,6 +47,7 @@ enum E_MYFRAME_WORKER_THREAD_MESSAGES
 {
     MYFRAME_WORKER_THREAD_EXPOSE_COMPLETE = wxID_HIGHEST+1,
     MYFRAME_WORKER_THREAD_MOVE_COMPLETE,
+    MYFRAME_WORKER_THREAD_PULSE_PLANNED,
 };
 
 wxDECLARE_EVENT(REQUEST_EXPOSURE_EVENT, wxCommandEvent);
@@ -151,9 +152,12 @@ class MyFrameConfigDialogCtrlSet : public ConfigDialogCtrlSet
     wxCheckBox *m_varExposureDelayEnabled;
     wxSpinCtrl *m_varExpDelayShort;
     wxSpinCtrl *m_varExpDelayLong;
+    wxCheckBox *m_pipelineEnabled;
+    wxSpinCtrl *m_pipelineHoldLimit;
     void OnDirSelect(wxCommandEvent& evt);
     void OnImageLogEnableChecked(wxCommandEvent& event);
     void OnVariableDelayChecked(wxCommandEvent& evt);
+    void OnPipelinedExposuresChecked(wxCommandEvent& evt);
 
 public:
     MyFrameConfigDialogCtrlSet(MyFrame *pFrame, AdvancedDialog* pAdvancedDialog, BrainCtrlIdMap& CtrlMap);
@@ -204,6 +208,16 @@ private:
 
     bool m_continueCapturing; // should another image be captured?
     SingleExposure m_singleExposure;
+    bool m_pipelinedExposures; // start the next exposure while the guide pulses for this frame run
+    int m_pipelinePulseLimit; // ms; a longer guide pulse holds the next exposure until the mount is idle, 0 for no hold
+    bool m_exposureDeferred; // exposure held back until outstanding guide moves complete
+    std::vector<int> m_plannedPulses[2]; // planned pulse (ms) of the in-flight moves of pMount, pSecondaryMount
+    WorkerThread *m_moveThreads[2]; // worker thread running the in-flight moves of pMount, pSecondaryMount
+
+    bool PipelineActive() const;
+    bool CanOverlapGuideMoves() const;
+    void StartDeferredExposure();
+    WorkerThread *MoveThread(Mount *mount, WorkerThread *preferred);
 
 public:
     MyFrame();
@@ -344,6 +358,7 @@ public:
     void OnExposeComplete(wxThreadEvent& evt);
     void OnExposeComplete(usImage *image, bool err);
     void OnMoveComplete(wxThreadEvent& evt);
+    void OnGuidePulsePlanned(wxThreadEvent& evt);
 
     void LoadProfileSettings();
     void UpdateTitle();
@@ -396,6 +411,11 @@ public:
     static void PlaceWindowOnScreen(wxWindow *window, int x, int y);
     bool GetBeepForLostStar();
     void SetBeepForLostStar(bool beep);
+    bool GetPipelinedExposures() const;
+    void SetPipelinedExposures(bool enable);
+    int GetPipelinePulseLimit() const;
+    void SetPipelinePulseLimit(int limitMs);
+    void NotifyGuidePulsePlanned(Mount *mount, int pulseMs);
 
     MyFrameConfigDialogPane *GetConfigDialogPane(wxWindow *pParent);
     MyFrameConfigDialogCtrlSet *GetConfigDlgCtrlSet(MyFrame *pFrame, AdvancedDialog *pAdvancedDialog, BrainCtrlIdMap& CtrlMap);
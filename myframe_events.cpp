@@ -413,6 +413,7 @@ void MyFrame::FinishStop(void)
     UpdateButtonsStatus();
     StatusMsg(_("Stopped."));
     PhdController::AbortController("Stopped capturing");
+    ImageBufferPool::LogStats();
 }
 
 static wxString RawModeWarningKey(void)
@@ -445,6 +446,13 @@ static void WarnRawImageMode(void)
  * - updates button state based on appropriate state variables
  * - schedules another exposure if CaptureActive is stil true
  *
+ * With pipelined exposures the next exposure is scheduled before the guider
+ * state is updated, so the exposure runs while this frame is processed and
+ * its correction is issued. When a pipeline pulse limit is set, the exposure
+ * is instead held until the guide pulses for this frame are known, then
+ * started while they run if none of them is longer than the limit (see
+ * OnGuidePulsePlanned).
+ *
  */
 void MyFrame::OnExposeComplete(usImage *pNewFrame, bool err)
 {
@@ -503,24 +511,43 @@ void MyFrame::OnExposeComplete(usImage *pNewFrame, bool err)
             CheckDarkFrameGeometry();
         }
 
+        if (PipelineActive() && m_pipelinePulseLimit == 0)
+        {
+            Debug.Write("OnExposeComplete: pipelined, starting next exposure\n");
+            ScheduleExposure();
+        }
+
         pGuider->UpdateGuideState(pNewFrame, !m_continueCapturing);
         pNewFrame = NULL; // the guider owns it now
 
         PhdController::UpdateControllerState();
 
-        Debug.Write(wxString::Format("OnExposeComplete: CaptureActive=%d m_continueCapturing=%d\n",
-            CaptureActive, m_continueCapturing));
+        Debug.Write(wxString::Format("OnExposeComplete: CaptureActive=%d m_continueCapturing=%d exposurePending=%d\n",
+            CaptureActive, m_continueCapturing, m_exposurePending));
 
         CaptureActive = m_continueCapturing;
 
         if (CaptureActive)
         {
-            ScheduleExposure();
+            if (m_exposurePending)
+            {
+                // already started by the pipeline
+            }
+            else if (PipelineActive() && !CanOverlapGuideMoves())
+            {
+                Debug.Write("OnExposeComplete: holding exposure until the guide pulses are known\n");
+                m_exposureDeferred = true;
+            }
+            else
+            {
+                ScheduleExposure();
+            }
         }
-        else
+        else if (!m_exposurePending)
         {
             FinishStop();
         }
+        // otherwise the stop finishes when the pipelined exposure completes
     }
     catch (const wxString& Msg)
     {
@@ -533,9 +560,35 @@ void MyFrame::OnExposeComplete(wxThreadEvent& event)
 {
     usImage *image = event.GetPayload<usImage *>();
     bool err = event.GetInt() != 0;
+    LatencyFrameScope latencyFrame(event.GetExtraLong());
     OnExposeComplete(image, err);
 }
 
+void MyFrame::OnGuidePulsePlanned(wxThreadEvent& event)
+{
+    Mount *mount = event.GetPayload<Mount *>();
+    int pulse = event.GetInt();
+
+    if (mount != pMount && mount != pSecondaryMount)
+        return;
+
+    m_plannedPulses[mount == pMount ? 0 : 1].push_back(pulse);
+
+    if (!m_exposureDeferred)
+        return;
+
+    if (CanOverlapGuideMoves())
+    {
+        Debug.Write(wxString::Format("guide pulse %d ms within limit, starting held exposure\n", pulse));
+        StartDeferredExposure();
+    }
+    else if (pulse > m_pipelinePulseLimit)
+    {
+        Debug.Write(wxString::Format("guide pulse %d ms exceeds limit %d ms, exposure held until the move completes\n",
+            pulse, m_pipelinePulseLimit));
+    }
+}
+
 void MyFrame::OnMoveComplete(wxThreadEvent& event_)
 {
     try
@@ -553,6 +606,22 @@ void MyFrame::OnMoveComplete(wxThreadEvent& event_)
         assert(mount->IsBusy());
         mount->DecrementRequestCount();
 
+        if (mount == pMount || mount == pSecondaryMount)
+        {
+            // moves complete in order, so this was the oldest planned move
+            std::vector<int>& planned = m_plannedPulses[mount == pMount ? 0 : 1];
+            if (!mount->IsBusy())
+                planned.clear();
+            else if (!planned.empty())
+                planned.erase(planned.begin());
+        }
+
+        if (m_exposureDeferred && CanOverlapGuideMoves())
+        {
+            Debug.Write("guide pulses within limit, starting held exposure\n");
+            StartDeferredExposure();
+        }
+
         Mount::MOVE_RESULT moveResult = event.result;
 
         mount->LogGuideStepInfo();
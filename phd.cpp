@@ -34,6 +34,7 @@
 
 #include "phd.h"
 
+#include "benchmark.h"
 #include "phdupdate.h"
 
 #include <curl/curl.h>
@@ -71,6 +72,8 @@ static const wxCmdLineEntryDesc cmdLineDesc[] =
     { wxCMD_LINE_SWITCH, "R", "Reset", "Reset all PHD2 settings to default values" },
     { wxCMD_LINE_OPTION, "s", "save", "save settings to file and exit", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
     { wxCMD_LINE_SWITCH, "v", "version", "print the program version and exit" },
+    { wxCMD_LINE_SWITCH, "H", "headless", "run without showing any windows, for use with event server clients" },
+    { wxCMD_LINE_OPTION, "B", "benchmark", "run image processing benchmarks (all, or comma-separated list) and exit", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
     { wxCMD_LINE_NONE }
 };
 
@@ -124,6 +127,7 @@ struct ExecFuncThreadEvent : public wxThreadEvent
 PhdApp::PhdApp()
 {
     m_resetConfig = false;
+    m_headless = false;
     m_instanceNumber = 1;
 #ifdef  __linux__
     XInitThreads();
@@ -637,12 +641,21 @@ bool PhdApp::OnInit()
     PhdController::OnAppInit();
 
     ImageLogger::Init();
+    LatencyMonitor::Init();
 
     wxImage::AddHandler(new wxJPEGHandler);
     wxImage::AddHandler(new wxPNGHandler);
 
     pFrame = new MyFrame();
 
+    if (m_headless)
+    {
+        // the frame is never shown, so nothing is painted; clients drive
+        // the capture, guide and mount pipeline through the event server
+        Debug.Write("Running headless\n");
+        return true;
+    }
+
     pFrame->Show(true);
 
     if (pConfig->IsNewInstance() || (pConfig->NumProfiles() == 1 && pFrame->pGearDialog->IsEmptyProfile()))
@@ -662,6 +675,7 @@ int PhdApp::OnExit()
     assert(!pCamera);
 
     ImageLogger::Destroy();
+    LatencyMonitor::Destroy();
 
     PhdController::OnAppExit();
 
@@ -694,6 +708,15 @@ bool PhdApp::OnCmdLineParsed(wxCmdLineParser& parser)
         wxPrintf("%s\n", FULLVER);
         ::exit(0);
     }
+    else
+    {
+        wxString benchmarks;
+        if (parser.Found("B", &benchmarks))
+        {
+            RunBenchmarks(benchmarks);
+            ::exit(0);
+        }
+    }
 
     parser.Found("i", &m_instanceNumber);
 
@@ -703,6 +726,7 @@ bool PhdApp::OnCmdLineParsed(wxCmdLineParser& parser)
         s_configOp = CONFIG_OP_SAVE;
 
     m_resetConfig = parser.Found("R");
+    m_headless = parser.Found("H");
 
     return true;
 }
@@ -189,6 +189,7 @@ WX_DEFINE_ARRAY_DOUBLE(double, ArrayOfDbl);
 #include "runinbg.h"
 #include "fitsiowrap.h"
 #include "imagelogger.h"
+#include "latency_monitor.h"
 
 class wxSingleInstanceChecker;
 
@@ -216,6 +217,7 @@ class PhdApp : public wxApp
     wxSingleInstanceChecker *m_instanceChecker;
     long m_instanceNumber;
     bool m_resetConfig;
+    bool m_headless;
     wxString m_resourcesDir;
     wxDateTime m_logFileTime;
 
@@ -237,6 +239,7 @@ public:
     virtual bool Yield(bool onlyIfNeeded = false);
     static void ExecInMainThread(std::function<void()> func);
     int GetInstanceNumber() const { return m_instanceNumber; }
+    bool IsHeadless() const { return m_headless; }
     const wxString& GetPHDResourcesDir() const { return m_resourcesDir; }
     wxString GetLocalesDir() const;
     const wxLocale& GetLocale() const { return m_locale; }
@@ -36,6 +36,10 @@
  */
 
 #include "phd.h"
+#include "image_simd.h"
+#include "star_hfr.h"
+#include "thread_pool.h"
+
 #include <algorithm>
 
 Star::Star()
@@ -69,58 +73,257 @@ void Star::SetError(FindResult error)
     m_lastFindResult = error;
 }
 
-// helper struct for HFR calculation
-struct R2M
+// Least-squares fit of a circular 2-D Gaussian on a constant background to
+// the (2R+1) x (2R+1) stamp of pixels centered on (cx, cy), by
+// Levenberg-Marquardt. The stamp radius is a template parameter, so all the
+// working storage is on the stack and the loops have fixed trip counts.
+// Pixels outside the view or at or above clipADU are left out of the fit.
+template<int R>
+class PsfFitter
 {
-    double r2;
-    wxPoint p;
-    double m;
-    R2M() { }
-    R2M(int x, int y, double m_) : p(x, y), m(m_) { }
-    bool operator<(const R2M& rhs) const { return r2 < rhs.r2; }
-};
+    enum { SIZE = 2 * R + 1, NPIX = SIZE * SIZE, MAX_ITERATIONS = 30 };
 
-static double hfr(std::vector<R2M>& vec, double cx, double cy, double mass)
-{
-    if (vec.size() == 1) // hot pixel?
-        return 0.25;
+public:
+    // model parameters; the position is relative to the stamp center
+    enum { P_AMP, P_X, P_Y, P_SIGMA, P_BG, NPAR };
+
+private:
+    double m_val[NPIX];
+    double m_wt[NPIX];          // 1 for the pixels in the fit, else 0
+    int m_cx, m_cy;
+    unsigned int m_npix;
 
-    // compute Half Flux Radius (HFR)
-    for (auto it = vec.begin(); it != vec.end(); ++it)
+    // the Gaussian is separable, so a stamp needs only 2 * SIZE exponentials
+    static void Profile(const double p[NPAR], double gx[SIZE], double gy[SIZE])
     {
-        double dx = (double) it->p.x - cx;
-        double dy = (double) it->p.y - cy;
-        it->r2 = dx * dx + dy * dy;
+        double const k = -0.5 / (p[P_SIGMA] * p[P_SIGMA]);
+        for (int i = 0; i < SIZE; i++)
+        {
+            double const ex = (double)(i - R) - p[P_X];
+            double const ey = (double)(i - R) - p[P_Y];
+            gx[i] = exp(k * ex * ex);
+            gy[i] = exp(k * ey * ey);
+        }
     }
-    std::sort(vec.begin(), vec.end()); // sort by ascending radius^2
 
-    // find radius of half-mass
-    double r20, r21, m0, m1;
-    r20 = r21 = m0 = m1 = 0.0;
-    double halfm = 0.5 * mass;
-    for (auto it = vec.begin(); it != vec.end(); ++it)
+    double Chi2(const double p[NPAR]) const
     {
-        const R2M& rm = *it;
-        r20 = r21;
-        m0 = m1;
-        r21 = rm.r2;
-        m1 += rm.m;
-        if (m1 > halfm)
-            break;
+        double gx[SIZE], gy[SIZE];
+        Profile(p, gx, gy);
+
+        double chi2 = 0.;
+        for (int j = 0; j < SIZE; j++)
+        {
+            for (int i = 0; i < SIZE; i++)
+            {
+                double const r = m_val[j * SIZE + i] - (p[P_BG] + p[P_AMP] * gx[i] * gy[j]);
+                chi2 += m_wt[j * SIZE + i] * r * r;
+            }
+        }
+        return chi2;
     }
 
-    // interpolate
-    double hfr;
-    if (m1 > m0)
+    // normal equations J'J and J'r at p
+    void NormalEquations(const double p[NPAR], double jtj[NPAR][NPAR], double jtr[NPAR]) const
     {
-        double r0 = sqrt(r20), r1 = sqrt(r21);
-        double s = (r1 - r0) / (m1 - m0);
-        hfr = r0 + s * (halfm - m0);
+        double gx[SIZE], gy[SIZE];
+        Profile(p, gx, gy);
+
+        double const s2 = p[P_SIGMA] * p[P_SIGMA];
+
+        for (int a = 0; a < NPAR; a++)
+        {
+            jtr[a] = 0.;
+            for (int b = 0; b < NPAR; b++)
+                jtj[a][b] = 0.;
+        }
+
+        for (int j = 0; j < SIZE; j++)
+        {
+            double const ey = (double)(j - R) - p[P_Y];
+            for (int i = 0; i < SIZE; i++)
+            {
+                double const w = m_wt[j * SIZE + i];
+                if (w == 0.)
+                    continue;
+
+                double const ex = (double)(i - R) - p[P_X];
+                double const g = gx[i] * gy[j];
+                double const ag = p[P_AMP] * g / s2;
+                double const r = m_val[j * SIZE + i] - (p[P_BG] + p[P_AMP] * g);
+
+                double const d[NPAR] = { g, ag * ex, ag * ey, ag * (ex * ex + ey * ey) / p[P_SIGMA], 1. };
+
+                for (int a = 0; a < NPAR; a++)
+                {
+                    jtr[a] += d[a] * r;
+                    for (int b = 0; b <= a; b++)
+                        jtj[a][b] += d[a] * d[b];
+                }
+            }
+        }
+
+        for (int a = 0; a < NPAR; a++)
+            for (int b = a + 1; b < NPAR; b++)
+                jtj[a][b] = jtj[b][a];
     }
-    else
-        hfr = 0.25;
 
-    return hfr;
+    // solve the symmetric positive definite system a x = b by Cholesky
+    // decomposition, in place; x is returned in b
+    static bool Solve(double a[NPAR][NPAR], double b[NPAR])
+    {
+        for (int j = 0; j < NPAR; j++)
+        {
+            double d = a[j][j];
+            for (int k = 0; k < j; k++)
+                d -= a[j][k] * a[j][k];
+            if (d <= 0.)
+                return false;
+            a[j][j] = sqrt(d);
+            for (int i = j + 1; i < NPAR; i++)
+            {
+                double s = a[i][j];
+                for (int k = 0; k < j; k++)
+                    s -= a[i][k] * a[j][k];
+                a[i][j] = s / a[j][j];
+            }
+        }
+        for (int i = 0; i < NPAR; i++)
+        {
+            double s = b[i];
+            for (int k = 0; k < i; k++)
+                s -= a[i][k] * b[k];
+            b[i] = s / a[i][i];
+        }
+        for (int i = NPAR - 1; i >= 0; i--)
+        {
+            double s = b[i];
+            for (int k = i + 1; k < NPAR; k++)
+                s -= a[k][i] * b[k];
+            b[i] = s / a[i][i];
+        }
+        return true;
+    }
+
+public:
+
+    PsfFitter(const ImageView& view, int cx, int cy, unsigned int clipADU)
+        : m_cx(cx), m_cy(cy), m_npix(0)
+    {
+        for (int j = 0; j < SIZE; j++)
+        {
+            int const y = cy + j - R;
+            for (int i = 0; i < SIZE; i++)
+            {
+                int const x = cx + i - R;
+                double val = 0., wt = 0.;
+                if (view.rect.Contains(x, y))
+                {
+                    unsigned int const v = view.Pixel(x, y);
+                    val = (double) v;
+                    if (v < clipADU)
+                    {
+                        wt = 1.;
+                        ++m_npix;
+                    }
+                }
+                m_val[j * SIZE + i] = val;
+                m_wt[j * SIZE + i] = wt;
+            }
+        }
+    }
+
+    // Fit the model starting from the star position (x, y) and the given
+    // background and HFD. On success (x, y) receive the fitted position.
+    bool Fit(double *x, double *y, double bg, double hfd)
+    {
+        if (m_npix < 2 * NPAR)
+            return false;
+
+        double p[NPAR];
+        p[P_X] = *x - m_cx;
+        p[P_Y] = *y - m_cy;
+        p[P_SIGMA] = std::max(hfd / 2.3548, 0.5);   // the HFD of a Gaussian is its FWHM
+        p[P_BG] = bg;
+        p[P_AMP] = m_val[R * SIZE + R] - bg;
+        if (p[P_AMP] <= 0.)
+            return false;
+
+        double chi2 = Chi2(p);
+        double lambda = 1e-3;
+        bool converged = false;
+
+        for (int iter = 0; iter < MAX_ITERATIONS && !converged; iter++)
+        {
+            double jtj[NPAR][NPAR], jtr[NPAR];
+            NormalEquations(p, jtj, jtr);
+
+            for (;;)
+            {
+                double a[NPAR][NPAR], step[NPAR];
+                for (int i = 0; i < NPAR; i++)
+                {
+                    for (int k = 0; k < NPAR; k++)
+                        a[i][k] = jtj[i][k];
+                    a[i][i] *= 1. + lambda;
+                    step[i] = jtr[i];
+                }
+
+                double pn[NPAR];
+                bool ok = Solve(a, step);
+                if (ok)
+                {
+                    for (int i = 0; i < NPAR; i++)
+                        pn[i] = p[i] + step[i];
+                    ok = pn[P_SIGMA] > 0.2 && pn[P_AMP] > 0.;
+                }
+
+                double const chi2n = ok ? Chi2(pn) : 0.;
+                if (ok && chi2n <= chi2)
+                {
+                    converged = fabs(step[P_X]) < 1e-4 && fabs(step[P_Y]) < 1e-4;
+                    std::copy(pn, pn + NPAR, p);
+                    chi2 = chi2n;
+                    lambda = std::max(lambda * 0.1, 1e-7);
+                    break;
+                }
+
+                lambda *= 10.;
+                if (lambda > 1e7)
+                {
+                    // no step reduces chi^2: p is at the minimum
+                    converged = true;
+                    break;
+                }
+            }
+        }
+
+        // the fit must stay near the centroid and describe a star that
+        // fits in the stamp
+        if (!converged || fabs(p[P_X] - (*x - m_cx)) > 1. || fabs(p[P_Y] - (*y - m_cy)) > 1. || p[P_SIGMA] > R)
+            return false;
+
+        *x = m_cx + p[P_X];
+        *y = m_cy + p[P_Y];
+        return true;
+    }
+};
+
+// refine the centroid (x, y) of a star by fitting its profile; the stamp is
+// chosen to cover the star, and stars too large for the largest stamp keep
+// their centroid, which is accurate for well-sampled stars anyway
+static bool PsfFit(const ImageView& view, double *x, double *y, double bg, double hfd, unsigned int clipADU)
+{
+    int const cx = ROUND(*x);
+    int const cy = ROUND(*y);
+
+    if (hfd <= 2.5)
+        return PsfFitter<3>(view, cx, cy, clipADU).Fit(x, y, bg, hfd);
+    if (hfd <= 4.0)
+        return PsfFitter<5>(view, cx, cy, clipADU).Fit(x, y, bg, hfd);
+    if (hfd <= 6.0)
+        return PsfFitter<7>(view, cx, cy, clipADU).Fit(x, y, bg, hfd);
+    return false;
 }
 
 bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, FindMode mode, double minHFD, double maxHFD, unsigned short maxADU, StarFindLogType loggingControl)
@@ -135,21 +338,13 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
             Debug.Write(wxString::Format("Star::Find(%d, %d, %d, %d, (%d,%d,%d,%d), %.1f, %0.1f, %hu) frame %u\n", searchRegion, base_x, base_y, mode,
             pImg->Subframe.x, pImg->Subframe.y, pImg->Subframe.width, pImg->Subframe.height, minHFD, maxHFD, maxADU, pImg->FrameNum));
 
-        int minx, miny, maxx, maxy;
+        // the subframe (or full frame), read in place
+        ImageView const view = pImg->View();
 
-        if (pImg->Subframe.IsEmpty())
-        {
-            minx = miny = 0;
-            maxx = pImg->Size.GetWidth() - 1;
-            maxy = pImg->Size.GetHeight() - 1;
-        }
-        else
-        {
-            minx = pImg->Subframe.GetLeft();
-            maxx = pImg->Subframe.GetRight();
-            miny = pImg->Subframe.GetTop();
-            maxy = pImg->Subframe.GetBottom();
-        }
+        int const minx = view.rect.GetLeft();
+        int const maxx = view.rect.GetRight();
+        int const miny = view.rect.GetTop();
+        int const maxy = view.rect.GetBottom();
 
         // search region bounds
         int start_x = wxMax(base_x - searchRegion, minx);
@@ -162,8 +357,8 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
             throw ERROR_INFO("coordinates are invalid");
         }
 
-        const unsigned short *imgdata = pImg->ImageData;
-        int rowsize = pImg->Size.GetWidth();
+        const unsigned short *imgdata = view.base;
+        int rowsize = view.stride;
 
         int peak_x = 0, peak_y = 0;
         unsigned int peak_val = 0;
@@ -193,35 +388,19 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
             // find the peak value within the search region using a smoothing function
             // also check for saturation
 
-            for (int y = start_y + 1; y <= end_y - 1; y++)
-            {
-                for (int x = start_x + 1; x <= end_x - 1; x++)
-                {
-                    unsigned short p = imgdata[y * rowsize + x];
-                    unsigned int val =
-                        4 * (unsigned int) p +
-                        imgdata[(y - 1) * rowsize + (x - 1)] +
-                        imgdata[(y - 1) * rowsize + (x + 1)] +
-                        imgdata[(y + 1) * rowsize + (x - 1)] +
-                        imgdata[(y + 1) * rowsize + (x + 1)] +
-                        2 * imgdata[(y - 1) * rowsize + (x + 0)] +
-                        2 * imgdata[(y + 0) * rowsize + (x - 1)] +
-                        2 * imgdata[(y + 0) * rowsize + (x + 1)] +
-                        2 * imgdata[(y + 1) * rowsize + (x + 0)];
+            int const n = end_x - start_x - 1;
+            const unsigned short *row = imgdata + rowsize * (start_y + 1) + start_x + 1;
 
-                    if (val > peak_val)
-                    {
-                        peak_val = val;
-                        peak_x = x;
-                        peak_y = y;
-                    }
+            for (int y = start_y + 1; y <= end_y - 1; y++, row += rowsize)
+            {
+                int idx;
+                unsigned int val = SmoothedPeakRow(row - rowsize, row, row + rowsize, n, &idx, max3);
 
-                    if (p > max3[0])
-                        std::swap(p, max3[0]);
-                    if (p > max3[1])
-                        std::swap(p, max3[1]);
-                    if (p > max3[2])
-                        std::swap(p, max3[2]);
+                if (val > peak_val)
+                {
+                    peak_val = val;
+                    peak_x = start_x + 1 + idx;
+                    peak_y = y;
                 }
             }
 
@@ -306,7 +485,8 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         double mass = 0.0;
         unsigned int n;
 
-        std::vector<R2M> hfrvec;
+        // every pixel within the aperture, at most
+        R2M hfrvec[(2 * A + 1) * (2 * A + 1)];
 
         if (mode == FIND_PEAK)
         {
@@ -355,7 +535,10 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
                     mass += d;
                     ++n;
 
-                    hfrvec.push_back(R2M(x, y, d));
+                    R2M& rm = hfrvec[n - 1];
+                    rm.x = x;
+                    rm.y = y;
+                    rm.m = d;
                 }
             }
         }
@@ -394,7 +577,7 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
         newX = peak_x + cx / mass;
         newY = peak_y + cy / mass;
 
-        HFD = 2.0 * hfr(hfrvec, newX, newY, mass);
+        HFD = 2.0 * HalfFluxRadius(hfrvec, n, newX, newY, mass);
         // Check for constraints on HFD value
         if (mode != FIND_PEAK)
         {
@@ -410,6 +593,20 @@ bool Star::Find(const usImage *pImg, int searchRegion, int base_x, int base_y, F
             }
         }
 
+        if (mode == FIND_PSF_FIT)
+        {
+            // leave saturated pixels out of the fit
+            unsigned int const clipADU = maxADU > 0 ? (unsigned int) maxADU + pImg->Pedestal : UINT_MAX;
+            double fx = newX, fy = newY;
+            if (PsfFit(view, &fx, &fy, mean_bg, HFD, clipADU))
+            {
+                newX = fx;
+                newY = fy;
+            }
+            else if (loggingControl == FIND_LOGGING_VERBOSE)
+                Debug.Write("Star::Find: PSF fit failed, using centroid\n");
+        }
+
         // check for saturation
 
         unsigned int mx = (unsigned int) max3[0];
@@ -492,43 +689,86 @@ struct FloatImg
     FloatImg(const wxSize& size) : px(0) { Init(size); }
     FloatImg(const usImage& img) : px(0) {
         Init(img.Size);
-        for (unsigned int i = 0; i < NPixels; i++)
-            px[i] = (float) img.ImageData[i];
+        int const width = Size.GetWidth();
+        int const height = Size.GetHeight();
+        ThreadPool::ParallelForRows(height, ThreadPool::RowBands(height, 64), [&](int, int y0, int y1) {
+            for (unsigned int i = y0 * width; i < (unsigned int)(y1 * width); i++)
+                px[i] = (float) img.ImageData[i];
+        });
     }
     ~FloatImg() { delete[] px; }
     void Init(const wxSize& sz) { delete[] px;  Size = sz; NPixels = Size.GetWidth() * Size.GetHeight(); px = new float[NPixels]; }
     void Swap(FloatImg& other) { std::swap(px, other.px); std::swap(Size, other.Size); std::swap(NPixels, other.NPixels); }
 };
 
-static void GetStats(double *mean, double *stdev, const FloatImg& img, const wxRect& win)
+// running mean and variance (Welford)
+struct RunningStats
 {
-    // Determine the mean and standard deviation
-    double sum = 0.0;
-    double a = 0.0;
-    double q = 0.0;
-    double k = 1.0;
-    double km1 = 0.0;
-
-    const int width = img.Size.GetWidth();
-    const float *p0 = &img.px[win.GetTop() * width + win.GetLeft()];
-    for (int y = 0; y < win.GetHeight(); y++)
+    double n;
+    double sum;
+    double a;   // mean
+    double q;   // sum of squared deviations from the mean
+
+    RunningStats() : n(0.0), sum(0.0), a(0.0), q(0.0) { }
+
+    void Add(const FloatImg& img, const wxRect& win)
     {
-        const float *end = p0 + win.GetWidth();
-        for (const float *p = p0; p < end; p++)
+        const int width = img.Size.GetWidth();
+        const float *p0 = &img.px[win.GetTop() * width + win.GetLeft()];
+        for (int y = 0; y < win.GetHeight(); y++)
         {
-            double const x = (double) *p;
-            sum += x;
-            double const a0 = a;
-            a += (x - a) / k;
-            q += (x - a0) * (x - a);
-            km1 = k;
-            k += 1.0;
+            const float *end = p0 + win.GetWidth();
+            for (const float *p = p0; p < end; p++)
+            {
+                double const x = (double) *p;
+                sum += x;
+                n += 1.0;
+                double const a0 = a;
+                a += (x - a) / n;
+                q += (x - a0) * (x - a);
+            }
+            p0 += width;
         }
-        p0 += width;
     }
 
-    *mean = sum / km1;
-    *stdev = sqrt(q / km1);
+    // combine with the statistics of another set of samples (Chan et al.)
+    void Merge(const RunningStats& other)
+    {
+        if (other.n == 0.0)
+            return;
+        double const total = n + other.n;
+        double const delta = other.a - a;
+        a += delta * other.n / total;
+        q += other.q + delta * delta * n * other.n / total;
+        sum += other.sum;
+        n = total;
+    }
+};
+
+static void GetStats(double *mean, double *stdev, const FloatImg& img, const wxRect& win)
+{
+    // Determine the mean and standard deviation
+    RunningStats stats;
+
+    enum { MIN_BAND_ROWS = 64 };
+    int const nbands = ThreadPool::RowBands(win.GetHeight(), MIN_BAND_ROWS);
+
+    if (nbands == 1)
+        stats.Add(img, win);
+    else
+    {
+        // large windows are split into bands of rows and the partial
+        // statistics combined
+        std::vector<RunningStats> bands(nbands);
+        ThreadPool::ParallelForRows(win.GetHeight(), nbands, [&](int band, int y0, int y1) {
+            bands[band].Add(img, wxRect(win.GetLeft(), win.GetTop() + y0, win.GetWidth(), y1 - y0));
+        });
+        for (int i = 0; i < nbands; i++)
+            stats.Merge(bands[i]);
+    }
+
+    *mean = stats.sum / stats.n;
+    *stdev = sqrt(stats.q / stats.n);
 }
 
 // un-comment to save the intermediate autofind image
@@ -559,87 +799,94 @@ static void SaveImage(const FloatImg& img, const char *name)
 #endif // SAVE_AUTOFIND_IMG
 }
 
+struct PsfKernel
+{
+    float w[5][5];  // weight at horizontal distance a, vertical distance b
+
+    PsfKernel()
+    {
+        //                       A      B1     B2    C1     C2    C3     D1     D2     D3
+        const double PSF[] = { 0.906, 0.584, 0.365, .117, .049, -0.05, -.064, -.074, -.094 };
+
+        /* PSF Grid is:
+        D3 D3 D3 D3 D3 D3 D3 D3 D3
+        D3 D3 D3 D2 D1 D2 D3 D3 D3
+        D3 D3 C3 C2 C1 C2 C3 D3 D3
+        D3 D2 C2 B2 B1 B2 C2 D2 D3
+        D3 D1 C1 B1 A  B1 C1 D1 D3
+        D3 D2 C2 B2 B1 B2 C2 D2 D3
+        D3 D3 C3 C2 C1 C2 C3 D3 D3
+        D3 D3 D3 D2 D1 D2 D3 D3 D3
+        D3 D3 D3 D3 D3 D3 D3 D3 D3
+
+        1@A
+        4@B1, B2, C1, C3, D1
+        8@C2, D2
+        44 * D3
+        */
+
+        // index into PSF[] by horizontal and vertical distance from the center
+        static const int grid[5][5] = {
+            { 0, 1, 3, 6, 8 },
+            { 1, 2, 4, 7, 8 },
+            { 3, 4, 5, 8, 8 },
+            { 6, 7, 8, 8, 8 },
+            { 8, 8, 8, 8, 8 },
+        };
+
+        // The fit is sum_k PSF[k] * (S_k - n_k * mean) with mean the average of
+        // all 81 pixels, so every pixel also carries a weight of
+        // -sum_k PSF[k] * n_k / 81 through the mean
+        double c = 0.0;
+        for (int a = -4; a <= 4; a++)
+            for (int b = -4; b <= 4; b++)
+                c += PSF[grid[abs(a)][abs(b)]];
+        c /= 81.0;
+
+        for (int a = 0; a < 5; a++)
+            for (int b = 0; b < 5; b++)
+                w[a][b] = (float)(PSF[grid[a][b]] - c);
+    }
+};
+
 static void psf_conv(FloatImg& dst, const FloatImg& src)
 {
     dst.Init(src.Size);
 
-    //                       A      B1     B2    C1     C2    C3     D1     D2     D3
-    const double PSF[] = { 0.906, 0.584, 0.365, .117, .049, -0.05, -.064, -.074, -.094 };
+    static const PsfKernel s_psf;
 
     int const width = src.Size.GetWidth();
     int const height = src.Size.GetHeight();
 
     memset(dst.px, 0, src.NPixels * sizeof(float));
 
-    /* PSF Grid is:
-    D3 D3 D3 D3 D3 D3 D3 D3 D3
-    D3 D3 D3 D2 D1 D2 D3 D3 D3
-    D3 D3 C3 C2 C1 C2 C3 D3 D3
-    D3 D2 C2 B2 B1 B2 C2 D2 D3
-    D3 D1 C1 B1 A  B1 C1 D1 D3
-    D3 D2 C2 B2 B1 B2 C2 D2 D3
-    D3 D3 C3 C2 C1 C2 C3 D3 D3
-    D3 D3 D3 D2 D1 D2 D3 D3 D3
-    D3 D3 D3 D3 D3 D3 D3 D3 D3
-
-    1@A
-    4@B1, B2, C1, C3, D1
-    8@C2, D2
-    44 * D3
-    */
-
     int psf_size = 4;
 
-    for (int y = psf_size; y < height - psf_size; y++)
-    {
-        for (int x = psf_size; x < width - psf_size; x++)
+    if (width <= 2 * psf_size || height <= 2 * psf_size)
+        return;
+
+    // the convolution is linear, so it is done as a single 9x9 kernel, one
+    // band of rows per work item
+    int const rows = height - 2 * psf_size;
+    enum { MIN_BAND_ROWS = 32 };
+
+    ThreadPool::ParallelForRows(rows, ThreadPool::RowBands(rows, MIN_BAND_ROWS), [&](int, int y0, int y1) {
+        y0 += psf_size;
+        y1 += psf_size;
+
+        std::vector<float> buf(5 * width);
+        float *const scratch[5] = { &buf[0], &buf[width], &buf[2 * width], &buf[3 * width], &buf[4 * width] };
+
+        for (int y = y0; y < y1; y++)
         {
-            float A, B1, B2, C1, C2, C3, D1, D2, D3;
-
-#define PX(dx, dy) *(src.px + width * (y + (dy)) + x + (dx))
-            A =  PX(+0, +0);
-            B1 = PX(+0, -1) + PX(+0, +1) + PX(+1, +0) + PX(-1, +0);
-            B2 = PX(-1, -1) + PX(+1, -1) + PX(-1, +1) + PX(+1, +1);
-            C1 = PX(+0, -2) + PX(-2, +0) + PX(+2, +0) + PX(+0, +2);
-            C2 = PX(-1, -2) + PX(+1, -2) + PX(-2, -1) + PX(+2, -1) + PX(-2, +1) + PX(+2, +1) + PX(-1, +2) + PX(+1, +2);
-            C3 = PX(-2, -2) + PX(+2, -2) + PX(-2, +2) + PX(+2, +2);
-            D1 = PX(+0, -3) + PX(-3, +0) + PX(+3, +0) + PX(+0, +3);
-            D2 = PX(-1, -3) + PX(+1, -3) + PX(-3, -1) + PX(+3, -1) + PX(-3, +1) + PX(+3, +1) + PX(-1, +3) + PX(+1, +3);
-            D3 = PX(-4, -2) + PX(-3, -2) + PX(+3, -2) + PX(+4, -2) + PX(-4, -1) + PX(+4, -1) + PX(-4, +0) + PX(+4, +0) + PX(-4, +1) + PX(+4, +1) + PX(-4, +2) + PX(-3, +2) + PX(+3, +2) + PX(+4, +2);
-#undef PX
-            int i;
-            const float *uptr;
-
-            uptr = src.px + width * (y - 4) + (x - 4);
-            for (i = 0; i < 9; i++)
-                D3 += *uptr++;
-
-            uptr = src.px + width * (y - 3) + (x - 4);
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
-            uptr += 3;
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
-
-            uptr = src.px + width * (y + 3) + (x - 4);
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
-            uptr += 3;
-            for (i = 0; i < 3; i++)
-                D3 += *uptr++;
-
-            uptr = src.px + width * (y + 4) + (x - 4);
-            for (i = 0; i < 9; i++)
-                D3 += *uptr++;
-
-            double mean = (A + B1 + B2 + C1 + C2 + C3 + D1 + D2 + D3) / 81.0;
-            double PSF_fit = PSF[0] * (A - mean) + PSF[1] * (B1 - 4.0 * mean) + PSF[2] * (B2 - 4.0 * mean) +
-                PSF[3] * (C1 - 4.0 * mean) + PSF[4] * (C2 - 8.0 * mean) + PSF[5] * (C3 - 4.0 * mean) +
-                PSF[6] * (D1 - 4.0 * mean) + PSF[7] * (D2 - 8.0 * mean) + PSF[8] * (D3 - 44.0 * mean);
-
-            dst.px[width * y + x] = (float) PSF_fit;
+            const float *const r[9] = {
+                src.px + width * (y - 4), src.px + width * (y - 3), src.px + width * (y - 2),
+                src.px + width * (y - 1), src.px + width * y, src.px + width * (y + 1),
+                src.px + width * (y + 2), src.px + width * (y + 3), src.px + width * (y + 4),
+            };
+            SymConv9Row(dst.px + width * y, r, s_psf.w, scratch, width);
         }
-    }
+    });
 }
 
 static void Downsample(FloatImg& dst, const FloatImg& src, int downsample)
@@ -652,18 +899,79 @@ static void Downsample(FloatImg& dst, const FloatImg& src, int downsample)
 
     float const d2 = downsample * downsample;
 
-    for (int yy = 0; yy < dh; yy++)
-    {
-        for (int xx = 0; xx < dw; xx++)
+    ThreadPool::ParallelForRows(dh, ThreadPool::RowBands(dh, 32), [&](int, int y0, int y1) {
+        for (int yy = y0; yy < y1; yy++)
         {
-            float sum = 0.0;
-            for (int j = 0; j < downsample; j++)
-                for (int i = 0; i < downsample; i++)
-                    sum += src.px[(yy * downsample + j) * width + xx * downsample + i];
-            float val = sum / d2;
-            dst.px[yy * dw + xx] = val;
+            for (int xx = 0; xx < dw; xx++)
+            {
+                float sum = 0.0;
+                for (int j = 0; j < downsample; j++)
+                    for (int i = 0; i < downsample; i++)
+                        sum += src.px[(yy * downsample + j) * width + xx * downsample + i];
+                float val = sum / d2;
+                dst.px[yy * dw + xx] = val;
+            }
         }
+    });
+}
+
+// Levels of the detection image pyramid: the smallest level with at most
+// PYRAMID_MAX_PIXELS pixels is used, but no coarser than 8x so that typical
+// guide stars still cover a pixel or so
+enum { PYRAMID_MAX_PIXELS = 4 * 1024 * 1024, PYRAMID_MAX_LEVEL = 3 };
+
+static int PyramidLevelFor(const wxSize& size)
+{
+    double npix = (double) size.GetWidth() * size.GetHeight();
+    int level = 0;
+    while (level < PYRAMID_MAX_LEVEL && npix > PYRAMID_MAX_PIXELS)
+    {
+        npix /= 4.0;
+        ++level;
     }
+    return level;
+}
+
+// One 2x reduction step of the detection image pyramid. Each output pixel is
+// the mean of the middle two values of the 2x2 block it covers, so a single
+// hot pixel in a block is rejected, while a star, which covers several
+// pixels, is kept. Only blocks entirely within *rect are computed, the rest
+// of the output is zero; *rect is updated to the computed region.
+template<typename T>
+static void PyramidReduce(FloatImg& dst, const T *src, const wxSize& size, wxRect *rect)
+{
+    dst.Init(wxSize(size.GetWidth() / 2, size.GetHeight() / 2));
+
+    int const x0 = (rect->GetLeft() + 1) / 2;
+    int const y0 = (rect->GetTop() + 1) / 2;
+    int const x1 = std::min((rect->GetRight() + 1) / 2, dst.Size.GetWidth());
+    int const y1 = std::min((rect->GetBottom() + 1) / 2, dst.Size.GetHeight());
+    wxRect const out(x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0));
+
+    if (out != wxRect(dst.Size))
+        memset(dst.px, 0, dst.NPixels * sizeof(float));
+
+    int const sw = size.GetWidth();
+    int const dw = dst.Size.GetWidth();
+
+    ThreadPool::ParallelForRows(out.height, ThreadPool::RowBands(out.height, 32), [&](int, int r0, int r1) {
+        for (int y = y0 + r0; y < y0 + r1; y++)
+        {
+            const T *s0 = src + 2 * y * sw;
+            const T *s1 = s0 + sw;
+            float *d = dst.px + y * dw;
+            for (int x = x0; x < x1; x++)
+            {
+                float const a = (float) s0[2 * x], b = (float) s0[2 * x + 1];
+                float const c = (float) s1[2 * x], e = (float) s1[2 * x + 1];
+                float const lo = std::min(std::min(a, b), std::min(c, e));
+                float const hi = std::max(std::max(a, b), std::max(c, e));
+                d[x] = (a + b + c + e - lo - hi) * 0.5f;
+            }
+        }
+    });
+
+    *rect = out;
 }
 
 struct Peak
@@ -677,28 +985,61 @@ struct Peak
     bool operator<(const Peak& rhs) const { return val < rhs.val; }
 };
 
-static void RemoveItems(std::set<Peak>& stars, const std::set<int>& to_erase)
+static void RemoveItems(std::vector<Peak>& stars, const std::vector<bool>& to_erase)
 {
-    int n = 0;
-    for (std::set<Peak>::iterator it = stars.begin(); it != stars.end(); n++)
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < stars.size(); i++)
+        if (!to_erase[i])
+            stars[n++] = stars[i];
+    stars.resize(n);
+}
+
+// Buckets points into square cells, so that the points within one cell
+// size of a location are found by looking at the 3x3 cells around it
+// instead of at every point
+class PointGrid
+{
+    int m_cell;
+    int m_cols;
+    int m_rows;
+    std::vector<int> m_head;    // last point added to each cell, -1 if none
+    std::vector<int> m_next;    // point added to the same cell before this one
+
+    int CellX(int x) const { return std::min(std::max(x / m_cell, 0), m_cols - 1); }
+    int CellY(int y) const { return std::min(std::max(y / m_cell, 0), m_rows - 1); }
+
+public:
+    PointGrid(const wxSize& size, int cell)
+        : m_cell(cell), m_cols(size.GetWidth() / cell + 1), m_rows(size.GetHeight() / cell + 1), m_head(m_cols * m_rows, -1) { }
+
+    // points are numbered in the order they are added
+    void Add(int x, int y)
     {
-        if (to_erase.find(n) != to_erase.end())
-        {
-            std::set<Peak>::iterator next = it;
-            ++next;
-            stars.erase(it);
-            it = next;
-        }
-        else
-            ++it;
+        int const c = CellY(y) * m_cols + CellX(x);
+        m_next.push_back(m_head[c]);
+        m_head[c] = m_next.size() - 1;
     }
-}
+
+    // call fn(n) for each point n that may be closer than the cell size to (x, y)
+    template<typename F>
+    void ForEachNear(int x, int y, F fn) const
+    {
+        int const cx = CellX(x);
+        int const cy = CellY(y);
+        for (int j = std::max(cy - 1, 0); j <= std::min(cy + 1, m_rows - 1); j++)
+            for (int i = std::max(cx - 1, 0); i <= std::min(cx + 1, m_cols - 1); i++)
+                for (int n = m_head[j * m_cols + i]; n != -1; n = m_next[n])
+                    fn(n);
+    }
+};
+
+// minimum separation between stars for purposes of detecting duplicates and improving spacial sampling
+enum { MIN_STAR_SEPARATION = 25 };
 
 static bool CloseToReference(const GuideStar& referencePoint, const GuideStar& other)
 {
-    // test whether star is close to the reference star for purposes of detecting duplicates and improving spacial sampling
-    const double minSeparation = 25.0;
-    return other.Distance(referencePoint) < minSeparation;
+    // test whether star is close to the reference star
+    return other.Distance(referencePoint) < MIN_STAR_SEPARATION;
 }
 
 // Multi-star version of AutoFind.
@@ -713,41 +1054,40 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
 
     wxBusyCursor busy;
 
+    // per-stage timings for the debug log
+    wxStopWatch swatch;
+    long lastLap = 0;
+    auto lap = [&swatch, &lastLap]() { long t = swatch.Time(); long d = t - lastLap; lastLap = t; return d; };
+
     Debug.Write(wxString::Format("Star::AutoFind called with edgeAllowance = %d "
         "searchRegion = %d roi = %dx%d@%d,%d\n",
         extraEdgeAllowance, searchRegion, roi.width, roi.height,
         roi.x, roi.y));
 
-    // run a 3x3 median first to eliminate hot pixels
-    usImage smoothed;
-    smoothed.CopyFrom(image);
+    wxRect filterRect(image.Size);
     if (!roi.IsEmpty())
     {
-        // set the subrame to the roi so that the Median3
-        // operation blanks pixels outside the ROI.
-        smoothed.Subframe = roi;
-        smoothed.Subframe.Intersect(wxRect(smoothed.Size));
+        // only filter the roi, pixels outside the ROI are left blank
+        filterRect = roi;
+        filterRect.Intersect(wxRect(image.Size));
 
         Debug.Write(wxString::Format("AutoFind: using ROI %dx%d@%d,%d\n",
-            smoothed.Subframe.width, smoothed.Subframe.height,
-            smoothed.Subframe.x, smoothed.Subframe.y));
+            filterRect.width, filterRect.height,
+            filterRect.x, filterRect.y));
 
-        if (smoothed.Subframe.width < searchRegion ||
-            smoothed.Subframe.height < searchRegion)
+        if (filterRect.width < searchRegion ||
+            filterRect.height < searchRegion)
         {
             Debug.Write(wxString::Format("AutoFind: bad ROI %dx%d\n",
-                smoothed.Subframe.width,
-                smoothed.Subframe.height));
+                filterRect.width,
+                filterRect.height));
             return false;
         }
     }
-    Median3(smoothed);
 
-    // convert to floating point
-    FloatImg conv(smoothed);
-
-    // downsample the source image
+    // choose the downsample factor
     int downsample = pFrame->pGuider->GetAutoSelDownsample();
+    int pyramidLevel = 0;
     if (downsample == 0 /* "Auto" */)
     {
         double const DOWNSAMPLE_SCALE_THRESH = 0.6;
@@ -759,14 +1099,65 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
             downsample = 2;
 
         Debug.Write(wxString::Format("AutoFind: auto downsample for scale %.2f => %dx\n", scale, downsample));
+
+        // On very large sensors, detect the candidates on a level of an image
+        // pyramid that is small enough to keep the cost of detection independent
+        // of the sensor size; Star::Find then measures each candidate at full
+        // resolution
+        int const level = PyramidLevelFor(filterRect.GetSize());
+        if (level > 0 && (1 << level) >= downsample)
+        {
+            pyramidLevel = level;
+            downsample = 1 << level;
+        }
     }
-    if (downsample > 1)
+
+    FloatImg conv;
+    long tMedian = 0, tConvert = 0;
+
+    if (pyramidLevel > 0)
     {
-        Debug.Write(wxString::Format("AutoFind: downsample %dx\n", downsample));
-        FloatImg tmp;
-        Downsample(tmp, conv, downsample);
-        conv.Swap(tmp);
+        Debug.Write(wxString::Format("AutoFind: %dx%d frame, detecting on pyramid level %d (%dx)\n",
+            filterRect.width, filterRect.height, pyramidLevel, downsample));
+
+        // the hot pixel rejection of the 2x2 reductions stands in for the 3x3 median
+        wxRect rect(filterRect);
+        PyramidReduce(conv, image.ImageData, image.Size, &rect);
+        for (int level = 2; level <= pyramidLevel; level++)
+        {
+            FloatImg tmp;
+            PyramidReduce(tmp, conv.px, conv.Size, &rect);
+            conv.Swap(tmp);
+        }
     }
+    else
+    {
+        // run a 3x3 median first to eliminate hot pixels
+        // the filter reads the source image in place, no need to copy it first
+        usImage smoothed;
+        smoothed.Init(image.Size);
+        if (filterRect != wxRect(image.Size))
+            smoothed.Clear();
+        Median3(smoothed.ImageData, image.View(filterRect));
+        tMedian = lap();
+
+        // convert to floating point
+        {
+            FloatImg tmp(smoothed);
+            conv.Swap(tmp);
+        }
+        tConvert = lap();
+
+        // downsample the source image
+        if (downsample > 1)
+        {
+            Debug.Write(wxString::Format("AutoFind: downsample %dx\n", downsample));
+            FloatImg tmp;
+            Downsample(tmp, conv, downsample);
+            conv.Swap(tmp);
+        }
+    }
+    long const tDownsample = lap();
 
     // run the PSF convolution
     {
@@ -774,6 +1165,7 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
         psf_conv(tmp, conv);
         conv.Swap(tmp);
     }
+    long const tConvolve = lap();
 
     enum { CONV_RADIUS = 4 };
     int dw = conv.Size.GetWidth();      // width of the downsampled image
@@ -783,10 +1175,10 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
     SaveImage(conv, "PHD2_AutoFind.fit");
 
     enum { TOP_N = 100 };  // keep track of the brightest stars
-    std::set<Peak> stars;  // sorted by ascending intensity
 
     double global_mean, global_stdev;
     GetStats(&global_mean, &global_stdev, conv, convRect);
+    long const tStats = lap();
 
     Debug.Write(wxString::Format("AutoFind: global mean = %.1f, stdev %.1f\n", global_mean, global_stdev));
 
@@ -794,115 +1186,191 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
     Debug.Write(wxString::Format("AutoFind: using threshold = %.1f\n", threshold));
 
     // find each local maximum
+    //
+    // A pixel is a local maximum when no pixel in the surrounding box is
+    // greater, that is when it equals the box maximum. The box maximum is
+    // separable, so the maxima along each row are computed first.
     int srch = 4;
-    for (int y = convRect.GetTop() + srch; y <= convRect.GetBottom() - srch; y++)
+    FloatImg rowmax(conv.Size);
     {
-        for (int x = convRect.GetLeft() + srch; x <= convRect.GetRight() - srch; x++)
+        int const x0 = convRect.GetLeft() + srch;
+        int const x1 = convRect.GetRight() - srch;
+        ThreadPool::ParallelForRows(convRect.GetHeight(), ThreadPool::RowBands(convRect.GetHeight(), 32), [&](int, int y0, int y1) {
+            for (int y = convRect.GetTop() + y0; y < convRect.GetTop() + y1; y++)
+            {
+                const float *row = conv.px + dw * y;
+                float *dst = rowmax.px + dw * y;
+                for (int x = x0; x <= x1; x++)
+                {
+                    float m = row[x - srch];
+                    for (int i = -srch + 1; i <= srch; i++)
+                        m = std::max(m, row[x + i]);
+                    dst[x] = m;
+                }
+            }
+        });
+    }
+
+    // Each band of rows keeps its TOP_N brightest candidates in a min-heap;
+    // the bands are merged once the search is done
+    int const searchTop = convRect.GetTop() + srch;
+    int const searchRows = std::max(convRect.GetHeight() - 2 * srch, 0);
+    int const nbands = ThreadPool::RowBands(searchRows, 32);
+    std::vector<std::vector<Peak>> bandPeaks(nbands);
+    auto heapCmp = [](const Peak& a, const Peak& b) { return b < a; };
+
+    ThreadPool::ParallelForRows(searchRows, nbands, [&](int band, int y0, int y1) {
+        std::vector<Peak>& heap = bandPeaks[band];
+
+        for (int y = searchTop + y0; y < searchTop + y1; y++)
         {
-            float val = conv.px[dw * y + x];
-            bool ismax = false;
-            if (val > 0.0)
+            for (int x = convRect.GetLeft() + srch; x <= convRect.GetRight() - srch; x++)
             {
-                ismax = true;
+                float val = conv.px[dw * y + x];
+                if (val <= 0.0)
+                    continue;
+
+                bool ismax = true;
                 for (int j = -srch; j <= srch; j++)
                 {
-                    for (int i = -srch; i <= srch; i++)
+                    if (rowmax.px[dw * (y + j) + x] > val)
                     {
-                        if (i == 0 && j == 0)
-                            continue;
-                        if (conv.px[dw * (y + j) + (x + i)] > val)
-                        {
-                            ismax = false;
-                            break;
-                        }
+                        ismax = false;
+                        break;
                     }
                 }
-            }
-            if (!ismax)
-                continue;
+                if (!ismax)
+                    continue;
 
-            // compare local maximum to mean value of surrounding pixels
-            const int local = 7;
-            double local_mean, local_stdev;
-            wxRect localRect(x - local, y - local, 2 * local + 1, 2 * local + 1);
-            localRect.Intersect(convRect);
-            GetStats(&local_mean, &local_stdev, conv, localRect);
+                // compare local maximum to mean value of surrounding pixels
+                const int local = 7;
+                double local_mean, local_stdev;
+                wxRect localRect(x - local, y - local, 2 * local + 1, 2 * local + 1);
+                localRect.Intersect(convRect);
+                GetStats(&local_mean, &local_stdev, conv, localRect);
 
-            // this is our measure of star intensity
-            double h = (val - local_mean) / global_stdev;
+                // this is our measure of star intensity
+                double h = (val - local_mean) / global_stdev;
 
-            if (h < threshold)
-            {
-                //  Debug.Write(wxString::Format("AG: local max REJECT [%d, %d] PSF %.1f SNR %.1f\n", imgx, imgy, val, SNR));
-                continue;
-            }
+                if (h < threshold)
+                {
+                    //  Debug.Write(wxString::Format("AG: local max REJECT [%d, %d] PSF %.1f SNR %.1f\n", imgx, imgy, val, SNR));
+                    continue;
+                }
+
+                // coordinates on the original image
+                int imgx = x * downsample + downsample / 2;
+                int imgy = y * downsample + downsample / 2;
 
-            // coordinates on the original image
-            int imgx = x * downsample + downsample / 2;
-            int imgy = y * downsample + downsample / 2;
+                Peak const peak(imgx, imgy, h);
+                if (heap.size() < TOP_N)
+                {
+                    heap.push_back(peak);
+                    std::push_heap(heap.begin(), heap.end(), heapCmp);
+                }
+                else if (heap.front() < peak)
+                {
+                    std::pop_heap(heap.begin(), heap.end(), heapCmp);
+                    heap.back() = peak;
+                    std::push_heap(heap.begin(), heap.end(), heapCmp);
+                }
+            }
+        }
+    });
 
-            stars.insert(Peak(imgx, imgy, h));
-            if (stars.size() > TOP_N)
-                stars.erase(stars.begin());
+    // Merge the bands, taking the candidates in scan order as the serial search
+    // did, so that ties in intensity are resolved the same way
+    std::vector<Peak> stars;  // sorted by ascending intensity
+    {
+        std::vector<Peak> candidates;
+        for (int i = 0; i < nbands; i++)
+            candidates.insert(candidates.end(), bandPeaks[i].begin(), bandPeaks[i].end());
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Peak& a, const Peak& b) { return a.y < b.y || (a.y == b.y && a.x < b.x); });
+
+        std::set<Peak> top;
+        for (auto it = candidates.begin(); it != candidates.end(); ++it)
+        {
+            top.insert(*it);
+            if (top.size() > TOP_N)
+                top.erase(top.begin());
         }
+        stars.assign(top.begin(), top.end());
     }
+    long const tPeaks = lap();
 
-    for (std::set<Peak>::const_reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
+    for (std::vector<Peak>::const_reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
         Debug.Write(wxString::Format("AutoFind: local max [%d, %d] %.1f\n", it->x, it->y, it->val));
 
     // merge stars that are very close into a single star
     {
-        const int minlimitsq = 5 * 5;
-    repeat:
-        for (std::set<Peak>::const_iterator a = stars.begin(); a != stars.end(); ++a)
+        // a star is erased when there is a brighter one very close to it.
+        // Stars are in order of ascending intensity, so the brighter ones
+        // are those with a higher index
+        const int minlimit = 5;
+        const int minlimitsq = minlimit * minlimit;
+        PointGrid grid(image.Size, minlimit);
+        for (auto it = stars.begin(); it != stars.end(); ++it)
+            grid.Add(it->x, it->y);
+
+        std::vector<bool> to_erase(stars.size());
+        for (int a = 0; a < (int) stars.size(); a++)
         {
-            std::set<Peak>::const_iterator b = a;
-            ++b;
-            for (; b != stars.end(); ++b)
+            int b = -1;
+            grid.ForEachNear(stars[a].x, stars[a].y, [&](int n) {
+                if (n <= a || (b != -1 && n > b))
+                    return;
+                int dx = stars[a].x - stars[n].x;
+                int dy = stars[a].y - stars[n].y;
+                if (dx * dx + dy * dy < minlimitsq)
+                    b = n;
+            });
+            if (b != -1)
             {
-                int dx = a->x - b->x;
-                int dy = a->y - b->y;
-                int d2 = dx * dx + dy * dy;
-                if (d2 < minlimitsq)
-                {
-                    // very close, treat as single star
-                    Debug.Write(wxString::Format("AutoFind: merge [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
-                    // erase the dimmer one
-                    stars.erase(a);
-                    goto repeat;
-                }
+                // very close, treat as single star
+                Debug.Write(wxString::Format("AutoFind: merge [%d, %d] %.1f - [%d, %d] %.1f\n", stars[a].x, stars[a].y, stars[a].val, stars[b].x, stars[b].y, stars[b].val));
+                // erase the dimmer one
+                to_erase[a] = true;
             }
         }
+        RemoveItems(stars, to_erase);
     }
 
     // exclude stars that would fit within a single searchRegion box
     {
         // build a list of stars to be excluded
-        std::set<int> to_erase;
         const int extra = 5; // extra safety margin
         const int fullw = searchRegion + extra;
-        for (std::set<Peak>::const_iterator a = stars.begin(); a != stars.end(); ++a)
+        PointGrid grid(image.Size, fullw + 1);
+        for (auto it = stars.begin(); it != stars.end(); ++it)
+            grid.Add(it->x, it->y);
+
+        std::vector<bool> to_erase(stars.size());
+        std::vector<int> neighbors;
+        for (int a = 0; a < (int) stars.size(); a++)
         {
-            std::set<Peak>::const_iterator b = a;
-            ++b;
-            for (; b != stars.end(); ++b)
+            neighbors.clear();
+            grid.ForEachNear(stars[a].x, stars[a].y, [&](int n) {
+                if (n > a && abs(stars[a].x - stars[n].x) <= fullw && abs(stars[a].y - stars[n].y) <= fullw)
+                    neighbors.push_back(n);
+            });
+            std::sort(neighbors.begin(), neighbors.end());
+
+            for (auto it = neighbors.begin(); it != neighbors.end(); ++it)
             {
-                int dx = abs(a->x - b->x);
-                int dy = abs(a->y - b->y);
-                if (dx <= fullw && dy <= fullw)
+                const Peak& pa = stars[a];
+                const Peak& pb = stars[*it];
+                // stars closer than search region, exclude them both
+                // but do not let a very dim star eliminate a very bright star
+                if (pb.val / pa.val >= 5.0)
                 {
-                    // stars closer than search region, exclude them both
-                    // but do not let a very dim star eliminate a very bright star
-                    if (b->val / a->val >= 5.0)
-                    {
-                        Debug.Write(wxString::Format("AutoFind: close dim-bright [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
-                    }
-                    else
-                    {
-                        Debug.Write(wxString::Format("AutoFind: too close [%d, %d] %.1f - [%d, %d] %.1f\n", a->x, a->y, a->val, b->x, b->y, b->val));
-                        to_erase.insert(std::distance(stars.begin(), a));
-                        to_erase.insert(std::distance(stars.begin(), b));
-                    }
+                    Debug.Write(wxString::Format("AutoFind: close dim-bright [%d, %d] %.1f - [%d, %d] %.1f\n", pa.x, pa.y, pa.val, pb.x, pb.y, pb.val));
+                }
+                else
+                {
+                    Debug.Write(wxString::Format("AutoFind: too close [%d, %d] %.1f - [%d, %d] %.1f\n", pa.x, pa.y, pa.val, pb.x, pb.y, pb.val));
+                    to_erase[a] = true;
+                    to_erase[*it] = true;
                 }
             }
         }
@@ -913,20 +1381,23 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
     {
         int edgeDist = searchRegion + extraEdgeAllowance;
 
-        std::set<Peak>::iterator it = stars.begin();
-        while (it != stars.end())
+        std::vector<bool> to_erase(stars.size());
+        for (unsigned int i = 0; i < stars.size(); i++)
         {
-            std::set<Peak>::iterator next = it;
-            ++next;
-            if (it->x <= edgeDist || it->x >= image.Size.GetWidth() - edgeDist ||
-                it->y <= edgeDist || it->y >= image.Size.GetHeight() - edgeDist)
+            const Peak& pk = stars[i];
+            if (pk.x <= edgeDist || pk.x >= image.Size.GetWidth() - edgeDist ||
+                pk.y <= edgeDist || pk.y >= image.Size.GetHeight() - edgeDist)
             {
-                Debug.Write(wxString::Format("AutoFind: too close to edge [%d, %d] %.1f\n", it->x, it->y, it->val));
-                stars.erase(it);
+                Debug.Write(wxString::Format("AutoFind: too close to edge [%d, %d] %.1f\n", pk.x, pk.y, pk.val));
+                to_erase[i] = true;
             }
-            it = next;
         }
+        RemoveItems(stars, to_erase);
     }
+    long const tPrune = lap();
+
+    Debug.Write(wxString::Format("AutoFind: times (ms) median %ld convert %ld downsample %ld psf %ld stats %ld peaks %ld prune %ld, %u threads\n",
+        tMedian, tConvert, tDownsample, tConvolve, tStats, tPeaks, tPrune, ThreadPool::Concurrency()));
 
     // At first I tried running Star::Find on the survivors to find the best
     // star. This had the unfortunate effect of locating hot pixels which
@@ -951,7 +1422,7 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
 
         // next see if any of the stars has a flat-top
         bool foundSaturated = false;
-        for (std::set<Peak>::reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
+        for (std::vector<Peak>::reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
         {
             Star tmp;
             tmp.Find(&image, searchRegion, it->x, it->y, FIND_CENTROID, pFrame->pGuider->GetMinStarHFD(), pFrame->pGuider->GetMaxStarHFD(), pCamera->GetSaturationADU(), FIND_LOGGING_VERBOSE);
@@ -1001,21 +1472,26 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
     double minSNR = pFrame->pGuider->GetAFMinStarSNR();
     double maxHFD = pFrame->pGuider->GetMaxStarHFD();
     foundStars.clear();
-    for (std::set<Peak>::reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
+    PointGrid foundGrid(image.Size, MIN_STAR_SEPARATION);
+    for (std::vector<Peak>::reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
     {
         GuideStar tmp;
         tmp.Find(&image, searchRegion, it->x, it->y, FIND_CENTROID, pFrame->pGuider->GetMinStarHFD(), maxHFD, pCamera->GetSaturationADU(), FIND_LOGGING_VERBOSE);
         // We're repeating the find, so we're vulnerable to hot pixels and creation of unwanted duplicates
         if (tmp.WasFound() && tmp.SNR >= minSNR)
         {
-            bool duplicate = std::find_if(foundStars.begin(), foundStars.end(),
-                [&tmp](const GuideStar& other) { return CloseToReference(tmp, other); }) != foundStars.end();
+            bool duplicate = false;
+            foundGrid.ForEachNear((int) tmp.X, (int) tmp.Y, [&](int n) {
+                if (CloseToReference(tmp, foundStars[n]))
+                    duplicate = true;
+            });
 
             if (!duplicate)
             {
                 tmp.referencePoint.X = tmp.X;
                 tmp.referencePoint.Y = tmp.Y;
                 foundStars.push_back(tmp);
+                foundGrid.Add((int) tmp.X, (int) tmp.Y);
             }
         }
     }
@@ -1030,7 +1506,7 @@ bool GuideStar::AutoFind(const usImage& image, int extraEdgeAllowance, int searc
     {
         Debug.Write(wxString::Format("AutoFind: finding best star pass %d\n", pass));
 
-        for (std::set<Peak>::reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
+        for (std::vector<Peak>::reverse_iterator it = stars.rbegin(); it != stars.rend(); ++it)
         {
             GuideStar tmp;
             tmp.Find(&image, searchRegion, it->x, it->y, FIND_CENTROID, pFrame->pGuider->GetMinStarHFD(), maxHFD, pCamera->GetSaturationADU(), FIND_LOGGING_VERBOSE);
@@ -47,6 +47,7 @@ public:
     {
         FIND_CENTROID,
         FIND_PEAK,
+        FIND_PSF_FIT,       // centroid refined by a fit of the star profile
     };
 
     enum FindResult
@@ -0,0 +1,171 @@
+/*
+ *  star_hfr.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "star_hfr.h"
+
+#include <algorithm>
+#include <cmath>
+
+// pixels at the same radius are taken in row-major order, the order in which
+// Star::Find collected them
+static bool RowMajorLess(const R2M& a, const R2M& b)
+{
+    return a.y < b.y || (a.y == b.y && a.x < b.x);
+}
+
+static bool RadiusLess(const R2M& a, const R2M& b)
+{
+    return a.r2 < b.r2 || (a.r2 == b.r2 && RowMajorLess(a, b));
+}
+
+// Half Flux Radius: the radius, interpolated between the pixels on either side,
+// at which the cumulative mass of the pixels taken in order of increasing
+// distance from (cx, cy) first exceeds half of the total mass.
+//
+// Instead of sorting the pixels by radius, a weighted quickselect partitions
+// them around a pivot radius and keeps only the side containing the half-mass
+// point, so the work is O(n) on average and done in place.
+double HalfFluxRadius(R2M *vec, unsigned int n, double cx, double cy, double mass)
+{
+    if (n == 1) // hot pixel?
+        return 0.25;
+
+    bool negative = false;
+    for (unsigned int i = 0; i < n; i++)
+    {
+        double dx = (double) vec[i].x - cx;
+        double dy = (double) vec[i].y - cy;
+        vec[i].r2 = dx * dx + dy * dy;
+        if (vec[i].m < 0.0)
+            negative = true;
+    }
+
+    double const halfm = 0.5 * mass;
+    double r20 = 0.0, r21 = 0.0, m0 = 0.0, m1 = 0.0;
+
+    if (negative)
+    {
+        // the cumulative mass is not monotonic, so the selection below does
+        // not apply; walk the pixels in sorted order
+        std::sort(vec, vec + n, RadiusLess);
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            r20 = r21;
+            m0 = m1;
+            r21 = vec[i].r2;
+            m1 += vec[i].m;
+            if (m1 > halfm)
+                break;
+        }
+    }
+    else
+    {
+        // vec[lo, hi) holds the pixels not yet ruled out; the ones ruled out
+        // below lo have total mass `before` and largest radius^2 `prevR2`
+        unsigned int lo = 0, hi = n;
+        double before = 0.0;
+        double prevR2 = 0.0;
+
+        while (lo < hi)
+        {
+            double const pivot = vec[lo + (hi - lo) / 2].r2;
+
+            // three-way partition: [lo, lt) < pivot, [lt, gt) == pivot, [gt, hi) > pivot
+            unsigned int lt = lo, i = lo, gt = hi;
+            double massLt = 0.0, massEq = 0.0, maxLt = prevR2;
+            while (i < gt)
+            {
+                double const r2 = vec[i].r2;
+                if (r2 < pivot)
+                {
+                    massLt += vec[i].m;
+                    if (r2 > maxLt)
+                        maxLt = r2;
+                    std::swap(vec[i++], vec[lt++]);
+                }
+                else if (r2 > pivot)
+                    std::swap(vec[i], vec[--gt]);
+                else
+                {
+                    massEq += vec[i].m;
+                    ++i;
+                }
+            }
+
+            if (lt > lo && before + massLt > halfm)
+            {
+                hi = lt;
+            }
+            else if (before + massLt + massEq > halfm || gt == hi)
+            {
+                // the half-mass point is among the pixels at the pivot radius;
+                // the partition scrambled them, so restore the order a sort
+                // would give before walking them
+                std::sort(vec + lt, vec + gt, RowMajorLess);
+
+                r21 = maxLt;
+                m1 = before + massLt;
+                for (i = lt; i < gt; i++)
+                {
+                    r20 = r21;
+                    m0 = m1;
+                    r21 = pivot;
+                    m1 += vec[i].m;
+                    if (m1 > halfm)
+                        break;
+                }
+                break;
+            }
+            else
+            {
+                before += massLt + massEq;
+                prevR2 = pivot;
+                lo = gt;
+            }
+        }
+    }
+
+    // interpolate
+    double hfr;
+    if (m1 > m0)
+    {
+        double r0 = sqrt(r20), r1 = sqrt(r21);
+        double s = (r1 - r0) / (m1 - m0);
+        hfr = r0 + s * (halfm - m0);
+    }
+    else
+        hfr = 0.25;
+
+    return hfr;
+}
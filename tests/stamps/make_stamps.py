@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+#
+# Writes the star stamps used by star_hfr_test.cpp: 31x31 16-bit FITS images
+# with the same layout PHD2 saves (BITPIX 16, BZERO 32768).
+#
+# Run from this directory: python3 make_stamps.py
+
+import math
+import random
+import struct
+
+W = H = 31
+
+
+def card(key, value=None, comment=''):
+    if value is None:
+        s = key
+    else:
+        v = ('T' if value else 'F') if isinstance(value, bool) else str(value)
+        s = '%-8s= %20s' % (key, v)
+        if comment:
+            s += ' / ' + comment
+    return s.ljust(80)[:80]
+
+
+def write_fits(name, pix):
+    hdr = [card('SIMPLE', True), card('BITPIX', 16), card('NAXIS', 2),
+           card('NAXIS1', W), card('NAXIS2', H),
+           card('BZERO', 32768), card('BSCALE', 1), card('END')]
+    h = ''.join(hdr)
+    h += ' ' * (-len(h) % 2880)
+    data = b''.join(struct.pack('>h', v - 32768) for v in pix)
+    data += b'\0' * (-len(data) % 2880)
+    with open(name, 'wb') as f:
+        f.write(h.encode('ascii'))
+        f.write(data)
+
+
+def star(rng, cx, cy, sigma, amp, bg, noise, sat=65535):
+    pix = []
+    for y in range(H):
+        for x in range(W):
+            v = bg + amp * math.exp(-((x - cx) ** 2 + (y - cy) ** 2) / (2 * sigma * sigma))
+            if noise:
+                v += rng.gauss(0, noise)
+            pix.append(max(0, min(sat, int(round(v)))))
+    return pix
+
+
+rng = random.Random(20261017)
+
+# ordinary stars: sub-pixel centroids, a range of sizes, brightness and noise
+for i in range(16):
+    cx = 15 + rng.uniform(-1.5, 1.5)
+    cy = 15 + rng.uniform(-1.5, 1.5)
+    sigma = rng.uniform(0.8, 3.0)
+    amp = rng.uniform(800, 20000)
+    noise = rng.uniform(5, 60)
+    write_fits('star%02d.fit' % i, star(rng, cx, cy, sigma, amp, 1000, noise))
+
+# noise-free stars centered on a pixel: many pixels share a radius
+write_fits('tie_centered.fit', star(rng, 15, 15, 1.6, 9000, 1000, 0))
+write_fits('tie_halfpixel.fit', star(rng, 15.5, 15.5, 2.2, 6000, 500, 0))
+
+# saturated star: a flat top of equal pixels
+write_fits('tie_saturated.fit', star(rng, 15, 15, 2.5, 90000, 1200, 0, sat=40000))
+
+# faint stars in heavy noise: pixels below the background give negative mass
+for i in range(4):
+    cx = 15 + rng.uniform(-1, 1)
+    cy = 15 + rng.uniform(-1, 1)
+    write_fits('faint%02d.fit' % i, star(rng, cx, cy, rng.uniform(1.2, 2.5), rng.uniform(150, 400), 1000, 60))
+
+# hot pixel
+hot = star(rng, 15, 15, 1.0, 0, 1000, 10)
+hot[15 * W + 15] = 30000
+write_fits('hotpixel.fit', hot)
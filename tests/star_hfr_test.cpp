@@ -0,0 +1,302 @@
+/*
+ *  star_hfr_test.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Compares HalfFluxRadius with the sort-based HFR computation it replaced,
+// on the star stamps in tests/stamps (see make_stamps.py there).
+
+#include "star_hfr.h"
+
+#include <gtest/gtest.h>
+#include <fitsio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Stamp
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned short> pixels;
+
+    unsigned short At(int x, int y) const { return pixels[y * width + x]; }
+};
+
+bool LoadStamp(const std::string& name, Stamp *stamp)
+{
+    std::string path = "stamps/" + name;
+    fitsfile *fptr;
+    int status = 0;
+    if (fits_open_diskfile(&fptr, path.c_str(), READONLY, &status))
+        return false;
+
+    long size[2];
+    int naxis;
+    fits_get_img_dim(fptr, &naxis, &status);
+    fits_get_img_size(fptr, 2, size, &status);
+    if (status || naxis != 2)
+    {
+        fits_close_file(fptr, &status);
+        return false;
+    }
+
+    stamp->width = (int) size[0];
+    stamp->height = (int) size[1];
+    stamp->pixels.resize(size[0] * size[1]);
+    long fpixel[2] = { 1, 1 };
+    fits_read_pix(fptr, TUSHORT, fpixel, size[0] * size[1], nullptr, &stamp->pixels[0], nullptr, &status);
+    fits_close_file(fptr, &status);
+    return status == 0;
+}
+
+// the aperture pixels of a stamp, collected as Star::Find does
+struct Aperture
+{
+    std::vector<R2M> pix;
+    double cx = 0.0;
+    double cy = 0.0;
+    double mass = 0.0;
+};
+
+enum
+{
+    A = 7,  // Star::Find aperture radius
+    B = 12, // outer radius of the background annulus
+};
+
+// With allPixels set, every pixel in the aperture is taken, including the
+// ones below the background, so some pixels have negative mass
+Aperture Collect(const Stamp& s, bool allPixels)
+{
+    int px = 0, py = 0;
+    for (int y = 0; y < s.height; y++)
+        for (int x = 0; x < s.width; x++)
+            if (s.At(x, y) > s.At(px, py))
+            {
+                px = x;
+                py = y;
+            }
+
+    double sum = 0.0, sum2 = 0.0;
+    unsigned int nbg = 0;
+    for (int y = 0; y < s.height; y++)
+        for (int x = 0; x < s.width; x++)
+        {
+            int r2 = (x - px) * (x - px) + (y - py) * (y - py);
+            if (r2 <= A * A || r2 > B * B)
+                continue;
+            double v = s.At(x, y);
+            sum += v;
+            sum2 += v * v;
+            ++nbg;
+        }
+    double const bg = sum / nbg;
+    double const sigma = sqrt(std::max(0.0, sum2 / nbg - bg * bg));
+    double const thresh = allPixels ? 0.0 : bg + 3.0 * sigma;
+
+    Aperture ap;
+    double cx = 0.0, cy = 0.0;
+    for (int y = std::max(py - A, 0); y <= std::min(py + A, s.height - 1); y++)
+        for (int x = std::max(px - A, 0); x <= std::min(px + A, s.width - 1); x++)
+        {
+            int dx = x - px, dy = y - py;
+            if (dx * dx + dy * dy > A * A || s.At(x, y) < thresh)
+                continue;
+            double const d = s.At(x, y) - bg;
+            cx += dx * d;
+            cy += dy * d;
+            ap.mass += d;
+            R2M rm;
+            rm.x = x;
+            rm.y = y;
+            rm.m = d;
+            ap.pix.push_back(rm);
+        }
+    ap.cx = px + cx / ap.mass;
+    ap.cy = py + cy / ap.mass;
+    return ap;
+}
+
+// The HFR computation before HalfFluxRadius: sort the pixels by radius and
+// walk them until half the mass is reached. std::sort left the order of
+// pixels at equal radii unspecified; the stable sort keeps them in collection
+// order, which is the order HalfFluxRadius uses.
+double SortedHfr(std::vector<R2M> vec, double cx, double cy, double mass)
+{
+    if (vec.size() == 1) // hot pixel?
+        return 0.25;
+
+    for (auto it = vec.begin(); it != vec.end(); ++it)
+    {
+        double dx = (double) it->x - cx;
+        double dy = (double) it->y - cy;
+        it->r2 = dx * dx + dy * dy;
+    }
+    std::stable_sort(vec.begin(), vec.end(), [](const R2M& a, const R2M& b) { return a.r2 < b.r2; });
+
+    double r20, r21, m0, m1;
+    r20 = r21 = m0 = m1 = 0.0;
+    double halfm = 0.5 * mass;
+    for (auto it = vec.begin(); it != vec.end(); ++it)
+    {
+        r20 = r21;
+        m0 = m1;
+        r21 = it->r2;
+        m1 += it->m;
+        if (m1 > halfm)
+            break;
+    }
+
+    double hfr;
+    if (m1 > m0)
+    {
+        double r0 = sqrt(r20), r1 = sqrt(r21);
+        double s = (r1 - r0) / (m1 - m0);
+        hfr = r0 + s * (halfm - m0);
+    }
+    else
+        hfr = 0.25;
+
+    return hfr;
+}
+
+double Hfd(std::vector<R2M> vec, double cx, double cy, double mass)
+{
+    return 2.0 * HalfFluxRadius(&vec[0], (unsigned int) vec.size(), cx, cy, mass);
+}
+
+double SortedHfd(const std::vector<R2M>& vec, double cx, double cy, double mass)
+{
+    return 2.0 * SortedHfr(vec, cx, cy, mass);
+}
+
+bool HasTies(std::vector<R2M> vec, double cx, double cy)
+{
+    std::vector<double> r2;
+    for (const R2M& rm : vec)
+        r2.push_back((rm.x - cx) * (rm.x - cx) + (rm.y - cy) * (rm.y - cy));
+    std::sort(r2.begin(), r2.end());
+    return std::adjacent_find(r2.begin(), r2.end()) != r2.end();
+}
+
+const double MaxHfdError = 0.01; // pixels
+
+const char *const StarStamps[] = {
+    "star00.fit", "star01.fit", "star02.fit", "star03.fit", "star04.fit", "star05.fit", "star06.fit", "star07.fit",
+    "star08.fit", "star09.fit", "star10.fit", "star11.fit", "star12.fit", "star13.fit", "star14.fit", "star15.fit",
+};
+
+const char *const TieStamps[] = { "tie_centered.fit", "tie_halfpixel.fit", "tie_saturated.fit" };
+
+const char *const FaintStamps[] = { "faint00.fit", "faint01.fit", "faint02.fit", "faint03.fit" };
+
+} // namespace
+
+TEST(StarHfrTest, MatchesSortedHfr)
+{
+    for (const char *name : StarStamps)
+    {
+        Stamp s;
+        ASSERT_TRUE(LoadStamp(name, &s)) << name;
+        Aperture ap = Collect(s, false);
+        ASSERT_GT(ap.pix.size(), 1u) << name;
+        EXPECT_NEAR(Hfd(ap.pix, ap.cx, ap.cy, ap.mass), SortedHfd(ap.pix, ap.cx, ap.cy, ap.mass), MaxHfdError) << name;
+    }
+}
+
+TEST(StarHfrTest, EqualRadii)
+{
+    for (const char *name : TieStamps)
+    {
+        Stamp s;
+        ASSERT_TRUE(LoadStamp(name, &s)) << name;
+        Aperture ap = Collect(s, false);
+
+        // about the centroid and about the pixel grid, where the symmetric
+        // stamps give many pixels at exactly the same radius
+        double const centers[][2] = {
+            { ap.cx, ap.cy },
+            { floor(ap.cx + 0.5), floor(ap.cy + 0.5) },
+            { floor(ap.cx) + 0.5, floor(ap.cy) + 0.5 },
+        };
+        bool ties = false;
+        for (const auto& c : centers)
+        {
+            ties = ties || HasTies(ap.pix, c[0], c[1]);
+            EXPECT_NEAR(Hfd(ap.pix, c[0], c[1], ap.mass), SortedHfd(ap.pix, c[0], c[1], ap.mass), MaxHfdError) << name;
+        }
+        EXPECT_TRUE(ties) << name;
+    }
+}
+
+TEST(StarHfrTest, NegativeMass)
+{
+    std::vector<const char *> names(std::begin(FaintStamps), std::end(FaintStamps));
+    names.insert(names.end(), std::begin(StarStamps), std::end(StarStamps));
+
+    unsigned int withNegative = 0;
+    for (const char *name : names)
+    {
+        Stamp s;
+        ASSERT_TRUE(LoadStamp(name, &s)) << name;
+        Aperture ap = Collect(s, true);
+        if (std::any_of(ap.pix.begin(), ap.pix.end(), [](const R2M& rm) { return rm.m < 0.0; }))
+            ++withNegative;
+        ASSERT_GT(ap.mass, 0.0) << name;
+        EXPECT_NEAR(Hfd(ap.pix, ap.cx, ap.cy, ap.mass), SortedHfd(ap.pix, ap.cx, ap.cy, ap.mass), MaxHfdError) << name;
+    }
+
+    // at least the faint stamps must have taken the negative-mass path
+    EXPECT_GE(withNegative, (unsigned int) (std::end(FaintStamps) - std::begin(FaintStamps)));
+}
+
+TEST(StarHfrTest, HotPixel)
+{
+    Stamp s;
+    ASSERT_TRUE(LoadStamp("hotpixel.fit", &s));
+    Aperture ap = Collect(s, false);
+    ASSERT_EQ(ap.pix.size(), 1u);
+    EXPECT_EQ(Hfd(ap.pix, ap.cx, ap.cy, ap.mass), 0.5);
+    EXPECT_EQ(SortedHfd(ap.pix, ap.cx, ap.cy, ap.mass), 0.5);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
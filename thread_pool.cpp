@@ -0,0 +1,190 @@
+/*
+ *  thread_pool.cpp
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "phd.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+
+// state shared by the threads working on one ParallelFor call
+struct ParallelJob
+{
+    const std::function<void(int)>& fn;
+    int count;
+    std::atomic<int> next;
+    int pending;            // helper tasks not yet finished, protected by lock
+    std::mutex lock;
+    std::condition_variable done;
+
+    ParallelJob(const std::function<void(int)>& f, int n) : fn(f), count(n), next(0), pending(0) { }
+
+    void Run()
+    {
+        int i;
+        while ((i = next++) < count)
+            fn(i);
+    }
+};
+
+class PoolImpl
+{
+    std::vector<std::thread> m_threads;
+    std::deque<ParallelJob *> m_queue;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+
+    void Worker();
+
+public:
+    PoolImpl();
+
+    unsigned int WorkerCount() const { return m_threads.size(); }
+    void Submit(ParallelJob *job, unsigned int helpers);
+};
+
+static thread_local bool s_inPool;
+static std::atomic<unsigned int> s_maxThreads(0);
+
+PoolImpl::PoolImpl()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    if (n > 1)
+    {
+        // the thread calling ParallelFor does its share of the work
+        for (unsigned int i = 0; i < n - 1; i++)
+            m_threads.push_back(std::thread(&PoolImpl::Worker, this));
+    }
+    Debug.Write(wxString::Format("ThreadPool: started %u worker threads\n", WorkerCount()));
+}
+
+void PoolImpl::Worker()
+{
+    s_inPool = true;
+
+    for (;;)
+    {
+        ParallelJob *job;
+        {
+            std::unique_lock<std::mutex> lck(m_lock);
+            m_cond.wait(lck, [this]() { return !m_queue.empty(); });
+            job = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        job->Run();
+
+        std::lock_guard<std::mutex> lck(job->lock);
+        if (--job->pending == 0)
+            job->done.notify_one();
+    }
+}
+
+void PoolImpl::Submit(ParallelJob *job, unsigned int helpers)
+{
+    job->pending = helpers;
+    {
+        std::lock_guard<std::mutex> lck(m_lock);
+        for (unsigned int i = 0; i < helpers; i++)
+            m_queue.push_back(job);
+    }
+    m_cond.notify_all();
+}
+
+// the pool lives for the life of the process; the worker threads are never
+// joined, so it is intentionally not destroyed at exit
+static PoolImpl *Pool()
+{
+    static PoolImpl *s_pool = new PoolImpl();
+    return s_pool;
+}
+
+} // namespace
+
+unsigned int ThreadPool::Concurrency()
+{
+    unsigned int n = Pool()->WorkerCount() + 1;
+    unsigned int max = s_maxThreads;
+    return max != 0 && max < n ? max : n;
+}
+
+void ThreadPool::SetMaxThreads(unsigned int n)
+{
+    s_maxThreads = n;
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& fn)
+{
+    if (count <= 0)
+        return;
+
+    unsigned int helpers = std::min((unsigned int) count, Concurrency()) - 1;
+
+    if (s_inPool || helpers == 0)
+    {
+        for (int i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    ParallelJob job(fn, count);
+    Pool()->Submit(&job, helpers);
+
+    job.Run();
+
+    // wait for the helpers to drop their references to the job, even the ones
+    // that were dequeued after the work ran out
+    std::unique_lock<std::mutex> lck(job.lock);
+    job.done.wait(lck, [&job]() { return job.pending == 0; });
+}
+
+int ThreadPool::RowBands(int rows, int minRows)
+{
+    int nbands = std::min((int) Concurrency() * 4, (rows + minRows - 1) / minRows);
+    return std::max(nbands, 1);
+}
+
+void ThreadPool::ParallelForRows(int rows, int nbands, const std::function<void(int, int, int)>& fn)
+{
+    ParallelFor(nbands, [&](int band) {
+        int y0 = (int)((long long) rows * band / nbands);
+        int y1 = (int)((long long) rows * (band + 1) / nbands);
+        fn(band, y0, y1);
+    });
+}
@@ -0,0 +1,67 @@
+/*
+ *  thread_pool.h
+ *  PHD Guiding
+ *
+ *  Copyright (c) 2024 openphdguiding.org
+ *  All rights reserved.
+ *
+ *  This source code is distributed under the following "BSD" license
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *    Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *    Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *    Neither the name of Craig Stark, Stark Labs nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef THREAD_POOL_INCLUDED
+#define THREAD_POOL_INCLUDED
+
+#include <functional>
+
+// A fixed pool of worker threads for data-parallel image processing.
+//
+// ParallelFor(count, fn) calls fn(i) for every i in [0, count), spreading the
+// calls over the pool and the calling thread, and returns when all of them
+// have completed. Calls made from inside a pool thread run serially on that
+// thread, so a parallel kernel may safely call another one.
+
+class ThreadPool
+{
+public:
+    // number of threads that run work items, including the calling thread
+    static unsigned int Concurrency();
+
+    static void ParallelFor(int count, const std::function<void(int)>& fn);
+
+    // number of bands to split `rows` image rows into: a few per thread to
+    // even out the load, but no band shorter than minRows
+    static int RowBands(int rows, int minRows);
+
+    // call fn(band, y0, y1) for each of nbands consecutive bands [y0, y1)
+    // covering rows [0, rows)
+    static void ParallelForRows(int rows, int nbands, const std::function<void(int, int, int)>& fn);
+
+    // limit the number of threads used by ParallelFor (for benchmarking).
+    // 0 restores the default (one per hardware thread)
+    static void SetMaxThreads(unsigned int n);
+};
+
+#endif // THREAD_POOL_INCLUDED
@@ -34,9 +34,16 @@
 
 #include "phd.h"
 #include "image_math.h"
+#include "image_simd.h"
 
 #include <algorithm>
 
+// Per-thread scratch space for CalcStats. The buffers are reused from frame
+// to frame so computing the stats does no heap allocation once the thread
+// has seen its first frame.
+static thread_local std::vector<int> s_histoBuf;
+static thread_local std::vector<unsigned short> s_filtRowBuf;
+
 class HistogramBuilder {
     public:
         int *histo;
@@ -44,16 +51,14 @@ class HistogramBuilder {
         int pixCount;
 
         HistogramBuilder() {
-            histo = new int[65536];
+            if (s_histoBuf.empty())
+                s_histoBuf.resize(65536);
+            histo = &s_histoBuf[0];
             MinADU = 0;
             MaxADU = 0;
             pixCount = 0;
         }
 
-        ~HistogramBuilder() {
-            delete[] histo;
-        }
-
         unsigned short median() const
         {
             int pixelLeft = pixCount / 2;
@@ -70,7 +75,6 @@ class HistogramBuilder {
         void scan(const unsigned short *t, int len)
         {
             if (pixCount == 0) {
-                unsigned short v = t[0];
                 // Initialization
                 MinADU = t[0];
                 MaxADU = t[0];
@@ -98,6 +102,161 @@ class HistogramBuilder {
         }
 };
 
+// 3x3 median filter one row of the stats window and fold it into the filtered min/max
+inline static void ScanFilteredRow(unsigned short *rowbuf, const ImageView& view, int y,
+                                   unsigned short *fmin, unsigned short *fmax)
+{
+    Median3Line(rowbuf, view, y);
+
+    unsigned short lo = *fmin;
+    unsigned short hi = *fmax;
+    for (int x = 0; x < view.rect.width; x++)
+    {
+        unsigned short const d = rowbuf[x];
+        lo = std::min(lo, d);
+        hi = std::max(hi, d);
+    }
+    *fmin = lo;
+    *fmax = hi;
+}
+
+struct BufferPoolImpl
+{
+    // keep at most this many idle buffers of any one size, and at most
+    // this many bytes of idle buffers overall
+    enum { MAX_IDLE_PER_SIZE = 4 };
+    static const size_t MAX_IDLE_BYTES = 256 * 1024 * 1024;
+
+    wxCriticalSection lock;
+    std::map<unsigned int, std::vector<unsigned short *>> idle;
+    ImageBufferPool::Stats stats;
+
+    BufferPoolImpl() { memset(&stats, 0, sizeof(stats)); }
+};
+
+static BufferPoolImpl& Pool()
+{
+    // intentionally leaked: images may still be released during static destruction
+    static BufferPoolImpl *s_pool = new BufferPoolImpl();
+    return *s_pool;
+}
+
+static unsigned short *AlignedAlloc(size_t bytes)
+{
+#if defined(__WINDOWS__)
+    return static_cast<unsigned short *>(_aligned_malloc(bytes, ImageBufferPool::ALIGNMENT));
+#else
+    void *p;
+    if (posix_memalign(&p, ImageBufferPool::ALIGNMENT, bytes) != 0)
+        return nullptr;
+    return static_cast<unsigned short *>(p);
+#endif
+}
+
+static void AlignedFree(unsigned short *p)
+{
+#if defined(__WINDOWS__)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+unsigned short *ImageBufferPool::Alloc(unsigned int npixels)
+{
+    size_t const bytes = (size_t) npixels * sizeof(unsigned short);
+    BufferPoolImpl& pool = Pool();
+
+    {
+        wxCriticalSectionLocker lck(pool.lock);
+
+        auto it = pool.idle.find(npixels);
+        if (it != pool.idle.end() && !it->second.empty())
+        {
+            unsigned short *buf = it->second.back();
+            it->second.pop_back();
+            ++pool.stats.hits;
+            pool.stats.pooledBytes -= bytes;
+            pool.stats.inUseBytes += bytes;
+            return buf;
+        }
+
+        ++pool.stats.misses;
+    }
+
+    unsigned short *buf = AlignedAlloc(bytes);
+    if (!buf)
+        return nullptr;
+
+    wxCriticalSectionLocker lck(pool.lock);
+    pool.stats.inUseBytes += bytes;
+    pool.stats.peakBytes = std::max(pool.stats.peakBytes, pool.stats.inUseBytes + pool.stats.pooledBytes);
+
+    return buf;
+}
+
+void ImageBufferPool::Free(unsigned short *buf, unsigned int npixels)
+{
+    if (!buf)
+        return;
+
+    size_t const bytes = (size_t) npixels * sizeof(unsigned short);
+    BufferPoolImpl& pool = Pool();
+
+    {
+        wxCriticalSectionLocker lck(pool.lock);
+
+        pool.stats.inUseBytes -= bytes;
+
+        std::vector<unsigned short *>& bufs = pool.idle[npixels];
+        if (bufs.size() < BufferPoolImpl::MAX_IDLE_PER_SIZE &&
+            pool.stats.pooledBytes + bytes <= BufferPoolImpl::MAX_IDLE_BYTES)
+        {
+            bufs.push_back(buf);
+            pool.stats.pooledBytes += bytes;
+            return;
+        }
+    }
+
+    AlignedFree(buf);
+}
+
+void ImageBufferPool::Purge()
+{
+    std::vector<unsigned short *> bufs;
+
+    {
+        BufferPoolImpl& pool = Pool();
+        wxCriticalSectionLocker lck(pool.lock);
+
+        for (auto it = pool.idle.begin(); it != pool.idle.end(); ++it)
+            bufs.insert(bufs.end(), it->second.begin(), it->second.end());
+        pool.idle.clear();
+        pool.stats.pooledBytes = 0;
+    }
+
+    for (auto it = bufs.begin(); it != bufs.end(); ++it)
+        AlignedFree(*it);
+}
+
+void ImageBufferPool::GetStats(Stats *stats)
+{
+    BufferPoolImpl& pool = Pool();
+    wxCriticalSectionLocker lck(pool.lock);
+    *stats = pool.stats;
+}
+
+void ImageBufferPool::LogStats()
+{
+    Stats st;
+    GetStats(&st);
+
+    unsigned int total = st.hits + st.misses;
+    Debug.Write(wxString::Format("ImageBufferPool: hits=%u misses=%u (%.1f%% hit) in use=%.1f MB pooled=%.1f MB peak=%.1f MB\n",
+        st.hits, st.misses, total ? 100.0 * st.hits / total : 0.0,
+        st.inUseBytes / 1048576.0, st.pooledBytes / 1048576.0, st.peakBytes / 1048576.0));
+}
+
 bool usImage::Init(const wxSize& size)
 {
     // Allocates space for image and sets params up
@@ -108,22 +267,22 @@ bool usImage::Init(const wxSize& size)
     Size = size;
     Subframe = wxRect(0, 0, 0, 0);
     MinADU = MaxADU = MedianADU = 0;
+    FiltStatsValid = false;
 
     if (NPixels != prev)
     {
-        delete[] ImageData;
+        ImageBufferPool::Free(ImageData, prev);
+        ImageData = nullptr;
 
         if (NPixels)
         {
-            ImageData = new unsigned short[NPixels];
+            ImageData = ImageBufferPool::Alloc(NPixels);
             if (!ImageData)
             {
                 NPixels = 0;
                 return true;
             }
         }
-        else
-            ImageData = nullptr;
     }
 
     return false;
@@ -134,91 +293,66 @@ void usImage::SwapImageData(usImage& other)
     unsigned short *t = ImageData;
     ImageData = other.ImageData;
     other.ImageData = t;
+    FiltStatsValid = other.FiltStatsValid = false;
 }
 
-void usImage::CalcStats()
+void usImage::CalcStats(bool filtStats)
 {
     if (!ImageData || !NPixels)
         return;
 
-    MinADU = 65535; MaxADU = 0;
-    FiltMin = 65535; FiltMax = 0;
-
-    if (Subframe.IsEmpty())
-    {
-        // full frame, no subframe
+    // single pass over the rows of the frame or subframe: the histogram (min,
+    // max, median) and the 3x3 median filtered min/max are computed together
+    // while the rows are still in cache
 
-        HistogramBuilder hb;
-        hb.scan(ImageData, NPixels);
-        MinADU = hb.MinADU;
-        MaxADU = hb.MaxADU;
-        MedianADU = hb.median();
+    ImageView const view = View();
+    wxRect const& win = view.rect;
 
-        unsigned short *tmpdata = new unsigned short[NPixels];
+    HistogramBuilder hb;
 
-        Median3(tmpdata, ImageData, Size, wxRect(Size));
+    FiltMin = 65535; FiltMax = 0;
+    FiltStatsValid = filtStats;
 
-        const unsigned short *src = tmpdata;
-        for (unsigned int i = 0; i < NPixels; i++)
-        {
-            unsigned short d = *src++;
-            if (d < FiltMin) FiltMin = d;
-            if (d > FiltMax) FiltMax = d;
-        }
+    if (filtStats && s_filtRowBuf.size() < (size_t) win.width)
+        s_filtRowBuf.resize(win.width);
 
-        delete[] tmpdata;
-    }
-    else
+    for (int y = 0; y < win.height; y++)
     {
-        // Subframe
+        hb.scan(view.Row(win.y + y) + win.x, win.width);
 
-        unsigned int pixcnt = Subframe.width * Subframe.height;
-        unsigned short *tmpdata = new unsigned short[pixcnt];
+        if (filtStats)
+            ScanFilteredRow(&s_filtRowBuf[0], view, y, &FiltMin, &FiltMax);
+    }
 
-        unsigned short *dst;
+    MinADU = hb.MinADU;
+    MaxADU = hb.MaxADU;
+    MedianADU = hb.median();
+}
 
-        dst = tmpdata;
-        for (int y = 0; y < Subframe.height; y++)
-        {
-            const unsigned short *src = ImageData + Subframe.x + (Subframe.y + y) * Size.GetWidth();
-            for (int x = 0; x < Subframe.width; x++)
-            {
-                unsigned short d = *src;
-                *dst++ = *src++;
-            }
-        }
+void usImage::CalcFiltStats()
+{
+    if (FiltStatsValid || !ImageData || !NPixels)
+        return;
 
-        HistogramBuilder hb;
-        hb.scan(tmpdata, pixcnt);
-        MinADU = hb.MinADU;
-        MaxADU = hb.MaxADU;
-        MedianADU = hb.median();
+    ImageView const view = View();
 
-        dst = new unsigned short[pixcnt];
+    if (s_filtRowBuf.size() < (size_t) view.rect.width)
+        s_filtRowBuf.resize(view.rect.width);
 
-        Median3(dst, tmpdata, Subframe.GetSize(), wxRect(Subframe.GetSize()));
+    FiltMin = 65535; FiltMax = 0;
 
-        const unsigned short *src = dst;
-        for (unsigned int i = 0; i < pixcnt; i++)
-        {
-            unsigned short d = *src++;
-            if (d < FiltMin) FiltMin = d;
-            if (d > FiltMax) FiltMax = d;
-        }
+    for (int y = 0; y < view.rect.height; y++)
+        ScanFilteredRow(&s_filtRowBuf[0], view, y, &FiltMin, &FiltMax);
 
-        delete[] dst;
-        delete[] tmpdata;
-    }
+    FiltStatsValid = true;
 }
 
-static unsigned char *buildGammaLookupTable(int blevel, int wlevel, double power)
+static void buildGammaLookupTable(unsigned char *result, int blevel, int wlevel, double power)
 {
-    unsigned char *result = new unsigned char[0x10000];
-
     if (blevel < 0) blevel = 0;
     if (wlevel < 0) wlevel = 0;
     if (blevel > 0xffff) blevel = 0xffff;
-    if (wlevel > 0xffff) blevel = 0xffff;
+    if (wlevel > 0xffff) wlevel = 0xffff;
 
     for (int i = 0; i <= blevel; ++i)
         result[i] = 0;
@@ -232,36 +366,54 @@ static unsigned char *buildGammaLookupTable(int blevel, int wlevel, double power
 
     for (int i = wlevel; i < 0x10000; ++i)
         result[i] = 255;
+}
 
-    return result;
+// The stretch rarely changes from one frame to the next, so keep the last
+// table instead of re-running pow() 64K times on every paint. Each rendering
+// thread has its own table.
+static const unsigned char *GammaLookupTable(int blevel, int wlevel, double power)
+{
+    static thread_local std::vector<unsigned char> s_lut;
+    static thread_local int s_blevel, s_wlevel;
+    static thread_local double s_power;
+
+    if (s_lut.empty() || blevel != s_blevel || wlevel != s_wlevel || power != s_power)
+    {
+        s_lut.resize(0x10000);
+        buildGammaLookupTable(&s_lut[0], blevel, wlevel, power);
+        s_blevel = blevel;
+        s_wlevel = wlevel;
+        s_power = power;
+    }
+
+    return &s_lut[0];
 }
 
 bool usImage::CopyToImage(wxImage **rawimg, int blevel, int wlevel, double power)
+{
+    return CopyToImage(rawimg, wxRect(Size), blevel, wlevel, power);
+}
+
+bool usImage::CopyToImage(wxImage **rawimg, const wxRect& rect, int blevel, int wlevel, double power)
 {
     wxImage *img = *rawimg;
 
     if (!img || !img->Ok() || (img->GetWidth() != Size.GetWidth()) || (img->GetHeight() != Size.GetHeight()) ) // can't reuse bitmap
     {
         delete img;
-        img = new wxImage(Size.GetWidth(), Size.GetHeight(), false);
+        // pixels outside rect are not written, so start them out black
+        img = new wxImage(Size.GetWidth(), Size.GetHeight(), rect != wxRect(Size));
     }
 
-    unsigned char *ImgPtr = img->GetData();
-    unsigned short *RawPtr = ImageData;
-
-    unsigned char *lutTable = buildGammaLookupTable(blevel, wlevel, power);
+    const unsigned char *lutTable = GammaLookupTable(blevel, wlevel, power);
 
-    for (unsigned int i = 0; i < NPixels; i++, RawPtr++ )
+    unsigned char *ImgPtr = img->GetData();
+    for (int y = rect.GetTop(); y <= rect.GetBottom(); y++)
     {
-        unsigned short v = *RawPtr;
-        unsigned char d = lutTable[v];
-        *ImgPtr++ = d;
-        *ImgPtr++ = d;
-        *ImgPtr++ = d;
+        GrayToRGBRow(ImgPtr + 3 * (y * Size.GetWidth() + rect.GetLeft()), &Pixel(rect.GetLeft(), y), lutTable,
+                     rect.GetWidth());
     }
 
-    delete[] lutTable;
-
     *rawimg = img;
     return false;
 }
@@ -35,6 +35,49 @@
 #ifndef USIMAGECLASS
 #define USIMAGECLASS
 
+// Pool of 64-byte aligned pixel buffers, keyed by pixel count. Frames are
+// allocated and released at the camera frame rate, and all of them have the
+// same size, so recycling the buffers avoids allocator churn and page faults
+// on large frames.
+class ImageBufferPool
+{
+public:
+    enum { ALIGNMENT = 64 };
+
+    struct Stats
+    {
+        unsigned int hits;
+        unsigned int misses;
+        size_t inUseBytes;
+        size_t pooledBytes;
+        size_t peakBytes;
+    };
+
+    static unsigned short *Alloc(unsigned int npixels);
+    static void Free(unsigned short *buf, unsigned int npixels);
+    static void Purge();
+    static void GetStats(Stats *stats);
+    static void LogStats();
+};
+
+// Read-only window onto a 16-bit image buffer. Pixels are addressed in the
+// coordinates of the parent image and rows are `stride` pixels apart, so a
+// subframe is processed in place instead of being copied out of the frame.
+struct ImageView
+{
+    const unsigned short *base;     // pixel (0, 0) of the parent image
+    int stride;                     // width of the parent image
+    wxRect rect;                    // the window, in parent image coordinates
+
+    ImageView(const unsigned short *base_, int stride_, const wxRect& rect_)
+        : base(base_), stride(stride_), rect(rect_) { }
+
+    // row y of the parent image, indexed by parent x coordinate
+    const unsigned short *Row(int y) const { return base + y * stride; }
+    const unsigned short& Pixel(int x, int y) const { return base[y * stride + x]; }
+    ImageView Sub(const wxRect& r) const { wxRect c(r); c.Intersect(rect); return ImageView(base, stride, c); }
+};
+
 class usImage
 {
 public:
@@ -47,6 +90,7 @@ public:
     unsigned short      MedianADU;
     unsigned short      FiltMin;
     unsigned short      FiltMax;
+    bool                FiltStatsValid; // FiltMin and FiltMax are up to date
     wxDateTime          ImgStartTime;
     int                 ImgExpDur;      // milli-seconds
     int                 ImgStackCnt;
@@ -63,6 +107,7 @@ public:
         MedianADU(0),
         FiltMin(0),
         FiltMax(0),
+        FiltStatsValid(false),
         ImgExpDur(0),
         ImgStackCnt(1),
         BitsPerPixel(0),
@@ -70,21 +115,26 @@ public:
         FrameNum(0)
     {
     }
-    ~usImage() { delete[] ImageData; }
+    ~usImage() { ImageBufferPool::Free(ImageData, NPixels); }
 
     bool                Init(const wxSize& size);
     bool                Init(int width, int height) { return Init(wxSize(width, height)); }
     void                SwapImageData(usImage& other);
-    void                CalcStats();
+    void                CalcStats(bool filtStats = true);
+    void                CalcFiltStats();
     void                InitImgStartTime();
     bool                CopyFrom(const usImage& src);
     bool                CopyToImage(wxImage **img, int blevel, int wlevel, double power);
+    bool                CopyToImage(wxImage **img, const wxRect& rect, int blevel, int wlevel, double power);
     bool                CopyFromImage(const wxImage& img);
     bool                Load(const wxString& fname);
     bool                Save(const wxString& fname, const wxString& hdrComment = wxEmptyString) const;
     bool                Rotate(double theta, bool mirror=false);
     unsigned short&     Pixel(int x, int y) { return ImageData[y * Size.x + x]; }
     const unsigned short& Pixel(int x, int y) const { return ImageData[y * Size.x + x]; }
+    // the subframe, or the whole frame if there is no subframe
+    ImageView           View() const { return View(Subframe.IsEmpty() ? wxRect(Size) : Subframe); }
+    ImageView           View(const wxRect& rect) const { return ImageView(ImageData, Size.GetWidth(), rect); }
     void                Clear(void);
 };
 
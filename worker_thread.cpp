@@ -85,7 +85,8 @@ void WorkerThread::EnqueueWorkerThreadTerminateRequest(void)
 
 /*************      Expose      **************************/
 
-void WorkerThread::EnqueueWorkerThreadExposeRequest(usImage *pImage, int exposureDuration, int exposureOptions, const wxRect& subframe)
+void WorkerThread::EnqueueWorkerThreadExposeRequest(usImage *pImage, int exposureDuration, int exposureOptions, const wxRect& subframe,
+                                                    unsigned int latencySeq)
 {
     m_interruptRequested &= ~INT_STOP;
 
@@ -100,6 +101,7 @@ void WorkerThread::EnqueueWorkerThreadExposeRequest(usImage *pImage, int exposur
     message.args.expose.options          = exposureOptions;
     message.args.expose.subframe         = subframe;
     message.args.expose.pSemaphore       = 0;
+    message.args.expose.latencySeq       = latencySeq;
 
     EnqueueMessage(message);
 }
@@ -172,6 +174,7 @@ CameraROITest(usImage *img)
 bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
 {
     bool bError = false;
+    LatencyFrameScope latencyFrame(req->latencySeq);
 
     try
     {
@@ -180,6 +183,8 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
             throw ERROR_INFO("Time lapse interrupted");
         }
 
+        LatencyMonitor::Mark(LAT_EXPOSE_START);
+
         if (pCamera->HasNonGuiCapture())
         {
             Debug.Write(wxString::Format("Handling exposure in thread, d=%d o=%x r=(%d,%d,%d,%d)\n", req->exposureDuration,
@@ -210,6 +215,7 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
         }
 
         Debug.Write("Exposure complete\n");
+        LatencyMonitor::Mark(LAT_CAPTURE_END);
 
         if (!bError)
         {
@@ -226,8 +232,12 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
                     Median3(*req->pImage);
                     break;
             }
+            LatencyMonitor::Mark(LAT_NR_END);
 
-            req->pImage->CalcStats();
+            // FiltMin/FiltMax are only needed for display, defer them to
+            // the GUI so they stay off the capture -> guide path
+            req->pImage->CalcStats(false);
+            LatencyMonitor::Mark(LAT_STATS_END);
         }
     }
     catch (const wxString& Msg)
@@ -239,11 +249,12 @@ bool WorkerThread::HandleExpose(EXPOSE_REQUEST *req)
     return bError;
 }
 
-void WorkerThread::SendWorkerThreadExposeComplete(usImage *pImage, bool bError)
+void WorkerThread::SendWorkerThreadExposeComplete(usImage *pImage, bool bError, unsigned int latencySeq)
 {
     wxThreadEvent *event = new wxThreadEvent(wxEVT_THREAD, MYFRAME_WORKER_THREAD_EXPOSE_COMPLETE);
     event->SetPayload<usImage *>(pImage);
     event->SetInt(bError);
+    event->SetExtraLong(latencySeq);
     wxQueueEvent(m_pFrame, event);
 }
 
@@ -264,6 +275,7 @@ void WorkerThread::EnqueueWorkerThreadMoveRequest(Mount *mount, const GuiderOffs
     message.args.move.ofs             = ofs;
     message.args.move.moveOptions     = moveOptions;
     message.args.move.semaphore       = nullptr;
+    message.args.move.latencySeq      = LatencyMonitor::ThreadFrame();
 
     EnqueueMessage(message);
 }
@@ -284,6 +296,7 @@ void WorkerThread::EnqueueWorkerThreadAxisMove(Mount *mount, const GUIDE_DIRECTI
     message.args.move.duration        = duration;
     message.args.move.moveOptions     = moveOptions;
     message.args.move.semaphore       = nullptr;
+    message.args.move.latencySeq      = LatencyMonitor::ThreadFrame();
 
     EnqueueMessage(message);
 }
@@ -430,7 +443,7 @@ wxThread::ExitCode WorkerThread::Entry()
                     m_skipSendExposeComplete = false;
                 }
                 else
-                    SendWorkerThreadExposeComplete(message.args.expose.pImage, bError);
+                    SendWorkerThreadExposeComplete(message.args.expose.pImage, bError, message.args.expose.latencySeq);
                 break;
 
             case REQUEST_MOVE: {
@@ -446,7 +459,10 @@ wxThread::ExitCode WorkerThread::Entry()
                                                  message.args.move.ofs.cameraOfs.X, message.args.move.ofs.cameraOfs.Y,
                                                  message.args.move.moveOptions));
 
+                LatencyFrameScope latencyFrame(message.args.move.latencySeq);
+                LatencyMonitor::Mark(LAT_MOVE_START);
                 HandleMove(&message.args.move);
+                LatencyMonitor::Mark(LAT_PULSE_END);
                 SendWorkerThreadMoveComplete(message.args.move);
                 break;
             }
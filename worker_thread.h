@@ -64,6 +64,7 @@ struct EXPOSE_REQUEST
     wxRect           subframe;
     bool             error;
     wxSemaphore     *pSemaphore;
+    unsigned int     latencySeq;
 };
 
 struct MOVE_REQUEST
@@ -76,6 +77,7 @@ struct MOVE_REQUEST
     Mount::MOVE_RESULT moveResult;
     GuiderOffset       ofs;
     wxSemaphore       *semaphore;
+    unsigned int       latencySeq;
 };
 
 struct MoveCompleteEvent : public wxThreadEvent
@@ -180,11 +182,12 @@ protected:
 
     /*************      Expose      **************************/
 public:
-    void EnqueueWorkerThreadExposeRequest(usImage *pImage, int exposureDuration, int exposureOptions, const wxRect& subframe);
+    void EnqueueWorkerThreadExposeRequest(usImage *pImage, int exposureDuration, int exposureOptions, const wxRect& subframe,
+                                          unsigned int latencySeq);
     void SetSkipExposeComplete();
 protected:
     bool HandleExpose(EXPOSE_REQUEST *args);
-    void SendWorkerThreadExposeComplete(usImage *pImage, bool bError);
+    void SendWorkerThreadExposeComplete(usImage *pImage, bool bError, unsigned int latencySeq);
     // in the frame class: void MyFrame::OnWorkerThreadExposeComplete(wxThreadEvent& event);
 
     /*************      Guide       **************************/